@@ -0,0 +1,23 @@
+# Package finder for the Wayland client library
+#  - WAYLAND_SCANNER is set to the wayland-scanner program, which
+#	generates code for protocol extensions
+
+# Define search directories depending on system
+if(CMAKE_COMPILER_IS_GNUCC)
+	set(_search_path_inc ENV CPATH)
+	set(_search_path_lib ENV LIBRARY_PATH)
+endif(CMAKE_COMPILER_IS_GNUCC)
+
+find_path(WAYLAND_INCLUDE_DIR wayland-client.h
+	HINTS ${_search_path_inc})
+find_library(WAYLAND_LIBRARIES wayland-client
+	HINTS ${_search_path_lib})
+find_program(WAYLAND_SCANNER wayland-scanner)
+
+mark_as_advanced(WAYLAND_INCLUDE_DIR)
+mark_as_advanced(WAYLAND_LIBRARIES)
+mark_as_advanced(WAYLAND_SCANNER)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(Wayland DEFAULT_MSG
+	WAYLAND_LIBRARIES WAYLAND_INCLUDE_DIR WAYLAND_SCANNER)
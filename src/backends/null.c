@@ -0,0 +1,202 @@
+#include "common.h"
+#include "gamma.h"
+#include "options.h"
+#include "systemtime.h"
+#include "null.h"
+
+/**\brief null method state */
+typedef struct {
+	/**\brief number of simulated crtcs */
+	int crtc_count;
+	/**\brief crtc number, -1 for all */
+	int crtc_num;
+	/**\brief length of gamma ramps */
+	int ramp_size;
+	/**\brief milliseconds each request takes */
+	float latency;
+	/**\brief record file, NULL when recording to memory */
+	/*@null@*/ FILE *file;
+	/**\brief records kept in memory */
+	/*@null@*/ null_record_s *records;
+	/**\brief number of records */
+	int record_count;
+	/**\brief allocated records */
+	int record_alloc;
+	/**\brief red and blue end points of the last ramp of each crtc */
+	/*@null@*/ uint16_t *ends;
+	/**\brief number of uploads */
+	unsigned long uploads;
+} null_state_t;
+
+static null_state_t state={0,-1,0,0.0f,NULL,NULL,0,0,NULL,0};
+
+int null_init(/*@unused@*/ int screen_num, int crtc_num,
+		/*@unused@*/ int save_ramps)
+{
+	char *file;
+	int i;
+
+	LOG(LOGINFO,_("Initializing Null backend"));
+	opt_get_null(&state.crtc_count,&state.ramp_size,&state.latency,&file);
+	if( crtc_num >= state.crtc_count ){
+		LOG(LOGERR,_("CRTC %d does not exist, only %d simulated."),
+				crtc_num,state.crtc_count);
+		return RET_FUN_FAILED;
+	}
+	state.crtc_num = crtc_num;
+	state.uploads = 0;
+	state.record_count = 0;
+	state.record_alloc = 0;
+	state.records = NULL;
+
+	/* Simulated displays start out with identity ramps */
+	state.ends = malloc(2*state.crtc_count*sizeof(uint16_t));
+	if( state.ends==NULL ){
+		perror("malloc");
+		return RET_FUN_FAILED;
+	}
+	for( i=0; i<2*state.crtc_count; ++i )
+		state.ends[i] = UINT16_MAX;
+
+	state.file = NULL;
+	if( file!=NULL ){
+		state.file = fopen(file,"wb");
+		if( (state.file==NULL)
+				|| (fwrite(NULL_RECORD_MAGIC,1,strlen(NULL_RECORD_MAGIC),
+						state.file)!=strlen(NULL_RECORD_MAGIC)) ){
+			LOG(LOGERR,_("Unable to open record file %s"),file);
+			(void)null_free();
+			return RET_FUN_FAILED;
+		}
+	}
+	LOG(LOGINFO,_("Simulating %d CRTCs, ramp size %d, %.3f ms per request"),
+			state.crtc_count,state.ramp_size,state.latency);
+	return RET_FUN_SUCCESS;
+}
+
+int null_free(void)
+{
+	int i;
+
+	LOG(LOGINFO,_("Null backend: %lu uploads"),state.uploads);
+	if( state.file!=NULL ){
+		if( fclose(state.file)!=0 )
+			LOG(LOGERR,_("Unable to write record file."));
+		state.file = NULL;
+	}
+	if( state.records!=NULL ){
+		for( i=0; i<state.record_count; ++i )
+			free(state.records[i].ramps);
+		free(state.records);
+		state.records = NULL;
+	}
+	state.record_count = 0;
+	state.record_alloc = 0;
+	free(state.ends);
+	state.ends = NULL;
+	return RET_FUN_SUCCESS;
+}
+
+// Appends an upload to the record file or the in-memory records
+static int null_record(int crtc, int temp, gamma_ramp_s ramp)
+{
+	null_record_s rec;
+	size_t bytes = 3*ramp.size*sizeof(uint16_t);
+
+	(void)systemtime_get_monotonic(&rec.time);
+	rec.crtc = crtc;
+	rec.temp = temp;
+	rec.size = ramp.size;
+	rec.ramps = NULL;
+
+	if( state.file!=NULL ){
+		int32_t header[3];
+		header[0] = (int32_t)rec.crtc;
+		header[1] = (int32_t)rec.temp;
+		header[2] = (int32_t)rec.size;
+		if( (fwrite(&rec.time,sizeof(rec.time),1,state.file)!=1)
+				|| (fwrite(header,sizeof(header),1,state.file)!=1)
+				|| (fwrite(ramp.all,bytes,1,state.file)!=1) ){
+			LOG(LOGERR,_("Unable to write record file."));
+			return RET_FUN_FAILED;
+		}
+		return RET_FUN_SUCCESS;
+	}
+
+	if( state.record_count==state.record_alloc ){
+		int alloc = state.record_alloc ? 2*state.record_alloc : 64;
+		null_record_s *grown = realloc(state.records,
+				alloc*sizeof(null_record_s));
+		if( grown==NULL ){
+			perror("realloc");
+			return RET_FUN_FAILED;
+		}
+		state.records = grown;
+		state.record_alloc = alloc;
+	}
+	rec.ramps = malloc(bytes);
+	if( rec.ramps==NULL ){
+		perror("malloc");
+		return RET_FUN_FAILED;
+	}
+	memcpy(rec.ramps,ramp.all,bytes);
+	state.records[state.record_count++] = rec;
+	return RET_FUN_SUCCESS;
+}
+
+// Simulates uploading ramps to one crtc
+static int null_send_crtc_gamma(int crtc, int temp)
+{
+	gamma_ramp_s ramp = gamma_ramp_fill(state.ramp_size,temp);
+
+	if( (ramp.all==NULL) || (state.ends==NULL) )
+		return RET_FUN_FAILED;
+	/* Crtc numbers of the null method are their own keys */
+	if( !gamma_gate_pass(crtc,ramp) )
+		return RET_FUN_SUCCESS;
+	if( state.latency>0.0f )
+		SLEEP(state.latency);
+	state.ends[2*crtc] = ramp.r[ramp.size-1];
+	state.ends[2*crtc+1] = ramp.b[ramp.size-1];
+	++state.uploads;
+	return null_record(crtc,temp,ramp);
+}
+
+int null_set_temperature(int temp, /*@unused@*/ gamma_s gamma)
+{
+	int i;
+
+	if( state.crtc_num>=0 )
+		return null_send_crtc_gamma(state.crtc_num,temp);
+	for( i=0; i<state.crtc_count; ++i )
+		if( !null_send_crtc_gamma(i,temp) )
+			return RET_FUN_FAILED;
+	return RET_FUN_SUCCESS;
+}
+
+int null_get_temperature(void)
+{
+	int crtc = state.crtc_num<0 ? 0 : state.crtc_num;
+
+	if( state.ends==NULL ){
+		LOG(LOGERR,_("Null backend not initialized."));
+		return RET_FUN_FAILED;
+	}
+	return gamma_find_temp(((float)state.ends[2*crtc])
+			/((float)state.ends[2*crtc+1]));
+}
+
+const null_record_s *null_get_records(int *count)
+{
+	*count = state.record_count;
+	return state.records;
+}
+
+int null_load_funcs(gamma_method_s *method){
+	method->func_init = &null_init;
+	method->func_end = &null_free;
+	method->func_set_temp = &null_set_temperature;
+	method->func_get_temp = &null_get_temperature;
+	method->name = "Null";
+	return RET_FUN_SUCCESS;
+}
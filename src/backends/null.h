@@ -0,0 +1,56 @@
+/**\file		null.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Null (headless) gamma interface
+ * \details Simulates CRTCs without touching any display and records every
+ * applied ramp, for benchmarking transitions and counting uploads. The
+ * record file starts with NULL_RECORD_MAGIC, followed by one record per
+ * upload in native byte order: time (double), CRTC, temperature and ramp
+ * size (32 bit ints each), then the red, green and blue ramps (uint16_t).
+ */
+
+#ifndef _REDSHIFT_NULL_H
+#define _REDSHIFT_NULL_H
+#ifdef ENABLE_NULL
+
+/**\brief Magic string at the start of record files */
+#define NULL_RECORD_MAGIC "RSGNULL1"
+
+/**\brief Ramp uploaded through the null method */
+typedef struct{
+	/**\brief Monotonic time of the upload in seconds */
+	double time;
+	/**\brief CRTC index */
+	int crtc;
+	/**\brief Temperature */
+	int temp;
+	/**\brief Size of each ramp */
+	int size;
+	/**\brief Red, green and blue ramps */
+	/*@null@*//*@owned@*/ uint16_t *ramps;
+} null_record_s;
+
+/**\brief Initialize null method from the --null configuration */
+int null_init(int screen_num, int crtc_num, int save_ramps);
+
+/**\brief Frees null method state and closes the record file */
+int null_free(void);
+
+/**\brief Simulates uploading ramps for a temperature */
+int null_set_temperature(int temp, gamma_s gamma);
+
+/**\brief Retrieves the temperature from the last uploaded ramp */
+int null_get_temperature(void);
+
+/**\brief Retrieves uploads recorded in memory
+ * \param count receives the number of records
+ * \return records, valid until null_free, NULL when recording to a file
+ */
+/*@null@*//*@observer@*/ const null_record_s *null_get_records(
+		/*@out@*/ int *count);
+
+/**\brief loads functions into methods structure */
+int null_load_funcs(gamma_method_s *method);
+
+#endif /*ENABLE_NULL*/
+#endif /* ! _REDSHIFT_NULL_H */
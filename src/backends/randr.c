@@ -4,8 +4,14 @@
 #include <xcb/randr.h>
 /*@end@*/
 #include "gamma.h"
+#include "options.h"
+#include "systemtime.h"
 #include "randr.h"
 
+/* CTM property: 3x3 S31.32 sign-magnitude values, each as two 32-bit
+   items with the low word first */
+#define RANDR_CTM_ITEMS	18
+
 /**\brief randr storage of crtc state info */
 typedef struct {
 	/**\brief crtc number */
@@ -14,6 +20,26 @@ typedef struct {
 	unsigned int ramp_size;
 	/**\brief pointer to saved gamma ramps */
 	/*@null@*/ uint16_t *saved_ramps;
+	/**\brief cookie of the last queued gamma update */
+	xcb_void_cookie_t set_cookie;
+	/**\brief set if set_cookie has not been checked yet */
+	int pending;
+	/**\brief set if the crtc has a mode, and so drives an output */
+	int active;
+	/**\brief outputs driven by the crtc */
+	/*@null@*/ xcb_randr_output_t *outputs;
+	/**\brief number of outputs */
+	int num_outputs;
+	/**\brief CTM support of all outputs, -1 if not probed yet */
+	int ctm;
+	/**\brief set if a CTM other than identity may be applied */
+	int ctm_applied;
+	/**\brief last CTM written, in property format */
+	uint32_t ctm_last[RANDR_CTM_ITEMS];
+	/**\brief cookies of the last queued CTM update, one per output */
+	/*@null@*/ xcb_void_cookie_t *ctm_cookies;
+	/**\brief set if ctm_cookies have not been checked yet */
+	int ctm_pending;
 } randr_crtc_state_t;
 
 /**\brief randr storage of state info */
@@ -28,30 +54,297 @@ typedef struct {
 	unsigned int crtc_count;
 	/**\brief state of crtcs*/
 	/*@null@*/ randr_crtc_state_t *crtcs;
+	/**\brief first event code of the RANDR extension */
+	uint8_t event_base;
+	/**\brief save ramps of CRTCs as they appear */
+	int save_ramps;
+	/**\brief last temperature applied since init or the last restore, 0
+	 * if none */
+	int last_temp;
+	/**\brief last gamma applied */
+	gamma_s last_gamma;
+	/**\brief RANDR_CHANGED_* flags of events queued while waiting for
+	 * replies, which leave nothing to read on the connection */
+	int changes;
+	/**\brief atom of the CTM output property, XCB_NONE if unknown */
+	xcb_atom_t ctm_atom;
 } randr_state_t;
 
 #define RANDR_VERSION_MAJOR  1
 #define RANDR_VERSION_MINOR  3
 
-static randr_state_t state={NULL,NULL,0,0,NULL};
+static randr_state_t state={NULL,NULL,0,0,NULL,0,0,0,{1.0f,1.0f,1.0f},0,XCB_NONE};
+
+/* Flags returned when draining events */
+#define RANDR_CHANGED_ENABLED	1
+#define RANDR_CHANGED_RESOURCES	2
+
+// Marks a CRTC active if it has a mode and drives at least one output
+static void randr_crtc_set_active(randr_crtc_state_t *crtc,
+		/*@null@*/ xcb_randr_get_crtc_info_reply_t *info_reply,
+		/*@null@*/ xcb_generic_error_t *info_error)
+{
+	if ( info_error || (info_reply==NULL) ) {
+		/* Drive the CRTC rather than risk leaving a display untinted */
+		LOG(LOGWARN, _("`%s' returned error %d\n"),
+			"RANDR Get CRTC Info",
+			info_error ? info_error->error_code : 0);
+		crtc->active = 1;
+	} else {
+		int num_outputs = xcb_randr_get_crtc_info_outputs_length(info_reply);
+		xcb_randr_output_t *outputs =
+			xcb_randr_get_crtc_info_outputs(info_reply);
+
+		crtc->active = (info_reply->mode != XCB_NONE)
+			&& (info_reply->num_outputs > 0);
+		if( (num_outputs != crtc->num_outputs) || ((num_outputs>0)
+				&& (memcmp(outputs,crtc->outputs,
+						num_outputs*sizeof(xcb_randr_output_t))!=0)) ){
+			/* Outputs changed, their CTM support is unknown */
+			free(crtc->outputs);
+			free(crtc->ctm_cookies);
+			crtc->ctm_cookies = NULL;
+			crtc->ctm_pending = 0;
+			crtc->ctm = -1;
+			memset(crtc->ctm_last,0,sizeof(crtc->ctm_last));
+			crtc->num_outputs = 0;
+			crtc->outputs = malloc((num_outputs+1)
+					* sizeof(xcb_randr_output_t));
+			if( crtc->outputs!=NULL ){
+				memcpy(crtc->outputs,outputs,
+						num_outputs*sizeof(xcb_randr_output_t));
+				crtc->num_outputs = num_outputs;
+			}
+		}
+	}
+}
+
+// Frees memory owned by a CRTC state
+static void randr_crtc_free(randr_crtc_state_t *crtc)
+{
+	free(crtc->saved_ramps);
+	crtc->saved_ramps = NULL;
+	free(crtc->outputs);
+	crtc->outputs = NULL;
+	crtc->num_outputs = 0;
+	free(crtc->ctm_cookies);
+	crtc->ctm_cookies = NULL;
+}
+
+// Stores ramp size and saved ramps of a new CRTC from its replies
+static int randr_init_crtc(randr_crtc_state_t *crtc,
+		/*@null@*/ xcb_randr_get_crtc_gamma_size_reply_t *size_reply,
+		/*@null@*/ xcb_generic_error_t *size_error,
+		/*@null@*/ xcb_randr_get_crtc_gamma_reply_t *gamma_reply,
+		/*@null@*/ xcb_generic_error_t *gamma_error,
+		int save_ramps)
+{
+	unsigned int ramp_size;
+	uint16_t *gamma_r;
+	uint16_t *gamma_g;
+	uint16_t *gamma_b;
+
+	if ( size_error || (size_reply==NULL) ) {
+		LOG(LOGERR, _("`%s' returned error %d\n"),
+			"RANDR Get CRTC Gamma Size",
+			size_error ? size_error->error_code : 0);
+		return RET_FUN_FAILED;
+	}
+
+	ramp_size = (unsigned int)size_reply->size;
+	crtc->ramp_size = ramp_size;
+
+	if (ramp_size == 0) {
+		LOG(LOGERR, _("Gamma ramp size too small: %i\n"),
+			ramp_size);
+		return RET_FUN_FAILED;
+	}
+
+	if( !save_ramps )
+		return RET_FUN_SUCCESS;
+
+	if ( gamma_error || (gamma_reply==NULL) ) {
+		LOG(LOGERR, _("`%s' returned error %d\n"),
+			"RANDR Get CRTC Gamma",
+			gamma_error ? gamma_error->error_code : 0);
+		return RET_FUN_FAILED;
+	}
+
+	gamma_r = xcb_randr_get_crtc_gamma_red(gamma_reply);
+	gamma_g = xcb_randr_get_crtc_gamma_green(gamma_reply);
+	gamma_b = xcb_randr_get_crtc_gamma_blue(gamma_reply);
+
+	/* Allocate space for saved gamma ramps */
+	crtc->saved_ramps = malloc(3*ramp_size*sizeof(uint16_t));
+	if (crtc->saved_ramps == NULL) {
+		perror("malloc");
+		return RET_FUN_FAILED;
+	}
+
+	/* Copy gamma ramps into CRTC state */
+	/*@i6@*/memcpy(crtc->saved_ramps+0*ramp_size, gamma_r,
+	       ramp_size*sizeof(uint16_t));
+	memcpy(crtc->saved_ramps+1*ramp_size, gamma_g,
+	       ramp_size*sizeof(uint16_t));
+	memcpy(crtc->saved_ramps+2*ramp_size, gamma_b,
+	       ramp_size*sizeof(uint16_t));
+	return RET_FUN_SUCCESS;
+}
+
+// Rebuilds CRTC state from screen resources. CRTCs that are still present
+// keep their state, only new ones have their ramps queried. All requests
+// go out before any reply is waited on.
+static int randr_load_crtcs(
+		xcb_randr_get_screen_resources_current_reply_t *res_reply)
+{
+	unsigned int count = (unsigned int)res_reply->num_crtcs;
+	xcb_randr_crtc_t *ids;
+	randr_crtc_state_t *crtcs;
+	int *is_new;
+	xcb_randr_get_crtc_info_cookie_t *info_cookies;
+	xcb_randr_get_crtc_gamma_size_cookie_t *size_cookies;
+	xcb_randr_get_crtc_gamma_cookie_t *gamma_cookies;
+	unsigned int i,j;
+	int active_count=0;
+	int ret=RET_FUN_SUCCESS;
+
+	/* Keep room for at least one entry so an empty list is not NULL */
+	crtcs = malloc((count+1) * sizeof(randr_crtc_state_t));
+	is_new = malloc((count+1) * sizeof(int));
+	info_cookies = malloc((count+1)
+			* sizeof(xcb_randr_get_crtc_info_cookie_t));
+	size_cookies = malloc((count+1)
+			* sizeof(xcb_randr_get_crtc_gamma_size_cookie_t));
+	gamma_cookies = malloc((count+1)
+			* sizeof(xcb_randr_get_crtc_gamma_cookie_t));
+	if ( (crtcs == NULL) || (is_new == NULL) || (info_cookies == NULL)
+			|| (size_cookies == NULL) || (gamma_cookies == NULL) ) {
+		perror("malloc");
+		free(crtcs);
+		free(is_new);
+		free(info_cookies);
+		free(size_cookies);
+		free(gamma_cookies);
+		return RET_FUN_FAILED;
+	}
+
+	ids = xcb_randr_get_screen_resources_current_crtcs(res_reply);
+
+	/* Request mode of all CRTCs, plus the size of gamma ramps and the
+	   current ramps (if they are to be restored at program exit) of
+	   new ones. */
+	for (i = 0; i < count; i++) {
+		is_new[i] = 1;
+		for (j = 0; (state.crtcs!=NULL) && (j < state.crtc_count); j++) {
+			if( state.crtcs[j].crtc == ids[i] ){
+				crtcs[i] = state.crtcs[j];
+				/* Ownership of buffers moves to the new list */
+				state.crtcs[j].saved_ramps = NULL;
+				state.crtcs[j].outputs = NULL;
+				state.crtcs[j].num_outputs = 0;
+				state.crtcs[j].ctm_cookies = NULL;
+				is_new[i] = 0;
+				break;
+			}
+		}
+		if( is_new[i] ){
+			crtcs[i].crtc = ids[i];
+			crtcs[i].ramp_size = 0;
+			crtcs[i].saved_ramps = NULL;
+			crtcs[i].active = 0;
+			crtcs[i].outputs = NULL;
+			crtcs[i].num_outputs = 0;
+			crtcs[i].ctm = -1;
+			crtcs[i].ctm_applied = 0;
+			memset(crtcs[i].ctm_last,0,sizeof(crtcs[i].ctm_last));
+			crtcs[i].ctm_cookies = NULL;
+			size_cookies[i] = xcb_randr_get_crtc_gamma_size(state.conn,
+					ids[i]);
+			if( state.save_ramps )
+				gamma_cookies[i] = xcb_randr_get_crtc_gamma(
+						state.conn, ids[i]);
+		}
+		crtcs[i].pending = 0;
+		crtcs[i].ctm_pending = 0;
+		info_cookies[i] = xcb_randr_get_crtc_info(state.conn,
+				ids[i], res_reply->config_timestamp);
+	}
+
+	/* Collect replies, draining all of them even after a failure */
+	for (i = 0; i < count; i++) {
+		xcb_generic_error_t *info_error;
+		xcb_randr_get_crtc_info_reply_t *info_reply;
+
+		if( is_new[i] ){
+			xcb_generic_error_t *size_error;
+			xcb_generic_error_t *gamma_error=NULL;
+			xcb_randr_get_crtc_gamma_size_reply_t *size_reply;
+			xcb_randr_get_crtc_gamma_reply_t *gamma_reply=NULL;
+
+			size_reply = xcb_randr_get_crtc_gamma_size_reply(
+					state.conn, size_cookies[i],
+					/*@i1@*/&size_error);
+			if( state.save_ramps )
+				gamma_reply = xcb_randr_get_crtc_gamma_reply(
+						state.conn, gamma_cookies[i],
+						&gamma_error);
+			if( !randr_init_crtc(&crtcs[i],size_reply,size_error,
+						gamma_reply,gamma_error,
+						state.save_ramps) ){
+				/* Never drive a CRTC we know nothing about */
+				crtcs[i].ramp_size = 0;
+				ret = RET_FUN_FAILED;
+			}
+			free(size_reply);
+			free(size_error);
+			free(gamma_reply);
+			free(gamma_error);
+		}
+
+		info_reply = xcb_randr_get_crtc_info_reply(state.conn,
+				info_cookies[i], /*@i1@*/&info_error);
+		randr_crtc_set_active(&crtcs[i],info_reply,info_error);
+		if( crtcs[i].ramp_size == 0 )
+			crtcs[i].active = 0;
+		if( crtcs[i].active )
+			++active_count;
+		free(info_reply);
+		free(info_error);
+	}
+	free(is_new);
+	free(info_cookies);
+	free(size_cookies);
+	free(gamma_cookies);
+
+	/* Drop state of CRTCs that went away */
+	if( state.crtcs!=NULL ){
+		for (j = 0; j < state.crtc_count; j++)
+			randr_crtc_free(&state.crtcs[j]);
+		free(state.crtcs);
+	}
+	state.crtcs = crtcs;
+	state.crtc_count = count;
+
+	if( (state.crtc_num >= 0) && ((unsigned int)state.crtc_num >= count) )
+		LOG(LOGWARN,_("CRTC %d does not exist, only %u found."),
+				state.crtc_num,count);
+	LOG(LOGINFO,_("%d of %u CRTCs active"),active_count,count);
+	return ret;
+}
 
-int randr_init(int screen_num, int crtc_num)
+int randr_init(int screen_num, int crtc_num, int save_ramps)
 {
 	xcb_generic_error_t *error;
 	xcb_randr_query_version_cookie_t ver_cookie;
 	xcb_randr_query_version_reply_t *ver_reply;
 	const xcb_setup_t *setup;
 	int i;
+	int ret;
 	xcb_screen_iterator_t iter;
 	xcb_randr_get_screen_resources_current_cookie_t res_cookie;
 	xcb_randr_get_screen_resources_current_reply_t *res_reply;
-	xcb_randr_crtc_t *crtcs;
-	unsigned int ramp_size;
-	xcb_randr_get_crtc_gamma_cookie_t gamma_get_cookie;
-	xcb_randr_get_crtc_gamma_reply_t *gamma_get_reply;
-	uint16_t *gamma_r;
-	uint16_t *gamma_g;
-	uint16_t *gamma_b;
+	xcb_intern_atom_cookie_t atom_cookie;
+	xcb_intern_atom_reply_t *atom_reply;
 	
 	/* Open X server connection */
 	int preferred_screen;
@@ -62,38 +355,19 @@ int randr_init(int screen_num, int crtc_num)
 		return RET_FUN_FAILED;
 	}
 	state.conn = xcb_connect(NULL, &preferred_screen);
-
-	if (screen_num < 0)
-		screen_num = preferred_screen;
-
-	/* Query RandR version */
-	ver_cookie=xcb_randr_query_version(state.conn,
-			RANDR_VERSION_MAJOR,RANDR_VERSION_MINOR);
-	ver_reply = xcb_randr_query_version_reply(state.conn,
-			ver_cookie, &error);
-
-	if (error) {
-		LOG(LOGERR, _("`%s' returned error %d\n"),
-			"RANDR Query Version", error->error_code);
-		free(ver_reply);
-		xcb_disconnect(state.conn);
+	if( xcb_connection_has_error(state.conn) ){
+		LOG(LOGERR,_("Unable to connect to X server."));
+		(void)randr_free();
 		return RET_FUN_FAILED;
 	}
 
-	if (ver_reply->major_version < RANDR_VERSION_MAJOR ||
-	    ver_reply->minor_version < RANDR_VERSION_MINOR) {
-		LOG(LOGERR, _("Unsupported RANDR version (%u.%u)\n"),
-			ver_reply->major_version, ver_reply->minor_version);
-		free(ver_reply);
-		xcb_disconnect(state.conn);
-		return RET_FUN_FAILED;
-	}
-
-	free(ver_reply);
+	if (screen_num < 0)
+		screen_num = preferred_screen;
 
 	/* Get screen */
 	setup = xcb_get_setup(state.conn);
 	iter = xcb_setup_roots_iterator(setup);
+	state.screen = NULL;
 
 	for (i = 0; iter.rem > 0; i++) {
 		if (i == screen_num) {
@@ -106,199 +380,453 @@ int randr_init(int screen_num, int crtc_num)
 	if (state.screen == NULL) {
 		LOG(LOGERR, _("Screen %i could not be found.\n"),
 			screen_num);
-		xcb_disconnect(state.conn);
+		(void)randr_free();
 		return RET_FUN_FAILED;
 	}
 
-	/* Get list of CRTCs for the screen */
+	/* Query RandR version and the list of CRTCs in one round-trip.
+	   Notifications are selected before the list is read so no change
+	   can slip in between. */
+	ver_cookie=xcb_randr_query_version(state.conn,
+			RANDR_VERSION_MAJOR,RANDR_VERSION_MINOR);
+	(void)xcb_randr_select_input(state.conn, state.screen->root,
+			XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE
+			| XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE
+			| XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
 	res_cookie = xcb_randr_get_screen_resources_current(state.conn,
 					state.screen->root);
+	atom_cookie = xcb_intern_atom(state.conn, 1,
+			(uint16_t)strlen("CTM"), "CTM");
+	ver_reply = xcb_randr_query_version_reply(state.conn,
+			ver_cookie, &error);
+
+	if (error || (ver_reply==NULL)) {
+		LOG(LOGERR, _("`%s' returned error %d\n"),
+			"RANDR Query Version", error ? error->error_code : 0);
+		free(error);
+		free(ver_reply);
+		xcb_discard_reply(state.conn, res_cookie.sequence);
+		xcb_discard_reply(state.conn, atom_cookie.sequence);
+		(void)randr_free();
+		return RET_FUN_FAILED;
+	}
+
+	if (ver_reply->major_version < RANDR_VERSION_MAJOR ||
+	    ver_reply->minor_version < RANDR_VERSION_MINOR) {
+		LOG(LOGERR, _("Unsupported RANDR version (%u.%u)\n"),
+			ver_reply->major_version, ver_reply->minor_version);
+		free(ver_reply);
+		xcb_discard_reply(state.conn, res_cookie.sequence);
+		xcb_discard_reply(state.conn, atom_cookie.sequence);
+		(void)randr_free();
+		return RET_FUN_FAILED;
+	}
+
+	free(ver_reply);
+
 	res_reply = xcb_randr_get_screen_resources_current_reply(state.conn,
 					res_cookie,
 					/*@i1@*/&error);
 
-	if (error) {
+	if (error || (res_reply==NULL)) {
 		LOG(LOGERR, _("`%s' returned error %d\n"),
 			"RANDR Get Screen Resources Current",
-			error->error_code);
+			error ? error->error_code : 0);
+		free(error);
 		free(res_reply);
-		xcb_disconnect(state.conn);
+		xcb_discard_reply(state.conn, atom_cookie.sequence);
+		(void)randr_free();
 		return RET_FUN_FAILED;
 	}
 
+	/* Only drivers with color management have created the CTM atom */
+	atom_reply = xcb_intern_atom_reply(state.conn, atom_cookie, NULL);
+	state.ctm_atom = atom_reply ? atom_reply->atom : XCB_NONE;
+	free(atom_reply);
+
 	state.crtc_num = crtc_num;
-	state.crtc_count = (unsigned int)res_reply->num_crtcs;
-	if( state.crtcs!=NULL )
-		free(state.crtcs);
-	state.crtcs = malloc(state.crtc_count * sizeof(randr_crtc_state_t));
-	if (state.crtcs == NULL) {
-		perror("malloc");
-		free(res_reply);
-		xcb_disconnect(state.conn);
-		/*@i1@*/return RET_FUN_FAILED;
+	state.save_ramps = save_ramps;
+	state.last_temp = 0;
+	ret = randr_load_crtcs(res_reply);
+	free(res_reply);
+
+	if( !ret ){
+		(void)randr_free();
+		return RET_FUN_FAILED;
 	}
+	state.event_base = xcb_get_extension_data(state.conn,
+			&xcb_randr_id)->first_event;
+	/*@i1@*/return ret;
+}
 
-	crtcs = xcb_randr_get_screen_resources_current_crtcs(res_reply);
+// Applies pending CRTC change notifications to the set of active CRTCs,
+// returns RANDR_CHANGED_* flags for what needs to be caught up on
+static int randr_drain_events(void)
+{
+	xcb_generic_event_t *event;
+	int changed=state.changes;
 
-	/* Save CRTC identifier in state */
-	for (i = 0; i < ((int)state.crtc_count); i++) {
-		state.crtcs[i].crtc = crtcs[i];
+	state.changes = 0;
+	while( (event=xcb_poll_for_event(state.conn))!=NULL ){
+		xcb_randr_notify_event_t *notify;
+		uint8_t type = event->response_type & ~0x80;
+		int found=0;
+		int i;
+
+		if( type == state.event_base+XCB_RANDR_SCREEN_CHANGE_NOTIFY ){
+			changed |= RANDR_CHANGED_RESOURCES;
+			free(event);
+			continue;
+		}
+		if( type != state.event_base+XCB_RANDR_NOTIFY ){
+			free(event);
+			continue;
+		}
+		notify = (xcb_randr_notify_event_t*)event;
+		if( notify->subCode == XCB_RANDR_NOTIFY_OUTPUT_CHANGE ){
+			/* Outputs attached to CRTCs may have changed */
+			changed |= RANDR_CHANGED_RESOURCES;
+			free(event);
+			continue;
+		}
+		if( notify->subCode != XCB_RANDR_NOTIFY_CRTC_CHANGE ){
+			free(event);
+			continue;
+		}
+		for (i = 0; i < ((int)state.crtc_count); i++) {
+			int active;
+			if( state.crtcs[i].crtc != notify->u.cc.crtc )
+				continue;
+			found = 1;
+			active = (notify->u.cc.mode != XCB_NONE)
+				&& (state.crtcs[i].ramp_size > 0);
+			if( active && !state.crtcs[i].active ){
+				/* Mode set may have reset the ramps */
+				LOG(LOGINFO,_("CRTC %d enabled"),i);
+				changed |= RANDR_CHANGED_ENABLED;
+			}else if( !active && state.crtcs[i].active )
+				LOG(LOGINFO,_("CRTC %d disabled"),i);
+			state.crtcs[i].active = active;
+		}
+		if( !found )
+			changed |= RANDR_CHANGED_RESOURCES;
+		free(event);
 	}
+	return changed;
+}
 
-	free(res_reply);
+// Brings CRTC state up to date with the server,
+// returns non-zero if ramps need to be uploaded again
+static int randr_handle_events(void)
+{
+	xcb_randr_get_screen_resources_current_cookie_t res_cookie;
+	xcb_randr_get_screen_resources_current_reply_t *res_reply;
+	xcb_generic_error_t *error;
+	int changed = randr_drain_events();
+
+	if( changed & RANDR_CHANGED_RESOURCES ){
+		LOG(LOGINFO,_("Screen configuration changed, refreshing CRTCs"));
+		res_cookie = xcb_randr_get_screen_resources_current(state.conn,
+				state.screen->root);
+		res_reply = xcb_randr_get_screen_resources_current_reply(
+				state.conn, res_cookie, &error);
+		if (error || (res_reply==NULL)) {
+			LOG(LOGERR, _("`%s' returned error %d"),
+				"RANDR Get Screen Resources Current",
+				error ? error->error_code : 0);
+			free(error);
+			free(res_reply);
+		}else{
+			(void)randr_load_crtcs(res_reply);
+			free(res_reply);
+		}
+		state.changes |= randr_drain_events();
+	}
+	if( changed )
+		gamma_gate_reset();
+	return changed;
+}
+
+// Finds out which active CRTCs take a CTM on all of their outputs,
+// querying every unprobed output in one round-trip
+static void randr_probe_ctm(void)
+{
+	xcb_randr_query_output_property_cookie_t *cookies;
+	int count=0;
+	int i,k,n;
+
+	for (i = 0; i < ((int)state.crtc_count); i++) {
+		if( (state.crtcs[i].ctm != -1) || !state.crtcs[i].active )
+			continue;
+		if( (state.ctm_atom == XCB_NONE) || (state.crtcs[i].num_outputs == 0) )
+			state.crtcs[i].ctm = 0;
+		else
+			count += state.crtcs[i].num_outputs;
+	}
+	if( count == 0 )
+		return;
+	cookies = malloc(count*sizeof(xcb_randr_query_output_property_cookie_t));
+	if( cookies == NULL ){
+		perror("malloc");
+		return;
+	}
 
-	/* Save size and gamma ramps of all CRTCs.
-	   Current gamma ramps are saved so we can restore them
-	   at program exit. */
+	n = 0;
 	for (i = 0; i < ((int)state.crtc_count); i++) {
-		/*@i2@*/xcb_randr_crtc_t crtc = state.crtcs[i].crtc;
+		if( (state.crtcs[i].ctm != -1) || !state.crtcs[i].active )
+			continue;
+		for (k = 0; k < state.crtcs[i].num_outputs; k++)
+			cookies[n++] = xcb_randr_query_output_property(state.conn,
+					state.crtcs[i].outputs[k], state.ctm_atom);
+	}
 
-		/* Request size of gamma ramps */
-		xcb_randr_get_crtc_gamma_size_cookie_t gamma_size_cookie =
-			xcb_randr_get_crtc_gamma_size(state.conn, crtc);
-		xcb_randr_get_crtc_gamma_size_reply_t *gamma_size_reply =
-			xcb_randr_get_crtc_gamma_size_reply(state.conn,
-							    gamma_size_cookie,
-							    /*@i1@*/&error);
+	n = 0;
+	for (i = 0; i < ((int)state.crtc_count); i++) {
+		if( (state.crtcs[i].ctm != -1) || !state.crtcs[i].active )
+			continue;
+		state.crtcs[i].ctm = 1;
+		for (k = 0; k < state.crtcs[i].num_outputs; k++) {
+			xcb_randr_query_output_property_reply_t *reply;
+			xcb_generic_error_t *error;
 
-		if (error) {
-			LOG(LOGERR, _("`%s' returned error %d\n"),
-				"RANDR Get CRTC Gamma Size",
-				error->error_code);
-			free(gamma_size_reply);
-			xcb_disconnect(state.conn);
-			/*@i1@*/return RET_FUN_FAILED;
+			reply = xcb_randr_query_output_property_reply(state.conn,
+					cookies[n++], &error);
+			if( error || (reply==NULL) || reply->immutable )
+				state.crtcs[i].ctm = 0;
+			free(reply);
+			free(error);
 		}
+		LOG(LOGINFO,_("CRTC %d: color transform matrix %s"),i,
+				state.crtcs[i].ctm ? _("supported") : _("not supported"));
+	}
+	free(cookies);
+}
 
-		ramp_size = (unsigned int)gamma_size_reply->size;
-		state.crtcs[i].ramp_size = ramp_size;
+// Queues a CTM scaling each channel on all outputs of a CRTC,
+// skipped if the CRTC already has it
+static int randr_send_crtc_ctm(int crtc_num, const float *scale)
+{
+	randr_crtc_state_t *crtc = &state.crtcs[crtc_num];
+	uint32_t items[RANDR_CTM_ITEMS];
+	int c,k;
 
-		free(gamma_size_reply);
+	memset(items,0,sizeof(items));
+	for( c=0; c<3; ++c ){
+		/* Diagonal entries, always positive so sign bit stays clear */
+		uint64_t fixed = (uint64_t)(MAX(scale[c],0.0f)*4294967296.0+0.5);
+		items[2*(c*3+c)] = (uint32_t)(fixed & 0xFFFFFFFFu);
+		items[2*(c*3+c)+1] = (uint32_t)(fixed >> 32);
+	}
+	if( memcmp(items,crtc->ctm_last,sizeof(items))==0 )
+		return RET_FUN_SUCCESS;
 
-		if (ramp_size == 0) {
-			LOG(LOGERR, _("Gamma ramp size too small: %i\n"),
-				ramp_size);
-			xcb_disconnect(state.conn);
-			/*@i1@*/return RET_FUN_FAILED;
+	if( crtc->ctm_cookies == NULL ){
+		crtc->ctm_cookies = malloc((crtc->num_outputs+1)
+				* sizeof(xcb_void_cookie_t));
+		if( crtc->ctm_cookies == NULL ){
+			perror("malloc");
+			return RET_FUN_FAILED;
 		}
+	}
+	/* Queue new matrices, errors are collected later */
+	for( k=0; k<crtc->num_outputs; ++k )
+		crtc->ctm_cookies[k] = xcb_randr_change_output_property_checked(
+				state.conn, crtc->outputs[k], state.ctm_atom,
+				XCB_ATOM_INTEGER, 32, XCB_PROP_MODE_REPLACE,
+				RANDR_CTM_ITEMS, items);
+	crtc->ctm_pending = 1;
+	memcpy(crtc->ctm_last,items,sizeof(items));
+	LOG(LOGVERBOSE,_("Set CTM[CRTC %d], scale: (%f,%f,%f)"),
+			crtc_num,scale[0],scale[1],scale[2]);
+	return RET_FUN_SUCCESS;
+}
 
-		/* Request current gamma ramps */
-		gamma_get_cookie = xcb_randr_get_crtc_gamma(state.conn, crtc);
-		gamma_get_reply = xcb_randr_get_crtc_gamma_reply(state.conn,
-						       gamma_get_cookie,
-						       &error);
+// Scale of a channel in the last CTM sent to a CRTC
+static double randr_ctm_scale(const randr_crtc_state_t *crtc, int c)
+{
+	uint64_t fixed = ((uint64_t)crtc->ctm_last[2*(c*3+c)+1] << 32)
+		| crtc->ctm_last[2*(c*3+c)];
+	return (double)fixed/4294967296.0;
+}
 
-		if (error) {
-			LOG(LOGERR, _("`%s' returned error %d\n"),
-				"RANDR Get CRTC Gamma", error->error_code);
-			free(gamma_get_reply);
-			xcb_disconnect(state.conn);
-			/*@i1@*/return RET_FUN_FAILED;
-		}
+// Collects errors of queued CTM updates. CRTCs with a rejected CTM fall
+// back to ramps, returns the number of such CRTCs.
+static int randr_check_ctm(void)
+{
+	xcb_generic_error_t *error;
+	int failed=0;
+	int i,k;
 
-		gamma_r = xcb_randr_get_crtc_gamma_red(gamma_get_reply);
-		gamma_g = xcb_randr_get_crtc_gamma_green(gamma_get_reply);
-		gamma_b = xcb_randr_get_crtc_gamma_blue(gamma_get_reply);
+	for (i = 0; i < ((int)state.crtc_count); i++) {
+		randr_crtc_state_t *crtc = &state.crtcs[i];
+		int rejected=0;
 
-		/* Allocate space for saved gamma ramps */
-		state.crtcs[i].saved_ramps =
-			malloc(3*ramp_size*sizeof(uint16_t));
-		if (state.crtcs[i].saved_ramps == NULL) {
-			perror("malloc");
-			free(gamma_get_reply);
-			xcb_disconnect(state.conn);
-			/*@i1@*/return RET_FUN_FAILED;
+		if( !crtc->ctm_pending || (crtc->ctm_cookies==NULL) )
+			continue;
+		crtc->ctm_pending = 0;
+		for( k=0; k<crtc->num_outputs; ++k ){
+			error = xcb_request_check(state.conn, crtc->ctm_cookies[k]);
+			if( error ){
+				LOG(LOGWARN, _("`%s' returned error %d"),
+					"RANDR Change Output Property", error->error_code);
+				free(error);
+				rejected = 1;
+			}
+		}
+		if( rejected ){
+			LOG(LOGWARN,_("CRTC %d rejected color transform matrix,"
+						" using ramps"),i);
+			crtc->ctm = 0;
+			crtc->ctm_applied = 0;
+			memset(crtc->ctm_last,0,sizeof(crtc->ctm_last));
+			++failed;
 		}
+	}
+	return failed;
+}
 
-		/* Copy gamma ramps into CRTC state */
-		/*@i6@*/memcpy(state.crtcs[i].saved_ramps+0*ramp_size, gamma_r,
-		       ramp_size*sizeof(uint16_t));
-		memcpy(state.crtcs[i].saved_ramps+1*ramp_size, gamma_g,
-		       ramp_size*sizeof(uint16_t));
-		memcpy(state.crtcs[i].saved_ramps+2*ramp_size, gamma_b,
-		       ramp_size*sizeof(uint16_t));
+// Collects errors of all queued gamma updates.
+// Only the first check waits for the server, the rest are answered by then.
+static int randr_check_pending(/*@observer@*/ const char *what)
+{
+	xcb_generic_error_t *error;
+	int ret = RET_FUN_SUCCESS;
+	int i;
 
-		free(gamma_get_reply);
+	for (i = 0; i < ((int)state.crtc_count); i++) {
+		if( !state.crtcs[i].pending )
+			continue;
+		state.crtcs[i].pending = 0;
+		error = xcb_request_check(state.conn, state.crtcs[i].set_cookie);
+		if (error) {
+			LOG(LOGERR, _("`%s' returned error %d"),
+				what, error->error_code);
+			LOG(LOGERR, _("Unable to update CRTC %i"), i);
+			free(error);
+			ret = RET_FUN_FAILED;
+		}
 	}
-
-	/*@i1@*/return RET_FUN_SUCCESS;
+	return ret;
 }
 
-void randr_restore(void){
-	xcb_generic_error_t *error;
+int randr_restore(void){
+	int ret;
 	int i;
 
 	if( (state.conn==NULL)
 			||(state.crtcs==NULL) )
-		return;
+		return RET_FUN_FAILED;
 
 	/* Restore CRTC gamma ramps */
 	for (i = 0; i < ((int)state.crtc_count); i++) {
 		xcb_randr_crtc_t crtc = state.crtcs[i].crtc;
-
+		float identity[3] = {1.0f,1.0f,1.0f};
 		uint16_t ramp_size =(uint16_t)state.crtcs[i].ramp_size;
 		uint16_t *gamma_r;
 		uint16_t *gamma_g;
 		uint16_t *gamma_b;
-		/* Set gamma ramps */
-		xcb_void_cookie_t gamma_set_cookie;
 
+		if( state.crtcs[i].ctm_applied
+				&& randr_send_crtc_ctm(i,identity) )
+			state.crtcs[i].ctm_applied = 0;
+
+		/* Later CRTCs still need their CTM reset */
 		if( state.crtcs[i].saved_ramps==NULL )
-			return;
+			continue;
 
 		gamma_r = &state.crtcs[i].saved_ramps[0*ramp_size];
 		gamma_g = &state.crtcs[i].saved_ramps[1*ramp_size];
 		gamma_b = &state.crtcs[i].saved_ramps[2*ramp_size];
 
-		gamma_set_cookie = xcb_randr_set_crtc_gamma_checked(
+		/* Set gamma ramps */
+		state.crtcs[i].set_cookie = xcb_randr_set_crtc_gamma_checked(
 				state.conn, crtc,
 				ramp_size, gamma_r,
 				gamma_g, gamma_b);
+		state.crtcs[i].pending = 1;
+	}
+	(void)xcb_flush(state.conn);
+	ret = randr_check_pending("RANDR Set CRTC Gamma");
+	if( randr_check_ctm() )
+		ret = RET_FUN_FAILED;
+	gamma_gate_reset();
+	/* The saved ramps describe the display again, and are what heads
+	   appearing from now on should keep */
+	state.last_temp = 0;
+	return ret;
+}
 
-		error = xcb_request_check(state.conn, gamma_set_cookie);
+// Moves the adjustment of CRTCs using a CTM back into their ramps, so
+// nothing is left in a matrix other programs do not know about
+static void randr_ctm_release(void)
+{
+	float identity[3] = {1.0f,1.0f,1.0f};
+	int i;
 
-		if (error) {
-			LOG(LOGERR, _("`%s' returned error %d\n"),
-				"RANDR Set CRTC Gamma", error->error_code);
-			LOG(LOGERR, _("Unable to restore CRTC %i\n"), i);
-		}
+	for (i = 0; i < ((int)state.crtc_count); i++) {
+		gamma_ramp_s ramp;
+
+		if( !state.crtcs[i].ctm_applied )
+			continue;
+		if( !randr_send_crtc_ctm(i,identity) )
+			continue;
+		state.crtcs[i].ctm_applied = 0;
+		if( state.last_temp<=0 )
+			continue;
+		ramp = gamma_ramp_fill((int)state.crtcs[i].ramp_size,
+				state.last_temp);
+		if( ramp.all==NULL )
+			continue;
+		state.crtcs[i].set_cookie = xcb_randr_set_crtc_gamma_checked(
+				state.conn, state.crtcs[i].crtc,
+				(uint16_t)ramp.size, ramp.r, ramp.g, ramp.b);
+		state.crtcs[i].pending = 1;
 	}
+	(void)xcb_flush(state.conn);
+	(void)randr_check_pending("RANDR Set CRTC Gamma");
+	(void)randr_check_ctm();
 }
 
 int randr_free(void){
 	int i;
 
 	LOG(LOGVERBOSE,_("Freeing Randr specific memory"));
-	if( state.crtcs==NULL )
-		return RET_FUN_FAILED;
+
+	if( (state.conn!=NULL) && (state.crtcs!=NULL) )
+		randr_ctm_release();
 
 	/* Free CRTC state */
-	for( i=0; i<state.crtc_count; ++i ){
-		if( state.crtcs[i].saved_ramps!=NULL ){
+	if( state.crtcs!=NULL ){
+		for( i=0; i<state.crtc_count; ++i ){
 			LOG(LOGVERBOSE,_("Freeing Randr CRTC %d"),i);
-			free(state.crtcs[i].saved_ramps);
-			state.crtcs[i].saved_ramps=NULL;
+			randr_crtc_free(&state.crtcs[i]);
 		}
+		free(state.crtcs);
+		state.crtcs=NULL;
 	}
-	free(state.crtcs);
-	state.crtcs=NULL;
+	state.crtc_count=0;
+	state.screen=NULL;
+	state.last_temp=0;
+	state.changes=0;
 
 	/* Close connection */
 	if( state.conn!=NULL )
 		xcb_disconnect(state.conn);
+	state.conn=NULL;
 
 	LOG(LOGVERBOSE,_("Randr memory freed successfully."));
 	return RET_FUN_SUCCESS;
 }
 
-static int randr_set_temperature_for_crtc(int crtc_num, int temp,
-			       /*@unused@*/ gamma_s gamma)
+// Queues new gamma ramps for a CRTC without waiting for the server.
+// Pure white point scaling goes through the CTM where the outputs take
+// one, with an identity ramp.
+static int randr_send_crtc_gamma(int crtc_num, int temp)
 {
-	xcb_generic_error_t *error;
 	gamma_ramp_s ramp;
 	unsigned int ramp_size;
 	xcb_randr_crtc_t crtc;
-	xcb_void_cookie_t gamma_set_cookie;
+	float scale[3];
 
 	if ( (crtc_num>=((int)state.crtc_count))
 			||(crtc_num<0)
@@ -318,50 +846,95 @@ static int randr_set_temperature_for_crtc(int crtc_num, int temp,
 	crtc = state.crtcs[crtc_num].crtc;
 	ramp_size = state.crtcs[crtc_num].ramp_size;
 
-	ramp = gamma_ramp_fill((int)ramp_size,temp);
+	if( (state.crtcs[crtc_num].ctm == 1) && gamma_white_scale(temp,scale) ){
+		if( !randr_send_crtc_ctm(crtc_num,scale) )
+			return RET_FUN_FAILED;
+		state.crtcs[crtc_num].ctm_applied = 1;
+		ramp = gamma_ramp_identity((int)ramp_size);
+	}else{
+		if( state.crtcs[crtc_num].ctm_applied ){
+			/* Leave the whole adjustment to the ramps */
+			scale[0] = scale[1] = scale[2] = 1.0f;
+			if( !randr_send_crtc_ctm(crtc_num,scale) )
+				return RET_FUN_FAILED;
+			state.crtcs[crtc_num].ctm_applied = 0;
+		}
+		ramp = gamma_ramp_fill((int)ramp_size,temp);
+	}
 	if( (!ramp.size)
 			||(ramp.r==NULL)
 			||(ramp.g==NULL)
 			||(ramp.b==NULL) )
 		return RET_FUN_FAILED;
+	if( !gamma_gate_pass((int)crtc,ramp) )
+		return RET_FUN_SUCCESS;
 	if( state.conn==NULL ){
 		LOG(LOGERR,_("No connection available"));
 		return RET_FUN_FAILED;
 	}
 
-	/* Set new gamma ramps */
-	gamma_set_cookie = xcb_randr_set_crtc_gamma_checked(state.conn, crtc,
-						 (uint16_t)ramp_size, ramp.r,
-						 ramp.g, ramp.b);
-	error = xcb_request_check(state.conn, gamma_set_cookie);
-
-	if (error) {
-		LOG(LOGERR, _("`%s' returned error %d"),
-			"RANDR Set CRTC Gamma", error->error_code);
-		return RET_FUN_FAILED;
-	}
+	/* Queue new gamma ramps, errors are collected later */
+	state.crtcs[crtc_num].set_cookie = xcb_randr_set_crtc_gamma_checked(
+			state.conn, crtc, (uint16_t)ramp_size,
+			ramp.r, ramp.g, ramp.b);
+	state.crtcs[crtc_num].pending = 1;
 	LOG(LOGVERBOSE,_("Set gamma[CRTC %d], end points: (%d,%d)"),
 			crtc_num,ramp.r[ramp_size-1],ramp.b[ramp_size-1]);
 
 	return RET_FUN_SUCCESS;
 }
 
-int randr_set_temperature(int temp, gamma_s gamma){
+// Queues new gamma for the CRTCs being driven and waits for the server once
+static int randr_send_all(int temp)
+{
+	int ret = RET_FUN_SUCCESS;
+
 	/* If no CRTC number has been specified,
-	   set temperature on all CRTCs. */
+	   set temperature on all active CRTCs. */
 	if (state.crtc_num < 0) {
 		int i;
 		for (i = 0; i < ((int)state.crtc_count); i++) {
-			if(!randr_set_temperature_for_crtc(i,
-							   temp, gamma))
-				return RET_FUN_FAILED;
+			if( !state.crtcs[i].active )
+				continue;
+			if(!randr_send_crtc_gamma(i,temp)){
+				ret = RET_FUN_FAILED;
+				break;
+			}
 		}
 	} else {
-		return randr_set_temperature_for_crtc(state.crtc_num,
-						      temp, gamma);
+		ret = randr_send_crtc_gamma(state.crtc_num,temp);
 	}
 
-	return RET_FUN_SUCCESS;
+	/* Send all updates together and wait for the server once */
+	(void)xcb_flush(state.conn);
+	if( !randr_check_pending("RANDR Set CRTC Gamma") )
+		ret = RET_FUN_FAILED;
+	return ret;
+}
+
+int randr_set_temperature(int temp, gamma_s gamma){
+	int ret;
+	double start,end;
+
+	if( state.conn==NULL ){
+		LOG(LOGERR,_("No connection available"));
+		return RET_FUN_FAILED;
+	}
+	(void)systemtime_get_real_monotonic(&start);
+	(void)randr_handle_events();
+	state.last_temp = temp;
+	state.last_gamma = gamma;
+	randr_probe_ctm();
+	ret = randr_send_all(temp);
+	/* CRTCs that rejected the CTM still have the identity ramp,
+	   the gate lets only their new ramps through */
+	if( randr_check_ctm() )
+		ret = randr_send_all(temp);
+	state.changes |= randr_drain_events();
+	(void)systemtime_get_real_monotonic(&end);
+	LOG(LOGVERBOSE,_("Applied %dK in %.3f ms"),temp,(end-start)*1000.0);
+
+	return ret;
 }
 
 int randr_get_temperature(void){
@@ -379,9 +952,32 @@ int randr_get_temperature(void){
 		return RET_FUN_FAILED;
 	}
 
-	crtc = state.crtc_num<0 ?
-		state.crtcs[0] :
-		state.crtcs[state.crtc_num];
+	if( state.crtc_num<0 ){
+		unsigned int i;
+		/* Report the first CRTC that is shown */
+		crtc = state.crtcs[0];
+		for( i=0; i<state.crtc_count; ++i )
+			if( state.crtcs[i].active ){
+				crtc = state.crtcs[i];
+				break;
+			}
+	}else
+		crtc = state.crtcs[state.crtc_num];
+
+	/* Ramps saved at init still describe the display until the first
+	   update, after which the server is asked. A failed or partial update
+	   leaves the display unknown to the gamma layer too. */
+	if( (crtc.saved_ramps!=NULL) && (state.last_temp<=0)
+			&& !opt_get_verify_gamma() ){
+		uint16_t gamma_r_end = crtc.saved_ramps[1*crtc.ramp_size-1];
+		uint16_t gamma_b_end = crtc.saved_ramps[3*crtc.ramp_size-1];
+
+		LOG(LOGVERBOSE,_("Saved gamma end points: (%d,%d)"),
+				gamma_r_end,gamma_b_end);
+		/*@i1@*/return gamma_find_temp(
+				((float)gamma_r_end)/((float)gamma_b_end));
+	}
+
 	gamma_get_cookie= xcb_randr_get_crtc_gamma(state.conn,crtc.crtc);
 	gamma_get_reply = xcb_randr_get_crtc_gamma_reply(state.conn,
 			gamma_get_cookie, &error);
@@ -406,16 +1002,45 @@ int randr_get_temperature(void){
 		LOG(LOGVERBOSE,_("Gamma end points: (%d,%d)"),
 				gamma_r_end,gamma_b_end);
 		rb_ratio = ((float)gamma_r_end)/((float)gamma_b_end);
+		/* The white point is in the CTM, the ramps only add to it */
+		if( crtc.ctm_applied && (randr_ctm_scale(&crtc,2)>0.0) )
+			rb_ratio *= (float)(randr_ctm_scale(&crtc,0)
+					/randr_ctm_scale(&crtc,2));
 		free(gamma_get_reply);
 		/*@i2@*/return gamma_find_temp(rb_ratio);
 	}
 }
 
+int randr_poll(void){
+	if( state.conn==NULL ){
+		LOG(LOGERR,_("No connection available"));
+		return RET_FUN_FAILED;
+	}
+	if( xcb_connection_has_error(state.conn) ){
+		LOG(LOGERR,_("Connection to X server lost."));
+		return RET_FUN_FAILED;
+	}
+	/* Apply the current ramps to heads that just appeared */
+	if( randr_handle_events() && (state.last_temp>0) )
+		return randr_set_temperature(state.last_temp,state.last_gamma);
+	return RET_FUN_SUCCESS;
+}
+
+int randr_get_fd(void){
+	if( state.conn==NULL )
+		return -1;
+	return xcb_get_file_descriptor(state.conn);
+}
+
 int randr_load_funcs(gamma_method_s *method){
 	method->func_init = &randr_init;
 	method->func_end = &randr_free;
 	method->func_set_temp = &randr_set_temperature;
 	method->func_get_temp = &randr_get_temperature;
+	method->func_restore = &randr_restore;
+	method->func_poll = &randr_poll;
+	method->func_get_fd = &randr_get_fd;
+	method->caps = GAMMA_CAP_CTM;
 	method->name = "RANDR";
 	return RET_FUN_SUCCESS;
 }
@@ -8,14 +8,19 @@
 #define _REDSHIFT_RANDR_H
 #ifdef ENABLE_RANDR
 
-/**\brief Initialize Randr */
-int randr_init(int screen_num, int crtc_num);
+/**\brief Initialize Randr
+ * \param screen_num screen to use, -1 for the default screen
+ * \param crtc_num CRTC to use, -1 for all CRTCs
+ * \param save_ramps set to 0 to skip saving the current ramps when they
+ *	will not be restored
+ */
+int randr_init(int screen_num, int crtc_num, int save_ramps);
 
 /**\brief Frees Randr */
 int randr_free(void);
 
-/**\brief Restores saved gamma ramps */
-void randr_restore(void);
+/**\brief Restores saved gamma ramps and resets color transform matrices */
+int randr_restore(void);
 
 /**\brief Sets the temperature using Randr */
 int randr_set_temperature(int temp, gamma_s gamma);
@@ -25,6 +30,12 @@ int randr_set_temperature(int temp, gamma_s gamma);
  */
 int randr_get_temperature(void);
 
+/**\brief Handles screen changes, applying the current ramps to new CRTCs */
+int randr_poll(void);
+
+/**\brief Retrieves the X connection file descriptor */
+int randr_get_fd(void);
+
 /**\brief loads functions into methods structure */
 int randr_load_funcs(gamma_method_s *method);
 
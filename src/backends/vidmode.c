@@ -1,166 +1,408 @@
 #include "common.h"
 /*@ignore@*/
-#include <X11/Xlib.h>
-#include <X11/extensions/xf86vmode.h>
+#include <xcb/xcb.h>
+#include <xcb/xf86vidmode.h>
 /*@end@*/
 #include "gamma.h"
+#include "options.h"
 #include "vidmode.h"
 
-/**\brief VidMode state storage */
+/* Ramp size asked for before the real one is known, which is what
+   nearly every driver reports */
+#define VIDMODE_GUESS_RAMP_SIZE	256
+
+/**\brief VidMode storage of screen state info */
 typedef struct {
-	/**\brief Display pointer */
-	Display *display;
-	/**\brief Screen number in use */
+	/**\brief Screen number */
 	int screen_num;
 	/**\brief Size of the gamma ramps */
-	int ramp_size;
+	unsigned int ramp_size;
 	/**\brief Saved ramps */
-	uint16_t *saved_ramps;
+	/*@null@*/ uint16_t *saved_ramps;
+	/**\brief cookie of the last queued gamma update */
+	xcb_void_cookie_t set_cookie;
+	/**\brief set if set_cookie has not been checked yet */
+	int pending;
+} vidmode_screen_state_t;
+
+/**\brief VidMode state storage */
+typedef struct {
+	/**\brief xcb connection pointer */
+	/*@null@*/ xcb_connection_t *conn;
+	/**\brief Screen number in use, -1 for all */
+	int screen_num;
+	/**\brief Number of screens driven */
+	int screen_count;
+	/**\brief State of screens */
+	/*@null@*/ vidmode_screen_state_t *screens;
+	/**\brief set once ramps were sent since init or the last restore */
+	int updated;
 } vidmode_state_t;
 
-static vidmode_state_t state={NULL,0,0,NULL};
+static vidmode_state_t state={NULL,-1,0,NULL,0};
 
-int vidmode_init(int screen_num,int crtc_num)
+// Collects the outcome of the last queued updates. Only the first check
+// waits for the server, the rest are answered by then.
+static int vidmode_check_pending(void)
 {
-	int major, minor;
-	uint16_t *gamma_r;
-	uint16_t *gamma_g;
-	uint16_t *gamma_b;
-
-	/* Open display */
-	state.display = XOpenDisplay(NULL);
-	if (state.display == NULL) {
-		LOG(LOGERR, _("X request failed: %s\n"),
-			"XOpenDisplay");
-		return RET_FUN_FAILED;
+	xcb_generic_error_t *error;
+	int ret = RET_FUN_SUCCESS;
+	int i;
+
+	if( (state.conn==NULL) || (state.screens==NULL) )
+		return RET_FUN_SUCCESS;
+	for( i=0; i<state.screen_count; ++i ){
+		if( !state.screens[i].pending )
+			continue;
+		state.screens[i].pending = 0;
+		error = xcb_request_check(state.conn, state.screens[i].set_cookie);
+		if (error) {
+			LOG(LOGERR, _("`%s' returned error %d"),
+				"VidMode Set Gamma Ramp", error->error_code);
+			LOG(LOGERR, _("Unable to update screen %i"),
+				state.screens[i].screen_num);
+			free(error);
+			ret = RET_FUN_FAILED;
+		}
 	}
+	return ret;
+}
 
-	if (screen_num < 0) screen_num = DefaultScreen(state.display);
-	state.screen_num = screen_num;
+// Copies the ramps of a reply into the saved ramps of a screen
+static int vidmode_save_ramps(vidmode_screen_state_t *screen,
+		xcb_xf86vidmode_get_gamma_ramp_reply_t *reply)
+{
+	unsigned int ramp_size = screen->ramp_size;
 
-	/* Query extension version */
-	if( !XF86VidModeQueryVersion(state.display, &major, &minor) ){
-		LOG(LOGERR, _("X request failed: %s\n"),
-			"XF86VidModeQueryVersion");
-		XCloseDisplay(state.display);
+	screen->saved_ramps = malloc(3*ramp_size*sizeof(uint16_t));
+	if (screen->saved_ramps == NULL) {
+		perror("malloc");
 		return RET_FUN_FAILED;
 	}
+	/*@i6@*/memcpy(screen->saved_ramps+0*ramp_size,
+			xcb_xf86vidmode_get_gamma_ramp_red(reply),
+			ramp_size*sizeof(uint16_t));
+	memcpy(screen->saved_ramps+1*ramp_size,
+			xcb_xf86vidmode_get_gamma_ramp_green(reply),
+			ramp_size*sizeof(uint16_t));
+	memcpy(screen->saved_ramps+2*ramp_size,
+			xcb_xf86vidmode_get_gamma_ramp_blue(reply),
+			ramp_size*sizeof(uint16_t));
+	return RET_FUN_SUCCESS;
+}
 
-	/* Request size of gamma ramps */
-	if( !XF86VidModeGetGammaRampSize(state.display, state.screen_num,
-					&state.ramp_size) ){
-		LOG(LOGERR, _("X request failed: %s\n"),
-			"XF86VidModeGetGammaRampSize");
-		XCloseDisplay(state.display);
+// Reads ramp sizes and saves ramps of all screens. Every request goes out
+// before any reply is waited on. Ramps are asked for at the usual size,
+// and again only for screens that report a different one.
+static int vidmode_load_screens(int save_ramps)
+{
+	xcb_generic_error_t *error;
+	xcb_xf86vidmode_get_gamma_ramp_size_cookie_t *size_cookies;
+	xcb_xf86vidmode_get_gamma_ramp_size_reply_t *size_reply;
+	xcb_xf86vidmode_get_gamma_ramp_cookie_t *ramp_cookies;
+	xcb_xf86vidmode_get_gamma_ramp_reply_t *ramp_reply;
+	int ret = RET_FUN_SUCCESS;
+	int i;
+
+	size_cookies = malloc(state.screen_count
+			*sizeof(xcb_xf86vidmode_get_gamma_ramp_size_cookie_t));
+	ramp_cookies = malloc(state.screen_count
+			*sizeof(xcb_xf86vidmode_get_gamma_ramp_cookie_t));
+	if( (size_cookies==NULL) || (ramp_cookies==NULL) ){
+		perror("malloc");
+		free(size_cookies);
+		free(ramp_cookies);
 		return RET_FUN_FAILED;
 	}
+	for( i=0; i<state.screen_count; ++i ){
+		uint16_t screen = (uint16_t)state.screens[i].screen_num;
+		size_cookies[i] = xcb_xf86vidmode_get_gamma_ramp_size(state.conn,
+				screen);
+		if( save_ramps )
+			ramp_cookies[i] = xcb_xf86vidmode_get_gamma_ramp(state.conn,
+					screen, VIDMODE_GUESS_RAMP_SIZE);
+	}
+
+	/* Ramp sizes, re-asking for ramps read at the wrong size */
+	for( i=0; i<state.screen_count; ++i ){
+		vidmode_screen_state_t *screen = &state.screens[i];
 
-	if (state.ramp_size == 0) {
-		LOG(LOGERR, _("Gamma ramp size too small: %i\n"),
-			state.ramp_size);
-		XCloseDisplay(state.display);
+		size_reply = xcb_xf86vidmode_get_gamma_ramp_size_reply(state.conn,
+				size_cookies[i], &error);
+		if (error || (size_reply==NULL)) {
+			LOG(LOGERR, _("`%s' returned error %d\n"),
+				"VidMode Get Gamma Ramp Size",
+				error ? error->error_code : 0);
+			free(error);
+			ret = RET_FUN_FAILED;
+		}else
+			screen->ramp_size = (unsigned int)size_reply->size;
+		free(size_reply);
+		if( ret && (screen->ramp_size == 0) ){
+			LOG(LOGERR, _("Gamma ramp size too small: %i\n"),
+				screen->ramp_size);
+			ret = RET_FUN_FAILED;
+		}
+		if( ret && save_ramps
+				&& (screen->ramp_size != VIDMODE_GUESS_RAMP_SIZE) ){
+			xcb_discard_reply(state.conn, ramp_cookies[i].sequence);
+			ramp_cookies[i] = xcb_xf86vidmode_get_gamma_ramp(state.conn,
+					(uint16_t)screen->screen_num,
+					(uint16_t)screen->ramp_size);
+		}
+		if( !ret )
+			break;
+	}
+	if( !ret ){
+		for( ++i; i<state.screen_count; ++i )
+			xcb_discard_reply(state.conn, size_cookies[i].sequence);
+		if( save_ramps )
+			for( i=0; i<state.screen_count; ++i )
+				xcb_discard_reply(state.conn, ramp_cookies[i].sequence);
+		free(size_cookies);
+		free(ramp_cookies);
 		return RET_FUN_FAILED;
 	}
+	free(size_cookies);
 
-	/* Allocate space for saved gamma ramps */
-	state.saved_ramps = malloc(3*state.ramp_size*sizeof(uint16_t));
-	if (state.saved_ramps == NULL) {
-		perror("malloc");
-		XCloseDisplay(state.display);
+	/* Save current gamma ramps so we can restore them at program exit. */
+	for( i=0; save_ramps && (i<state.screen_count); ++i ){
+		ramp_reply = xcb_xf86vidmode_get_gamma_ramp_reply(state.conn,
+				ramp_cookies[i], &error);
+		if (error || (ramp_reply==NULL)) {
+			LOG(LOGERR, _("`%s' returned error %d\n"),
+				"VidMode Get Gamma Ramp", error ? error->error_code : 0);
+			free(error);
+			ret = RET_FUN_FAILED;
+		}else
+			ret = vidmode_save_ramps(&state.screens[i],ramp_reply);
+		free(ramp_reply);
+		if( !ret ){
+			for( ++i; i<state.screen_count; ++i )
+				xcb_discard_reply(state.conn, ramp_cookies[i].sequence);
+			break;
+		}
+	}
+	free(ramp_cookies);
+	return ret;
+}
+
+int vidmode_init(int screen_num,/*@unused@*/ int crtc_num,int save_ramps)
+{
+	xcb_generic_error_t *error;
+	xcb_xf86vidmode_query_version_cookie_t ver_cookie;
+	xcb_xf86vidmode_query_version_reply_t *ver_reply;
+	int preferred_screen;
+	int roots;
+	int i;
+
+	LOG(LOGINFO,_("Initializing VidMode backend"));
+	if( state.conn!=NULL ){
+		LOG(LOGERR,_("Connection already established."));
 		return RET_FUN_FAILED;
 	}
 
-	gamma_r = &state.saved_ramps[0*state.ramp_size];
-	gamma_g = &state.saved_ramps[1*state.ramp_size];
-	gamma_b = &state.saved_ramps[2*state.ramp_size];
+	/* Open X server connection */
+	state.conn = xcb_connect(NULL, &preferred_screen);
+	if( xcb_connection_has_error(state.conn) ){
+		LOG(LOGERR,_("Unable to connect to X server."));
+		(void)vidmode_free();
+		return RET_FUN_FAILED;
+	}
 
-	/* Save current gamma ramps so we can restore them at program exit. */
-	if( !XF86VidModeGetGammaRamp(state.display, state.screen_num,
-				    state.ramp_size, gamma_r, gamma_g,
-				    gamma_b) ){
-		LOG(LOGERR, _("X request failed: %s\n"),
-			"XF86VidModeGetGammaRamp");
-		XCloseDisplay(state.display);
+	/* Without a screen number every screen is driven */
+	roots = xcb_setup_roots_length(xcb_get_setup(state.conn));
+	if( screen_num >= roots ){
+		LOG(LOGERR, _("Screen %i could not be found.\n"),
+			screen_num);
+		(void)vidmode_free();
+		return RET_FUN_FAILED;
+	}
+	state.screen_num = screen_num;
+	state.screen_count = screen_num<0 ? roots : 1;
+	state.updated = 0;
+	state.screens = calloc((size_t)state.screen_count,
+			sizeof(vidmode_screen_state_t));
+	if( state.screens==NULL ){
+		perror("calloc");
+		(void)vidmode_free();
 		return RET_FUN_FAILED;
 	}
+	for( i=0; i<state.screen_count; ++i )
+		state.screens[i].screen_num = screen_num<0 ? i : screen_num;
 
+	/* The version query shares its round-trip with the screen queries */
+	ver_cookie = xcb_xf86vidmode_query_version(state.conn);
+	if( !vidmode_load_screens(save_ramps) ){
+		xcb_discard_reply(state.conn, ver_cookie.sequence);
+		(void)vidmode_free();
+		return RET_FUN_FAILED;
+	}
+	ver_reply = xcb_xf86vidmode_query_version_reply(state.conn,
+			ver_cookie, &error);
+	if (error || (ver_reply==NULL)) {
+		LOG(LOGERR, _("`%s' returned error %d\n"),
+			"VidMode Query Version", error ? error->error_code : 0);
+		free(error);
+		free(ver_reply);
+		(void)vidmode_free();
+		return RET_FUN_FAILED;
+	}
+	LOG(LOGVERBOSE,_("VidMode version %u.%u"),
+			ver_reply->major_version, ver_reply->minor_version);
+	free(ver_reply);
+	LOG(LOGINFO,_("Driving %d of %d screens"),state.screen_count,roots);
 	return RET_FUN_SUCCESS;
 }
 
 int vidmode_free(void)
 {
-	/* Free saved ramps */
-	free(state.saved_ramps);
+	int i;
 
-	/* Close display connection */
-	XCloseDisplay(state.display);
+	(void)vidmode_check_pending();
+
+	/* Free screen state */
+	if( state.screens!=NULL ){
+		for( i=0; i<state.screen_count; ++i )
+			free(state.screens[i].saved_ramps);
+		free(state.screens);
+		state.screens = NULL;
+	}
+	state.screen_count = 0;
+
+	/* Close connection */
+	if( state.conn!=NULL )
+		xcb_disconnect(state.conn);
+	state.conn = NULL;
 	return RET_FUN_SUCCESS;
 }
 
-void vidmode_restore(void)
+int vidmode_restore(void)
 {
-	uint16_t *gamma_r = &state.saved_ramps[0*state.ramp_size];
-	uint16_t *gamma_g = &state.saved_ramps[1*state.ramp_size];
-	uint16_t *gamma_b = &state.saved_ramps[2*state.ramp_size];
+	int missing = 0;
+	int ret;
+	int i;
+
+	if( (state.conn==NULL) || (state.screens==NULL) ){
+		LOG(LOGERR,_("No connection available"));
+		return RET_FUN_FAILED;
+	}
+	(void)vidmode_check_pending();
 
 	/* Restore gamma ramps */
-	if( !XF86VidModeSetGammaRamp(state.display, state.screen_num,
-					state.ramp_size, gamma_r, gamma_g,
-					gamma_b) ){
-		LOG(LOGERR, _("X request failed: %s\n"),
-			"XF86VidModeSetGammaRamp");
+	for( i=0; i<state.screen_count; ++i ){
+		vidmode_screen_state_t *screen = &state.screens[i];
+		unsigned int ramp_size = screen->ramp_size;
+
+		if( screen->saved_ramps==NULL ){
+			LOG(LOGERR,_("No saved gamma ramps to restore."));
+			missing = 1;
+			break;
+		}
+		screen->set_cookie = xcb_xf86vidmode_set_gamma_ramp_checked(
+				state.conn, (uint16_t)screen->screen_num,
+				(uint16_t)ramp_size,
+				&screen->saved_ramps[0*ramp_size],
+				&screen->saved_ramps[1*ramp_size],
+				&screen->saved_ramps[2*ramp_size]);
+		screen->pending = 1;
 	}
+	ret = vidmode_check_pending();
+	gamma_gate_reset();
+	state.updated = 0;
+	return missing ? RET_FUN_FAILED : ret;
 }
 
-int vidmode_set_temperature(int temp, gamma_s gamma)
+// Queues new gamma ramps for a screen without waiting for the server
+static int vidmode_send_screen_gamma(vidmode_screen_state_t *screen, int temp)
 {
-	/* Create new gamma ramps */
 	gamma_ramp_s ramp;
 
-	ramp = gamma_ramp_fill(state.ramp_size,temp);
+	ramp = gamma_ramp_fill((int)screen->ramp_size,temp);
 	if( !ramp.size )
 		return RET_FUN_FAILED;
+	if( !gamma_gate_pass(screen->screen_num,ramp) )
+		return RET_FUN_SUCCESS;
 
-	/* Set new gamma ramps */
-	if( !XF86VidModeSetGammaRamp(state.display, state.screen_num,
-				    ramp.size, ramp.r, ramp.g,
-				    ramp.b)){
-		LOG(LOGERR, _("X request failed: %s\n"),
-			"XF86VidModeSetGammaRamp");
+	/* Queue new gamma ramps, errors are collected after the flush */
+	screen->set_cookie = xcb_xf86vidmode_set_gamma_ramp_checked(state.conn,
+			(uint16_t)screen->screen_num, (uint16_t)ramp.size,
+			ramp.r, ramp.g, ramp.b);
+	screen->pending = 1;
+	return RET_FUN_SUCCESS;
+}
+
+int vidmode_set_temperature(int temp, /*@unused@*/ gamma_s gamma)
+{
+	int ret = RET_FUN_SUCCESS;
+	int i;
+
+	if( (state.conn==NULL) || (state.screens==NULL) ){
+		LOG(LOGERR,_("No connection available"));
 		return RET_FUN_FAILED;
 	}
-	return RET_FUN_SUCCESS;
+
+	/* All screens go out in one flush and are answered in one round
+	   trip, so a rejected update fails the step it belongs to */
+	state.updated = 1;
+	for( i=0; i<state.screen_count; ++i )
+		if( !vidmode_send_screen_gamma(&state.screens[i],temp) ){
+			ret = RET_FUN_FAILED;
+			break;
+		}
+	(void)xcb_flush(state.conn);
+	if( !vidmode_check_pending() )
+		ret = RET_FUN_FAILED;
+	return ret;
 }
 
 int vidmode_get_temperature(void){
-	uint16_t *gamma_r = malloc(state.ramp_size*sizeof(uint16_t));
-	uint16_t *gamma_g = malloc(state.ramp_size*sizeof(uint16_t));
-	uint16_t *gamma_b = malloc(state.ramp_size*sizeof(uint16_t));
-	if( !(gamma_r && gamma_g && gamma_b) ){
-		perror("malloc");
+	xcb_generic_error_t *error;
+	xcb_xf86vidmode_get_gamma_ramp_cookie_t ramp_cookie;
+	xcb_xf86vidmode_get_gamma_ramp_reply_t *ramp_reply;
+	vidmode_screen_state_t *screen;
+	uint16_t gamma_r_end,gamma_b_end;
+
+	if( (state.conn==NULL) || (state.screens==NULL) ){
+		LOG(LOGERR,_("Connection not established."));
 		return RET_FUN_FAILED;
 	}
+	/* Report the first screen driven */
+	screen = &state.screens[0];
 
-	if( !XF86VidModeGetGammaRamp(state.display,state.screen_num,
-				state.ramp_size,
-				gamma_r,gamma_g,gamma_b) ){
-		LOG(LOGERR,_("X request failed"));
-		free(gamma_r);
-		free(gamma_g);
-		free(gamma_b);
-		return RET_FUN_FAILED;
-	}else{
-		uint16_t gamma_r_end = gamma_r[state.ramp_size-1];
-		uint16_t gamma_b_end = gamma_b[state.ramp_size-1];
-		float rb_ratio = (float)gamma_r_end/(float)gamma_b_end;
+	/* Ramps saved at init still describe the display until the first
+	   update, after which it is asked. A failed or partial update leaves
+	   the display unknown to the gamma layer too. */
+	if( (screen->saved_ramps!=NULL) && !state.updated
+			&& !opt_get_verify_gamma() ){
+		gamma_r_end = screen->saved_ramps[1*screen->ramp_size-1];
+		gamma_b_end = screen->saved_ramps[3*screen->ramp_size-1];
 
 		LOG(LOGVERBOSE,_("Red end: %uK, Blue end: %uK"),
 				gamma_r_end,gamma_b_end);
-		free(gamma_r);
-		free(gamma_g);
-		free(gamma_b);
-		return gamma_find_temp(rb_ratio);
+		return gamma_find_temp((float)gamma_r_end/(float)gamma_b_end);
 	}
+
+	ramp_cookie = xcb_xf86vidmode_get_gamma_ramp(state.conn,
+			(uint16_t)screen->screen_num, (uint16_t)screen->ramp_size);
+	ramp_reply = xcb_xf86vidmode_get_gamma_ramp_reply(state.conn,
+			ramp_cookie, &error);
+	if (error || (ramp_reply==NULL)) {
+		LOG(LOGERR,_("`%s' returned error %d"),"VidMode Get Gamma Ramp",
+				error ? error->error_code : 0);
+		free(error);
+		free(ramp_reply);
+		return RET_FUN_FAILED;
+	}
+	gamma_r_end = xcb_xf86vidmode_get_gamma_ramp_red(ramp_reply)
+		[screen->ramp_size-1];
+	gamma_b_end = xcb_xf86vidmode_get_gamma_ramp_blue(ramp_reply)
+		[screen->ramp_size-1];
+	free(ramp_reply);
+
+	LOG(LOGVERBOSE,_("Red end: %uK, Blue end: %uK"),
+			gamma_r_end,gamma_b_end);
+	return gamma_find_temp((float)gamma_r_end/(float)gamma_b_end);
 }
 
 int vidmode_load_funcs(gamma_method_s *method){
@@ -168,6 +410,7 @@ int vidmode_load_funcs(gamma_method_s *method){
 	method->func_end = &vidmode_free;
 	method->func_set_temp = &vidmode_set_temperature;
 	method->func_get_temp = &vidmode_get_temperature;
+	method->func_restore = &vidmode_restore;
 	method->name = "VidMode";
 	return RET_FUN_SUCCESS;
 }
@@ -8,14 +8,19 @@
 #define _REDSHIFT_VIDMODE_H
 #ifdef ENABLE_VIDMODE
 
-/**\brief Initialize VidMode */
-int vidmode_init(int screen_num,int crtc_num);
+/**\brief Initialize VidMode
+ * \param screen_num screen to use, -1 for all screens
+ * \param crtc_num unused
+ * \param save_ramps set to 0 to skip saving the current ramps when they
+ *	will not be restored
+ */
+int vidmode_init(int screen_num,int crtc_num,int save_ramps);
 
 /**\brief Frees VidMode state */
 int vidmode_free(void);
 
 /**\brief Restores saved gamma ramps */
-void vidmode_restore(void);
+int vidmode_restore(void);
 
 /**\brief Sets temperature using VidMode */
 int vidmode_set_temperature(int temp, gamma_s gamma);
@@ -35,7 +35,8 @@ typedef /*@partial@*/ struct {
 
 static w32gdi_state_t state={NULL};
 
-static int w32gdi_init(/*@unused@*/int screen_num,/*@unused@*/ int crtc_num)
+static int w32gdi_init(/*@unused@*/int screen_num,/*@unused@*/ int crtc_num,
+		int save_ramps)
 {
 	int cmcap;
 
@@ -88,6 +89,11 @@ static int w32gdi_init(/*@unused@*/int screen_num,/*@unused@*/ int crtc_num)
 	/* Allocate space for saved gamma ramps */
 	if(state.saved_ramps)
 		free(state.saved_ramps);
+	state.saved_ramps = NULL;
+	if( !save_ramps ){
+		(void)DeleteDC(hdc);
+		return RET_FUN_SUCCESS;
+	}
 	state.saved_ramps = malloc(3*GAMMA_RAMP_SIZE*sizeof(WORD));
 	if (state.saved_ramps == NULL) {
 		perror("malloc");
@@ -109,6 +115,7 @@ static int w32gdi_free(void)
 {
 	/* Free saved ramps */
 	free(state.saved_ramps);
+	state.saved_ramps = NULL;
 
 	return RET_FUN_SUCCESS;
 }
@@ -118,9 +125,11 @@ static int w32gdi_restore(void)
 	HDC hdc;
 	hdc = CreateDC(TEXT("DISPLAY"),NULL,NULL,NULL);
 	/* Restore gamma ramps */
-	if( (hdc)||(!state.saved_ramps) ){
+	gamma_gate_reset();
+	if( (!hdc)||(!state.saved_ramps) ){
 		LOG(LOGERR,_("No device context or ramp."));
-		(void)DeleteDC(hdc);
+		if( hdc )
+			(void)DeleteDC(hdc);
 		return RET_FUN_FAILED;
 	}
 	if( !SetDeviceGammaRamp(hdc, state.saved_ramps) ){
@@ -128,6 +137,7 @@ static int w32gdi_restore(void)
 		(void)DeleteDC(hdc);
 		return RET_FUN_FAILED;
 	}
+	(void)DeleteDC(hdc);
 	return RET_FUN_SUCCESS;
 }
 
@@ -136,18 +146,26 @@ static int w32gdi_set_temperature(int temp, /*@unused@*/ gamma_s gamma)
 	HDC hdc;
 	gamma_ramp_s ramp=gamma_ramp_fill(GAMMA_RAMP_SIZE,temp);
 
-	/* Set new gamma ramps */
+	if( ramp.all && !gamma_gate_pass(0,ramp) )
+		return RET_FUN_SUCCESS;
+
+	/* Set new gamma ramps, the gate already counts them as applied so it
+	   is reset whenever they are not */
 	hdc = CreateDC(TEXT("DISPLAY"),NULL,NULL,NULL);
 	if( (!hdc)||(!ramp.all) ){
 		LOG(LOGERR,_("No device context or ramp."));
-	    (void)DeleteDC(hdc);
+		if( hdc )
+			(void)DeleteDC(hdc);
+		gamma_gate_reset();
 		return RET_FUN_FAILED;
 	}
 
 	if( !SetDeviceGammaRamp(hdc,ramp.all)) {
 		LOG(LOGERR,_("Unable to set gamma ramps."));
-	    (void)DeleteDC(hdc);
-    }
+		(void)DeleteDC(hdc);
+		gamma_gate_reset();
+		return RET_FUN_FAILED;
+	}
 
 	(void)DeleteDC(hdc);
 	return RET_FUN_SUCCESS;
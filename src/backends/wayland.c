@@ -0,0 +1,505 @@
+#define _GNU_SOURCE
+#include "common.h"
+/*@ignore@*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+#include "wlr-gamma-control-unstable-v1-client-protocol.h"
+/*@end@*/
+#include "gamma.h"
+#include "options.h"
+#include "systemtime.h"
+#include "wayland.h"
+
+/**\brief wayland storage of output state info */
+typedef struct {
+	/**\brief registry name of the output, also its gate key */
+	uint32_t name;
+	/**\brief output proxy */
+	/*@null@*/ struct wl_output *output;
+	/**\brief gamma control of the output */
+	/*@null@*/ struct zwlr_gamma_control_v1 *control;
+	/**\brief length of gamma ramps, 0 until the compositor tells */
+	unsigned int ramp_size;
+	/**\brief memfd holding the ramps, -1 if not created */
+	int fd;
+	/**\brief shared mapping of fd */
+	/*@null@*/ uint16_t *map;
+	/**\brief set if map holds ramps the compositor was sent */
+	int applied;
+	/**\brief set once the compositor revoked the gamma control */
+	int failed;
+} wayland_output_t;
+
+/**\brief wayland storage of state info */
+typedef struct {
+	/**\brief display connection */
+	/*@null@*/ struct wl_display *display;
+	/**\brief registry of globals */
+	/*@null@*/ struct wl_registry *registry;
+	/**\brief gamma control manager */
+	/*@null@*/ struct zwlr_gamma_control_manager_v1 *manager;
+	/**\brief output number asked for, -1 for all */
+	int crtc_num;
+	/**\brief registry name of that output, which unlike its number stays
+	 * with it while others come and go */
+	uint32_t crtc_name;
+	/**\brief outputs in announcement order */
+	/*@null@*/ wayland_output_t **outputs;
+	/**\brief number of outputs */
+	int output_count;
+	/**\brief allocated outputs */
+	int output_alloc;
+	/**\brief last temperature applied, 0 if none */
+	int last_temp;
+	/**\brief last gamma applied */
+	gamma_s last_gamma;
+	/**\brief set when an output became ready for ramps */
+	int changed;
+} wayland_state_t;
+
+static wayland_state_t state={NULL,NULL,NULL,-1,0,NULL,0,0,0,{1.0f,1.0f,1.0f},0};
+
+// Finds an output by registry name, NULL if there is none
+static /*@null@*/ wayland_output_t *wayland_output_find(uint32_t name)
+{
+	int i;
+
+	for( i=0; i<state.output_count; ++i )
+		if( state.outputs[i]->name==name )
+			return state.outputs[i];
+	return NULL;
+}
+
+// Unmaps and closes the ramp memfd of an output
+static void wayland_output_unmap(wayland_output_t *out)
+{
+	if( out->map!=NULL )
+		(void)munmap(out->map,3*out->ramp_size*sizeof(uint16_t));
+	out->map = NULL;
+	if( out->fd>=0 )
+		(void)close(out->fd);
+	out->fd = -1;
+	out->applied = 0;
+}
+
+// Destroys the gamma control of an output, the compositor restores the
+// original ramps of the output in response
+static void wayland_output_release(wayland_output_t *out)
+{
+	if( out->control!=NULL )
+		zwlr_gamma_control_v1_destroy(out->control);
+	out->control = NULL;
+	wayland_output_unmap(out);
+	out->ramp_size = 0;
+}
+
+static void wayland_control_gamma_size(void *data,
+		/*@unused@*/ struct zwlr_gamma_control_v1 *control, uint32_t size)
+{
+	wayland_output_t *out = data;
+	size_t bytes = 3*size*sizeof(uint16_t);
+
+	wayland_output_unmap(out);
+	out->ramp_size = size;
+	if( size==0 )
+		return;
+	/* The compositor reads the ramps straight from this memfd, so
+	   updates only rewrite the mapping and pass the descriptor again */
+	out->fd = memfd_create("redshiftgui-gamma",MFD_CLOEXEC);
+	if( (out->fd<0) || (ftruncate(out->fd,(off_t)bytes)!=0) ){
+		LOG(LOGERR,_("Unable to create gamma ramp memory: %s"),
+				strerror(errno));
+		wayland_output_unmap(out);
+		return;
+	}
+	out->map = mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_SHARED,out->fd,0);
+	if( out->map==MAP_FAILED ){
+		out->map = NULL;
+		LOG(LOGERR,_("Unable to map gamma ramp memory: %s"),
+				strerror(errno));
+		wayland_output_unmap(out);
+		return;
+	}
+	LOG(LOGVERBOSE,_("Output %u has ramp size %u"),out->name,size);
+	state.changed = 1;
+}
+
+static void wayland_control_failed(void *data,
+		/*@unused@*/ struct zwlr_gamma_control_v1 *control)
+{
+	wayland_output_t *out = data;
+
+	LOG(LOGWARN,_("Gamma control of output %u was revoked, another "
+			"program may be adjusting it."),out->name);
+	wayland_output_release(out);
+	out->failed = 1;
+}
+
+static const struct zwlr_gamma_control_v1_listener control_listener = {
+	wayland_control_gamma_size,
+	wayland_control_failed
+};
+
+// Requests a gamma control for an output that has none yet
+static int wayland_output_bind_control(wayland_output_t *out)
+{
+	if( (out->control!=NULL) || out->failed
+			|| (out->output==NULL) || (state.manager==NULL) )
+		return 0;
+	out->control = zwlr_gamma_control_manager_v1_get_gamma_control(
+			state.manager,out->output);
+	if( out->control==NULL )
+		return 0;
+	(void)zwlr_gamma_control_v1_add_listener(out->control,
+			&control_listener,out);
+	return 1;
+}
+
+// Tracks a new output, its control is requested once the manager is known
+static void wayland_output_add(uint32_t name)
+{
+	wayland_output_t *out = wayland_output_find(name);
+
+	/* Announced again, a control revoked before may be granted now */
+	if( out!=NULL ){
+		out->failed = 0;
+		(void)wayland_output_bind_control(out);
+		return;
+	}
+	if( state.output_count==state.output_alloc ){
+		int alloc = state.output_alloc ? 2*state.output_alloc : 4;
+		wayland_output_t **grown = realloc(state.outputs,
+				alloc*sizeof(wayland_output_t*));
+		if( grown==NULL ){
+			perror("realloc");
+			return;
+		}
+		state.outputs = grown;
+		state.output_alloc = alloc;
+	}
+	out = malloc(sizeof(wayland_output_t));
+	if( out==NULL ){
+		perror("malloc");
+		return;
+	}
+	out->name = name;
+	out->output = wl_registry_bind(state.registry,name,
+			&wl_output_interface,1);
+	out->control = NULL;
+	out->ramp_size = 0;
+	out->fd = -1;
+	out->map = NULL;
+	out->applied = 0;
+	out->failed = 0;
+	state.outputs[state.output_count++] = out;
+	LOG(LOGINFO,_("Found output %u"),name);
+	(void)wayland_output_bind_control(out);
+}
+
+static void wayland_registry_global(/*@unused@*/ void *data,
+		struct wl_registry *registry, uint32_t name,
+		const char *interface, /*@unused@*/ uint32_t version)
+{
+	if( strcmp(interface,wl_output_interface.name)==0 ){
+		wayland_output_add(name);
+	}else if( strcmp(interface,
+				zwlr_gamma_control_manager_v1_interface.name)==0 ){
+		state.manager = wl_registry_bind(registry,name,
+				&zwlr_gamma_control_manager_v1_interface,1);
+	}
+}
+
+static void wayland_registry_global_remove(/*@unused@*/ void *data,
+		/*@unused@*/ struct wl_registry *registry, uint32_t name)
+{
+	int i;
+
+	for( i=0; i<state.output_count; ++i ){
+		wayland_output_t *out = state.outputs[i];
+		if( out->name!=name )
+			continue;
+		LOG(LOGINFO,_("Output %u was removed"),name);
+		if( (state.crtc_num>=0) && (name==state.crtc_name) )
+			LOG(LOGWARN,_("Output %d, which was asked for, is gone."),
+					state.crtc_num);
+		wayland_output_release(out);
+		if( out->output!=NULL )
+			wl_output_destroy(out->output);
+		free(out);
+		--state.output_count;
+		memmove(&state.outputs[i],&state.outputs[i+1],
+				(state.output_count-i)*sizeof(wayland_output_t*));
+		return;
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	wayland_registry_global,
+	wayland_registry_global_remove
+};
+
+// Requests gamma controls for outputs without one and waits for their
+// ramp sizes
+static int wayland_bind_controls(void)
+{
+	int i,bound=0;
+
+	if( state.display==NULL )
+		return RET_FUN_FAILED;
+	for( i=0; i<state.output_count; ++i )
+		bound += wayland_output_bind_control(state.outputs[i]);
+	if( bound && (wl_display_roundtrip(state.display)<0) ){
+		LOG(LOGERR,_("Connection to compositor lost."));
+		return RET_FUN_FAILED;
+	}
+	return RET_FUN_SUCCESS;
+}
+
+int wayland_init(/*@unused@*/ int screen_num, int crtc_num, int save_ramps)
+{
+	int i,ready=0;
+
+	LOG(LOGINFO,_("Initializing Wayland backend"));
+	state.display = wl_display_connect(NULL);
+	if( state.display==NULL ){
+		LOG(LOGERR,_("Unable to connect to Wayland display."));
+		return RET_FUN_FAILED;
+	}
+	state.registry = wl_display_get_registry(state.display);
+	if( state.registry==NULL ){
+		LOG(LOGERR,_("Unable to get Wayland registry."));
+		(void)wayland_free();
+		return RET_FUN_FAILED;
+	}
+	(void)wl_registry_add_listener(state.registry,&registry_listener,NULL);
+	if( wl_display_roundtrip(state.display)<0 ){
+		LOG(LOGERR,_("Connection to compositor lost."));
+		(void)wayland_free();
+		return RET_FUN_FAILED;
+	}
+	if( state.manager==NULL ){
+		LOG(LOGERR,_("Compositor does not support wlr-gamma-control."));
+		(void)wayland_free();
+		return RET_FUN_FAILED;
+	}
+	if( crtc_num>=state.output_count ){
+		LOG(LOGERR,_("Output %d does not exist. "),crtc_num);
+		if( state.output_count>1 )
+			LOG(LOGERR,_("Valid outputs are [0-%d].\n"),
+					state.output_count-1);
+		else
+			LOG(LOGERR,_("Only output 0 exists.\n"));
+		(void)wayland_free();
+		return RET_FUN_FAILED;
+	}
+	state.crtc_num = crtc_num;
+	state.crtc_name = (crtc_num>=0) ? state.outputs[crtc_num]->name : 0;
+	if( !wayland_bind_controls() ){
+		(void)wayland_free();
+		return RET_FUN_FAILED;
+	}
+	for( i=0; i<state.output_count; ++i )
+		if( state.outputs[i]->map!=NULL )
+			++ready;
+	if( (state.output_count>0) && !ready ){
+		LOG(LOGERR,_("No output accepts gamma control."));
+		(void)wayland_free();
+		return RET_FUN_FAILED;
+	}
+	if( !save_ramps )
+		LOG(LOGWARN,_("The compositor restores ramps as soon as the "
+				"program exits."));
+	LOG(LOGINFO,_("Wayland: %d of %d outputs accept gamma control"),
+			ready,state.output_count);
+	return RET_FUN_SUCCESS;
+}
+
+int wayland_free(void)
+{
+	int i;
+
+	LOG(LOGVERBOSE,_("Freeing Wayland specific memory"));
+	if( state.outputs!=NULL ){
+		for( i=0; i<state.output_count; ++i ){
+			wayland_output_release(state.outputs[i]);
+			if( state.outputs[i]->output!=NULL )
+				wl_output_destroy(state.outputs[i]->output);
+			free(state.outputs[i]);
+		}
+		free(state.outputs);
+		state.outputs = NULL;
+	}
+	state.output_count = 0;
+	state.output_alloc = 0;
+	if( state.manager!=NULL )
+		zwlr_gamma_control_manager_v1_destroy(state.manager);
+	state.manager = NULL;
+	if( state.registry!=NULL )
+		wl_registry_destroy(state.registry);
+	state.registry = NULL;
+	if( state.display!=NULL ){
+		/* Make sure the compositor sees the controls go away */
+		(void)wl_display_flush(state.display);
+		wl_display_disconnect(state.display);
+	}
+	state.display = NULL;
+	state.last_temp = 0;
+	state.changed = 0;
+	return RET_FUN_SUCCESS;
+}
+
+int wayland_restore(void)
+{
+	int i;
+
+	if( state.display==NULL )
+		return RET_FUN_FAILED;
+	/* Dropping the controls restores the ramps, new controls are
+	   requested with the next update */
+	for( i=0; i<state.output_count; ++i )
+		wayland_output_release(state.outputs[i]);
+	state.last_temp = 0;
+	gamma_gate_reset();
+	if( wl_display_roundtrip(state.display)<0 ){
+		LOG(LOGERR,_("Connection to compositor lost."));
+		return RET_FUN_FAILED;
+	}
+	return RET_FUN_SUCCESS;
+}
+
+// Writes ramps for an output into its memfd and passes it to the compositor
+static int wayland_send_output_gamma(wayland_output_t *out, int temp)
+{
+	gamma_ramp_s ramp;
+
+	/* Not ready yet, the ramps follow once the ramp size arrives */
+	if( (out->control==NULL) || (out->map==NULL) )
+		return RET_FUN_SUCCESS;
+	ramp = gamma_ramp_fill((int)out->ramp_size,temp);
+	if( ramp.all==NULL )
+		return RET_FUN_FAILED;
+	if( !gamma_gate_pass((int)out->name,ramp) )
+		return RET_FUN_SUCCESS;
+	memcpy(out->map,ramp.all,3*ramp.size*sizeof(uint16_t));
+	/* The descriptor shares its offset with the compositor's copy */
+	(void)lseek(out->fd,0,SEEK_SET);
+	zwlr_gamma_control_v1_set_gamma(out->control,out->fd);
+	out->applied = 1;
+	LOG(LOGVERBOSE,_("Set gamma[output %u], end points: (%d,%d)"),
+			out->name,ramp.r[ramp.size-1],ramp.b[ramp.size-1]);
+	return RET_FUN_SUCCESS;
+}
+
+int wayland_set_temperature(int temp, gamma_s gamma)
+{
+	int i,ret=RET_FUN_SUCCESS;
+	wayland_output_t *out;
+	double start,end;
+
+	if( state.display==NULL ){
+		LOG(LOGERR,_("No connection available"));
+		return RET_FUN_FAILED;
+	}
+	(void)systemtime_get_real_monotonic(&start);
+	state.last_temp = temp;
+	state.last_gamma = gamma;
+	if( !wayland_bind_controls() )
+		return RET_FUN_FAILED;
+	state.changed = 0;
+	if( state.crtc_num<0 ){
+		for( i=0; i<state.output_count; ++i )
+			if( !wayland_send_output_gamma(state.outputs[i],temp) ){
+				ret = RET_FUN_FAILED;
+				break;
+			}
+	}else if( (out=wayland_output_find(state.crtc_name))!=NULL ){
+		ret = wayland_send_output_gamma(out,temp);
+	}else{
+		LOG(LOGERR,_("Output %d does not exist. "),state.crtc_num);
+		ret = RET_FUN_FAILED;
+	}
+	/* Wait until the compositor has read every memfd before any of them
+	   is rewritten */
+	if( wl_display_roundtrip(state.display)<0 ){
+		LOG(LOGERR,_("Connection to compositor lost."));
+		return RET_FUN_FAILED;
+	}
+	(void)systemtime_get_real_monotonic(&end);
+	LOG(LOGVERBOSE,_("Applied %dK in %.3f ms"),temp,(end-start)*1000.0);
+	return ret;
+}
+
+int wayland_get_temperature(void)
+{
+	int i;
+
+	if( state.display==NULL ){
+		LOG(LOGERR,_("Connection not established."));
+		return RET_FUN_FAILED;
+	}
+	for( i=0; i<state.output_count; ++i ){
+		wayland_output_t *out = state.outputs[i];
+		if( (state.crtc_num>=0) && (out->name!=state.crtc_name) )
+			continue;
+		if( out->applied && (out->map!=NULL) ){
+			uint16_t gamma_r_end = out->map[1*out->ramp_size-1];
+			uint16_t gamma_b_end = out->map[3*out->ramp_size-1];
+			LOG(LOGVERBOSE,_("Gamma end points: (%d,%d)"),
+					gamma_r_end,gamma_b_end);
+			return gamma_find_temp(((float)gamma_r_end)/((float)gamma_b_end));
+		}
+	}
+	/* Nothing sent yet, outputs still have their own ramps */
+	return gamma_find_temp(1.0f);
+}
+
+int wayland_poll(void)
+{
+	struct pollfd pfd;
+
+	if( state.display==NULL ){
+		LOG(LOGERR,_("No connection available"));
+		return RET_FUN_FAILED;
+	}
+	/* Read whatever arrived without blocking */
+	if( wl_display_prepare_read(state.display)==0 ){
+		pfd.fd = wl_display_get_fd(state.display);
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if( (poll(&pfd,1,0)>0) && (pfd.revents&POLLIN) )
+			(void)wl_display_read_events(state.display);
+		else
+			wl_display_cancel_read(state.display);
+	}
+	if( wl_display_dispatch_pending(state.display)<0 ){
+		LOG(LOGERR,_("Connection to compositor lost."));
+		return RET_FUN_FAILED;
+	}
+	(void)wl_display_flush(state.display);
+	/* Apply the current ramps to outputs that just appeared */
+	if( state.changed && (state.last_temp>0) )
+		return wayland_set_temperature(state.last_temp,state.last_gamma);
+	return RET_FUN_SUCCESS;
+}
+
+int wayland_get_fd(void)
+{
+	if( state.display==NULL )
+		return -1;
+	return wl_display_get_fd(state.display);
+}
+
+int wayland_load_funcs(gamma_method_s *method){
+	method->func_init = &wayland_init;
+	method->func_end = &wayland_free;
+	method->func_set_temp = &wayland_set_temperature;
+	method->func_get_temp = &wayland_get_temperature;
+	method->func_restore = &wayland_restore;
+	method->func_poll = &wayland_poll;
+	method->func_get_fd = &wayland_get_fd;
+	method->name = "Wayland";
+	return RET_FUN_SUCCESS;
+}
@@ -0,0 +1,45 @@
+/**\file		wayland.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Wayland interface
+ * \details Adjusts outputs through the wlr-gamma-control protocol of
+ * wlroots based compositors. Each output has its ramps in a memfd that is
+ * passed to the compositor with every update. Outputs are counted as CRTCs
+ * in the order the compositor announces them.
+ */
+
+#ifndef _REDSHIFT_WAYLAND_H
+#define _REDSHIFT_WAYLAND_H
+#ifdef ENABLE_WAYLAND
+
+/**\brief Initialize Wayland
+ * \param screen_num unused, the display is taken from WAYLAND_DISPLAY
+ * \param crtc_num output to use, -1 for all outputs
+ * \param save_ramps unused, the compositor restores ramps itself
+ */
+int wayland_init(int screen_num, int crtc_num, int save_ramps);
+
+/**\brief Frees Wayland, which makes the compositor restore the ramps */
+int wayland_free(void);
+
+/**\brief Restores original gamma ramps */
+int wayland_restore(void);
+
+/**\brief Sets the temperature using Wayland */
+int wayland_set_temperature(int temp, gamma_s gamma);
+
+/**\brief Retrieves the temperature from the last ramps sent, the
+ * protocol has no way to read ramps back */
+int wayland_get_temperature(void);
+
+/**\brief Handles output changes, applying the current ramps to new outputs */
+int wayland_poll(void);
+
+/**\brief Retrieves the Wayland connection file descriptor */
+int wayland_get_fd(void);
+
+/**\brief loads functions into methods structure */
+int wayland_load_funcs(gamma_method_s *method);
+
+#endif /*ENABLE_WAYLAND*/
+#endif /* ! _REDSHIFT_WAYLAND_H */
@@ -1,17 +1,24 @@
 #include "common.h"
 #include "gamma.h"
+#include "gamma_kernel.h"
+#include "gamma_worker.h"
 #include "options.h"
 #include "solar.h"
 #include "systemtime.h"
+#include <float.h>
 
-#if !(defined(ENABLE_RANDR) ||			\
+#if !(defined(ENABLE_WAYLAND) ||		\
+      defined(ENABLE_RANDR) ||			\
       defined(ENABLE_VIDMODE) ||		\
-      defined(ENABLE_WINGDI))
-# error "At least one of RANDR, VidMode or WinGDI must be enabled."
+      defined(ENABLE_WINGDI) ||			\
+      defined(ENABLE_NULL))
+# error "At least one of Wayland, RANDR, VidMode, WinGDI or Null must be enabled."
 #endif
+#include "backends/wayland.h"
 #include "backends/randr.h"
 #include "backends/vidmode.h"
 #include "backends/w32gdi.h"
+#include "backends/null.h"
 
 /* Angular elevation of the sun at which the color temperature
    transition period starts and ends (in degress).
@@ -20,10 +27,113 @@
 #define TRANSITION_LOW     SOLAR_CIVIL_TWILIGHT_ELEV
 #define TRANSITION_HIGH    3.0f
 
+/* Number of computed ramps kept for reuse */
+#define GAMMA_CACHE_SIZE	8
+/* Number of normalized channel curves kept for reuse */
+#define GAMMA_CURVE_SLOTS	6
+/* Number of ramp buffers in the pool, enough for the cache plus scratch
+   ramps and buffers handed out to backends */
+#define GAMMA_POOL_SIZE		(GAMMA_CACHE_SIZE+8)
+/* FNV-1a parameters used to hash uploaded ramps */
+#define GAMMA_FNV_OFFSET	2166136261u
+#define GAMMA_FNV_PRIME		16777619u
+
+/**\brief Cached ramp along with the inputs it was computed from */
+typedef struct{
+	/**\brief Temperature */
+	int temp;
+	/**\brief Brightness */
+	float brightness;
+	/**\brief Gamma tweak */
+	gamma_s tweak;
+	/**\brief Last use of this entry, 0 if empty */
+	unsigned long stamp;
+	/**\brief Computed ramp */
+	gamma_ramp_s ramp;
+} gamma_cache_entry;
+
+/**\brief Pooled ramp buffer */
+typedef struct{
+	/**\brief Ramp buffer */
+	gamma_ramp_s ramp;
+	/**\brief Number of users holding this buffer */
+	int refs;
+} gamma_pool_slot;
+
+/**\brief Normalized channel curve, depends only on ramp size and tweak */
+typedef struct{
+	/**\brief Ramp size */
+	int size;
+	/**\brief Gamma tweak of the channel */
+	float tweak;
+	/**\brief Last use of this entry, 0 if empty */
+	unsigned long stamp;
+	/**\brief Curve values (0-1) */
+	/*@null@*//*@owned@*/ double *values;
+} gamma_curve_entry;
+
+/**\brief Entry of the red:blue ratio to temperature index */
+typedef struct{
+	/**\brief Red:blue ratio, decreasing with temperature */
+	float ratio;
+	/**\brief Temperature */
+	float temp;
+} gamma_ratio_entry;
+
+/**\brief Last ramp uploaded to one output, used to gate no-op uploads */
+typedef struct{
+	/**\brief Backend specific output key */
+	int key;
+	/**\brief Set if last holds an uploaded ramp */
+	int valid;
+	/**\brief Hash of last */
+	uint32_t hash;
+	/**\brief Size of last */
+	int size;
+	/**\brief Copy of the uploaded ramp (all channels) */
+	/*@null@*//*@only@*/ uint16_t *last;
+} gamma_gate_entry;
+
+/**\brief Shadow of the state last applied through the active method */
+typedef struct{
+	/**\brief Set once a temperature has been applied */
+	int valid;
+	/**\brief Applied temperature */
+	int temp;
+	/**\brief Brightness the ramps were built with */
+	float brightness;
+	/**\brief Gamma adjustment the ramps were built with */
+	gamma_s gamma;
+} gamma_shadow_s;
+
+/**\brief Readback may differ from the applied temperature by this much
+ * before the display is considered changed by someone else */
+#define GAMMA_VERIFY_TOLERANCE 200
+
 static gamma_method_s methods[GAMMA_METHOD_MAX];
 static gamma_s default_gam = {DEFAULT_GAMMA,DEFAULT_GAMMA,DEFAULT_GAMMA};
 static gamma_method_t active_method=GAMMA_METHOD_NONE;
 static gamma_ramp_s ramp = {NULL,NULL,NULL,NULL,0};
+static gamma_pool_slot pool[GAMMA_POOL_SIZE];
+static gamma_cache_entry cache[GAMMA_CACHE_SIZE];
+static unsigned long cache_clock=0;
+static unsigned long cache_hits=0;
+static unsigned long cache_misses=0;
+static gamma_curve_entry curves[GAMMA_CURVE_SLOTS];
+static /*@null@*//*@only@*/ gamma_ratio_entry *ratio_index=NULL;
+static int ratio_index_size=0;
+static /*@null@*//*@only@*/ gamma_gate_entry *gates=NULL;
+static int gates_count=0;
+static unsigned long gate_uploads=0;
+static unsigned long gate_skip_exact=0;
+static unsigned long gate_skip_threshold=0;
+static gamma_shadow_s shadow={0,0,1.0f,{DEFAULT_GAMMA,DEFAULT_GAMMA,DEFAULT_GAMMA}};
+/* Brightness and gamma adjustment ramps are built with, set by each apply
+   so that the thread driving the method never reads the options */
+static float ramp_brightness=1.0f;
+static gamma_s ramp_tweak={DEFAULT_GAMMA,DEFAULT_GAMMA,DEFAULT_GAMMA};
+/* Set if the active method saved the ramps it found */
+static int ramps_saved=0;
 
 // Interpolates between two RGB colors
 static void gamma_interp_color(float a,
@@ -50,62 +160,405 @@ static int gamma_free_ramps(gamma_ramp_s *_ramp)
 	return RET_FUN_SUCCESS;
 }
 
-// Re-allocates ramps if needed
+// Allocates ramps of the given size, freeing previous ones
+static int gamma_alloc_ramps(gamma_ramp_s *_ramp, int size)
+{
+	if(gamma_free_ramps(_ramp)!=RET_FUN_SUCCESS)
+		return RET_FUN_FAILED;
+	_ramp->all = (uint16_t*)malloc(sizeof(uint16_t)*3*size);
+	if( _ramp->all==NULL ){
+		LOG(LOGERR,_("Unable to allocate new gamma ramps."));
+		return RET_FUN_FAILED;
+	}
+	_ramp->r = _ramp->all;
+	_ramp->g = _ramp->r+size;
+	_ramp->b = _ramp->g+size;
+	_ramp->size = size;
+	return RET_FUN_SUCCESS;
+}
+
+/* Hands out a ramp buffer of the given size from the pool */
+gamma_ramp_s gamma_ramp_acquire(int size)
+	/*@globals pool@*/
+{
+	int i;
+	gamma_pool_slot *empty = NULL;
+	gamma_pool_slot *spare = NULL;
+	gamma_ramp_s none = {NULL,NULL,NULL,NULL,0};
+
+	for( i=0; i<GAMMA_POOL_SIZE; ++i ){
+		gamma_pool_slot *slot = &pool[i];
+		if( slot->refs>0 )
+			continue;
+		if( (slot->ramp.all!=NULL) && (slot->ramp.size==size) ){
+			slot->refs = 1;
+			return slot->ramp;
+		}
+		if( slot->ramp.all==NULL ){
+			if( empty==NULL )
+				empty = slot;
+		}else if( spare==NULL )
+			spare = slot;
+	}
+	/* Prefer growing the pool over discarding a buffer of another size */
+	if( empty==NULL )
+		empty = spare;
+	if( empty==NULL ){
+		LOG(LOGERR,_("Ramp pool exhausted."));
+		return none;
+	}
+	LOG(LOGINFO,_("Allocating pooled ramp of size %d"),size);
+	if( gamma_alloc_ramps(&empty->ramp,size)!=RET_FUN_SUCCESS )
+		return none;
+	empty->refs = 1;
+	return empty->ramp;
+}
+
+/* Returns a ramp buffer to the pool */
+void gamma_ramp_release(gamma_ramp_s _ramp)
+	/*@globals pool@*/
+{
+	int i;
+	if( _ramp.all==NULL )
+		return;
+	for( i=0; i<GAMMA_POOL_SIZE; ++i ){
+		if( pool[i].ramp.all==_ramp.all ){
+			if( pool[i].refs>0 )
+				--pool[i].refs;
+			return;
+		}
+	}
+	LOG(LOGERR,_("Released ramp does not belong to the pool."));
+}
+
+// Frees unused pool buffers
+static void gamma_pool_free(void)
+	/*@globals pool@*/
+{
+	int i;
+	for( i=0; i<GAMMA_POOL_SIZE; ++i ){
+		if( pool[i].refs>0 ){
+			LOG(LOGWARN,_("Pooled ramp of size %d still in use"),
+					pool[i].ramp.size);
+			continue;
+		}
+		(void)gamma_free_ramps(&pool[i].ramp);
+	}
+}
+
+// Returns the scratch ramp for the size, swapping buffers via the pool
 gamma_ramp_s gamma_get_ramps(int size)
 	/*@globals ramp@*/
 {
 	if( ramp.size != size ){
-		LOG(LOGINFO,_("New ramp size requested, allocating new ramps"));
-		if(gamma_free_ramps(&ramp)!=RET_FUN_SUCCESS)
-			return ramp;
-		ramp.all = (uint16_t*)malloc(sizeof(uint16_t)*3*size);
-		if( ramp.all==NULL ){
-			LOG(LOGERR,_("Unable to allocate new gamma ramps."));
-			return ramp;
-		}
-		ramp.r = ramp.all;
-		ramp.g = ramp.r+size;
-		ramp.b = ramp.g+size;
-		ramp.size = size;
+		gamma_ramp_release(ramp);
+		ramp = gamma_ramp_acquire(size);
 	}
 	return ramp;
 }
 
-// Fill gamma ramp according to current parameters
-gamma_ramp_s gamma_ramp_fill(int size, int temp)
+// Retrieves the normalized curve for a ramp size and tweak,
+// computing it only the first time
+static /*@null@*/ const double *gamma_curve_get(int size, float tweak)
+	/*@globals curves,cache_clock@*/
 {
 	int i;
+	gamma_curve_entry *lru = &curves[0];
+	for( i=0; i<GAMMA_CURVE_SLOTS; ++i ){
+		gamma_curve_entry *entry = &curves[i];
+		if( (entry->stamp!=0)
+				&& (entry->size==size)
+				&& (entry->tweak==tweak) ){
+			entry->stamp = ++cache_clock;
+			return entry->values;
+		}
+		if( entry->stamp < lru->stamp )
+			lru = entry;
+	}
+	if( (lru->size!=size) || (lru->values==NULL) ){
+		free(lru->values);
+		lru->stamp = 0;
+		lru->values = (double*)malloc(sizeof(double)*size);
+		if( lru->values==NULL ){
+			LOG(LOGERR,_("Unable to allocate gamma curve."));
+			return NULL;
+		}
+	}
+	LOG(LOGVERBOSE,_("Computing curve (size %d, gamma %f)"),size,tweak);
+	if( tweak==1.0f ){
+		/* Identity gamma is a plain linear ramp */
+		for( i=0; i<size; ++i )
+			lru->values[i] = (float)i/size;
+	}else{
+		for( i=0; i<size; ++i )
+			lru->values[i] = pow((float)i/size,1.0f/tweak);
+	}
+	lru->size = size;
+	lru->tweak = tweak;
+	lru->stamp = ++cache_clock;
+	return lru->values;
+}
+
+// Calculates white point of a temperature, GAMMA_TEMP_IDENTITY gives 1.0
+static void gamma_white_point(int temp, /*@out@*/ float *white_point)
+{
 	int gmap_size;
-	/* Calculate white point */
-	float white_point[3];
 	float alpha = (float)(temp % 100) / 100.0f;
 	int temp_index = ((temp - 1000) / 100);
-	float brightness = opt_get_brightness();
-	gamma_s tweak = opt_get_gamma();
-	gamma_ramp_s curr_ramp = gamma_get_ramps(size);
-	temp_gamma *gam_map = opt_get_gammap(&gmap_size);
+	temp_gamma *gam_map;
 
+	if( temp==GAMMA_TEMP_IDENTITY ){
+		white_point[0] = white_point[1] = white_point[2] = 1.0f;
+		return;
+	}
+	gam_map = opt_get_gammap(&gmap_size);
 	gamma_interp_color(alpha, gam_map[temp_index].gamma,
 			  gam_map[temp_index+1].gamma, white_point);
+}
+
+// Computes ramp values for the given parameters
+static int gamma_ramp_compute(gamma_ramp_s curr_ramp, int temp,
+		float brightness, gamma_s tweak)
+{
+	int size = curr_ramp.size;
+	/* Calculate white point */
+	float white_point[3];
+	const double *curve_r = gamma_curve_get(size,tweak.r);
+	const double *curve_g = gamma_curve_get(size,tweak.g);
+	const double *curve_b = gamma_curve_get(size,tweak.b);
+
+	if( (curve_r==NULL) || (curve_g==NULL) || (curve_b==NULL) )
+		return RET_FUN_FAILED;
+	gamma_white_point(temp,white_point);
 
 	LOG(LOGVERBOSE,_("Gamma brightness: %f"),brightness);
-	if( (curr_ramp.size==0) ||
-			(curr_ramp.r==NULL) ||
-			(curr_ramp.g==NULL) ||
-			(curr_ramp.b==NULL) )
-		return curr_ramp;
-	for (i = 0; i < size; i++) {
-		curr_ramp.r[i] = (uint16_t)(brightness*
-				(pow((float)i/size,1.0f/tweak.r)*
-		/*@i@*/	 UINT16_MAX * white_point[0]));
-		curr_ramp.g[i] = (uint16_t)(brightness*
-				(pow((float)i/size,1.0f/tweak.g)*
-		/*@i@*/	 UINT16_MAX * white_point[1]));
-		curr_ramp.b[i] = (uint16_t)(brightness*
-				(pow((float)i/size,1.0f/tweak.b)*
-		/*@i@*/	 UINT16_MAX * white_point[2]));
-	}
-	return curr_ramp;
+	/* Each channel is a single scale pass over its curve */
+	gamma_kernel_scale(curve_r,size,white_point[0],brightness,curr_ramp.r);
+	gamma_kernel_scale(curve_g,size,white_point[1],brightness,curr_ramp.g);
+	gamma_kernel_scale(curve_b,size,white_point[2],brightness,curr_ramp.b);
+	return RET_FUN_SUCCESS;
+}
+
+// Finds a cached ramp matching the parameters, or the least recently used
+static gamma_cache_entry *gamma_cache_find(int size, int temp,
+		float brightness, gamma_s tweak, /*@out@*/ int *hit)
+	/*@globals cache@*/
+{
+	int i;
+	gamma_cache_entry *lru = &cache[0];
+	for( i=0; i<GAMMA_CACHE_SIZE; ++i ){
+		gamma_cache_entry *entry = &cache[i];
+		if( (entry->stamp!=0)
+				&& (entry->ramp.size==size)
+				&& (entry->temp==temp)
+				&& (entry->brightness==brightness)
+				&& (entry->tweak.r==tweak.r)
+				&& (entry->tweak.g==tweak.g)
+				&& (entry->tweak.b==tweak.b) ){
+			*hit = 1;
+			return entry;
+		}
+		if( entry->stamp < lru->stamp )
+			lru = entry;
+	}
+	*hit = 0;
+	return lru;
+}
+
+// Empties the ramp and curve caches
+static void gamma_cache_free(void)
+	/*@globals cache,curves@*/
+{
+	int i;
+	for( i=0; i<GAMMA_CACHE_SIZE; ++i ){
+		gamma_ramp_release(cache[i].ramp);
+		cache[i].ramp.all = NULL;
+		cache[i].ramp.size = 0;
+		cache[i].stamp = 0;
+	}
+	for( i=0; i<GAMMA_CURVE_SLOTS; ++i ){
+		free(curves[i].values);
+		curves[i].values = NULL;
+		curves[i].stamp = 0;
+	}
+	LOG(LOGINFO,_("Ramp cache: %lu hits, %lu misses"),
+			cache_hits,cache_misses);
+}
+
+// Looks up or computes a ramp for the given parameters
+static gamma_ramp_s gamma_ramp_get(int size, int temp,
+		float brightness, gamma_s tweak)
+{
+	int hit;
+	gamma_cache_entry *entry = gamma_cache_find(size,temp,
+			brightness,tweak,&hit);
+
+	if( hit ){
+		++cache_hits;
+		entry->stamp = ++cache_clock;
+		return entry->ramp;
+	}
+	++cache_misses;
+	/* Reuse the evicted buffer when the size matches,
+	   otherwise swap it for one of the right size from the pool */
+	entry->stamp = 0;
+	if( (entry->ramp.size!=size) || (entry->ramp.all==NULL) ){
+		gamma_ramp_release(entry->ramp);
+		entry->ramp = gamma_ramp_acquire(size);
+		if( entry->ramp.all==NULL )
+			return entry->ramp;
+	}
+	if( gamma_ramp_compute(entry->ramp,temp,brightness,tweak)
+			!=RET_FUN_SUCCESS ){
+		gamma_ramp_s none = {NULL,NULL,NULL,NULL,0};
+		return none;
+	}
+	entry->temp = temp;
+	entry->brightness = brightness;
+	entry->tweak = tweak;
+	entry->stamp = ++cache_clock;
+	return entry->ramp;
+}
+
+// Fill gamma ramp according to current parameters
+gamma_ramp_s gamma_ramp_fill(int size, int temp)
+{
+	return gamma_ramp_get(size,temp,ramp_brightness,ramp_tweak);
+}
+
+/* Ramp that passes colors through unchanged */
+gamma_ramp_s gamma_ramp_identity(int size)
+{
+	gamma_s linear = {1.0f,1.0f,1.0f};
+	return gamma_ramp_get(size,GAMMA_TEMP_IDENTITY,1.0f,linear);
+}
+
+/* Checks if the ramps for temp only scale each channel */
+int gamma_white_scale(int temp, float *scale)
+{
+	int i;
+
+	if( (ramp_tweak.r!=1.0f) || (ramp_tweak.g!=1.0f) || (ramp_tweak.b!=1.0f) )
+		return RET_FUN_FAILED;
+	gamma_white_point(temp,scale);
+	for( i=0; i<3; ++i )
+		scale[i] *= ramp_brightness;
+	return RET_FUN_SUCCESS;
+}
+
+/* Retrieves ramp cache counters */
+void gamma_cache_stats(unsigned long *hits, unsigned long *misses){
+	*hits = cache_hits;
+	*misses = cache_misses;
+}
+
+// Hashes all channels of a ramp
+static uint32_t gamma_gate_hash(const uint16_t *all, int count)
+{
+	uint32_t hash = GAMMA_FNV_OFFSET;
+	int i;
+	for( i=0; i<count; ++i ){
+		hash = (hash ^ (uint32_t)(all[i]&0xFF)) * GAMMA_FNV_PRIME;
+		hash = (hash ^ (uint32_t)(all[i]>>8)) * GAMMA_FNV_PRIME;
+	}
+	return hash;
+}
+
+// Finds or adds the gate of an output
+static /*@null@*//*@dependent@*/ gamma_gate_entry *gamma_gate_find(int key)
+{
+	gamma_gate_entry *grown;
+	int i;
+	for( i=0; i<gates_count; ++i )
+		if( gates[i].key==key )
+			return &gates[i];
+	grown = realloc(gates,(gates_count+1)*sizeof(gamma_gate_entry));
+	if( grown==NULL )
+		return NULL;
+	gates = grown;
+	gates[gates_count].key = key;
+	gates[gates_count].valid = 0;
+	gates[gates_count].hash = 0;
+	gates[gates_count].size = 0;
+	gates[gates_count].last = NULL;
+	return &gates[gates_count++];
+}
+
+/* Checks whether uploading a ramp to an output would have visible effect */
+int gamma_gate_pass(int key, gamma_ramp_s ramp)
+{
+	gamma_gate_entry *gate;
+	int count = 3*ramp.size;
+	int depth = opt_get_gate_depth();
+	uint32_t hash;
+	int i;
+
+	if( (depth<=0) || (ramp.all==NULL) )
+		return 1;
+	gate = gamma_gate_find(key);
+	if( gate==NULL )
+		return 1;
+	hash = gamma_gate_hash(ramp.all,count);
+	if( gate->valid && (gate->size==ramp.size) && (gate->last!=NULL) ){
+		int lsb = 1<<(16-depth);
+		int visible = 0;
+		if( (gate->hash==hash)
+				&& (memcmp(gate->last,ramp.all,count*sizeof(uint16_t))==0) ){
+			++gate_skip_exact;
+			return 0;
+		}
+		for( i=0; (i<count) && !visible; ++i )
+			visible = abs((int)ramp.all[i]-(int)gate->last[i])>=lsb;
+		if( !visible ){
+			++gate_skip_threshold;
+			return 0;
+		}
+	}
+	if( gate->size!=ramp.size ){
+		free(gate->last);
+		gate->last = malloc(count*sizeof(uint16_t));
+		gate->size = ramp.size;
+	}
+	if( gate->last==NULL ){
+		gate->valid = 0;
+		gate->size = 0;
+		return 1;
+	}
+	memcpy(gate->last,ramp.all,count*sizeof(uint16_t));
+	gate->hash = hash;
+	gate->valid = 1;
+	++gate_uploads;
+	return 1;
+}
+
+/* Forgets uploaded ramps, forcing the next upload through */
+void gamma_gate_reset(void)
+{
+	int i;
+	for( i=0; i<gates_count; ++i )
+		gates[i].valid = 0;
+}
+
+// Frees all gates
+static void gamma_gate_free(void)
+	/*@globals gates,gates_count@*/
+{
+	int i;
+	for( i=0; i<gates_count; ++i )
+		free(gates[i].last);
+	free(gates);
+	gates = NULL;
+	gates_count = 0;
+	LOG(LOGINFO,_("Upload gate: %lu uploads, %lu identical, %lu below threshold"),
+			gate_uploads,gate_skip_exact,gate_skip_threshold);
+}
+
+/* Retrieves upload gate counters */
+void gamma_gate_stats(unsigned long *uploads, unsigned long *skip_exact,
+		unsigned long *skip_threshold){
+	*uploads = gate_uploads;
+	*skip_exact = gate_skip_exact;
+	*skip_threshold = gate_skip_threshold;
 }
 
 char *gamma_get_method_name(gamma_method_t method)
@@ -117,26 +570,67 @@ char *gamma_get_method_name(gamma_method_t method)
 		return "None";
 }
 
-int gamma_find_temp(float ratio){
+// Builds the red:blue ratio index from the gamma map
+static int gamma_ratio_index_build(void)
+	/*@globals ratio_index,ratio_index_size@*/
+{
 	int i;
 	int gam_val_size;
 	temp_gamma *gam_map=opt_get_gammap(&gam_val_size);
-	float prev_ratio,curr_ratio;
-	LOG(LOGVERBOSE,_("R/B Ratio: %f"),ratio);
-	prev_ratio = (float)gam_map[0].gamma.r/(float)gam_map[0].gamma.b;
+
+	free(ratio_index);
+	ratio_index_size = 0;
+	ratio_index = (gamma_ratio_entry*)malloc(
+			sizeof(gamma_ratio_entry)*gam_val_size);
+	if( ratio_index==NULL ){
+		LOG(LOGERR,_("Unable to allocate ratio index."));
+		return RET_FUN_FAILED;
+	}
 	for(i=0; i<gam_val_size; ++i){
-		curr_ratio = (float)gam_map[i].gamma.r/(float)gam_map[i].gamma.b;
-		if( curr_ratio <= ratio ){
-			// Interpolate color based on ratio
-			int color = (int)((ratio-curr_ratio)/(prev_ratio-curr_ratio)*100
-				+i*100+1000);
-			LOG(LOGVERBOSE,_("Current col:%d"),color);
-			return color;
+		ratio_index[i].ratio = (gam_map[i].gamma.b > 0.0f) ?
+			gam_map[i].gamma.r/gam_map[i].gamma.b : FLT_MAX;
+		ratio_index[i].temp = (float)gam_map[i].temp;
+		if( (i>0) && (ratio_index[i].ratio >= ratio_index[i-1].ratio) ){
+			LOG(LOGERR,_("Gamma map ratio is not decreasing at %dK"),
+					gam_map[i].temp);
+			free(ratio_index);
+			ratio_index = NULL;
+			return RET_FUN_FAILED;
 		}
-		prev_ratio = curr_ratio;
 	}
-	LOG(LOGERR,_("Unable to find color temperature"));
-	return RET_FUN_FAILED;
+	ratio_index_size = gam_val_size;
+	return RET_FUN_SUCCESS;
+}
+
+int gamma_find_temp(float ratio){
+	int lo,hi;
+	float frac,temp;
+	LOG(LOGVERBOSE,_("R/B Ratio: %f"),ratio);
+	if( (ratio_index==NULL) && (gamma_ratio_index_build()!=RET_FUN_SUCCESS) )
+		return RET_FUN_FAILED;
+	if( ratio >= ratio_index[0].ratio )
+		return (int)ratio_index[0].temp;
+	if( ratio < ratio_index[ratio_index_size-1].ratio ){
+		LOG(LOGERR,_("Unable to find color temperature"));
+		return RET_FUN_FAILED;
+	}
+	/* Binary search for ratio[lo] > ratio >= ratio[hi] */
+	lo = 0;
+	hi = ratio_index_size-1;
+	while( hi-lo > 1 ){
+		int mid = (lo+hi)/2;
+		if( ratio_index[mid].ratio > ratio )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	// Interpolate temperature based on ratio
+	frac = (ratio_index[lo].ratio-ratio)
+		/(ratio_index[lo].ratio-ratio_index[hi].ratio);
+	temp = ratio_index[lo].temp
+		+frac*(ratio_index[hi].temp-ratio_index[lo].temp);
+	LOG(LOGVERBOSE,_("Current col:%f"),temp);
+	return (int)floor(temp+0.5f);
 }
 
 /* Looks up gamma method by name */
@@ -159,9 +653,18 @@ int gamma_load_methods(void){
 		methods[i].func_set_temp = NULL;
 		methods[i].func_get_temp = NULL;
 		methods[i].func_restore = NULL;
+		methods[i].func_poll = NULL;
+		methods[i].func_get_fd = NULL;
+		methods[i].caps = 0;
 		methods[i].name = NULL;
 	}
 	methods[GAMMA_METHOD_AUTO].name = "Auto";
+	if( gamma_ratio_index_build()!=RET_FUN_SUCCESS )
+		return RET_FUN_FAILED;
+#ifdef ENABLE_WAYLAND
+	if(wayland_load_funcs(&methods[GAMMA_METHOD_WAYLAND])!=RET_FUN_SUCCESS)
+		return RET_FUN_FAILED;
+#endif
 #ifdef ENABLE_RANDR
 	if(randr_load_funcs(&methods[GAMMA_METHOD_RANDR])!=RET_FUN_SUCCESS)
 		return RET_FUN_FAILED;
@@ -173,13 +676,17 @@ int gamma_load_methods(void){
 #ifdef ENABLE_WINGDI
 	if(w32gdi_load_funcs(&methods[GAMMA_METHOD_WINGDI])!=RET_FUN_SUCCESS)
 		return RET_FUN_FAILED;
+#endif
+#ifdef ENABLE_NULL
+	if(null_load_funcs(&methods[GAMMA_METHOD_NULL])!=RET_FUN_SUCCESS)
+		return RET_FUN_FAILED;
 #endif
 	return RET_FUN_SUCCESS;
 }
 
 /* Initialize gamma adjustment method. */
 gamma_method_t gamma_init_method(int screen_num, int crtc_num,
-		gamma_method_t method)
+		int save_ramps, gamma_method_t method)
 {
 	gamma_method_t curr=method;
 	gamma_method_t trymethod=method;
@@ -189,10 +696,19 @@ gamma_method_t gamma_init_method(int screen_num, int crtc_num,
 		LOG(LOGERR,_("You must free previous method before init"));
 		return GAMMA_METHOD_NONE;
 	}
+	// Ramps built while initializing follow the current options
+	ramp_brightness = opt_get_brightness();
+	ramp_tweak = opt_get_gamma();
 	do{
+		// Null never drives a display, so it must be asked for by name
+		if( (trymethod == GAMMA_METHOD_AUTO) && (curr == GAMMA_METHOD_NULL) ){
+			++curr;
+			continue;
+		}
 		if(methods[curr].func_init){
 			LOG(LOGINFO,_("Trying %s method"),methods[curr].name);
-			if( methods[curr].func_init(screen_num,crtc_num) == RET_FUN_SUCCESS){
+			if( methods[curr].func_init(screen_num,crtc_num,
+						save_ramps) == RET_FUN_SUCCESS){
 				validmethod = curr;
 				active_method = validmethod;
 			}else
@@ -207,38 +723,122 @@ gamma_method_t gamma_init_method(int screen_num, int crtc_num,
 		LOG(LOGERR,_("Could not initialize any valid methods"));
 		return GAMMA_METHOD_NONE;
 	}
+	if( methods[validmethod].caps & GAMMA_CAP_CTM )
+		LOG(LOGINFO,_("%s can use color transform matrices"),
+				methods[validmethod].name);
+	ramps_saved = save_ramps;
 	return validmethod;
 }
 
-/* Restore saved gamma ramps with the appropriate adjustment method. */
-int gamma_state_restore(void)
+// Applies temperature through the active method and records it in the shadow
+static int gamma_shadow_apply(int temp, gamma_s gamma,
+		float brightness, gamma_s tweak)
+{
+	ramp_brightness = brightness;
+	ramp_tweak = tweak;
+	// Always reach the backend, it may have outputs to catch up on;
+	// unchanged ramps are dropped per output by gamma_gate_pass
+	if( methods[active_method].func_set_temp(temp,gamma)!=RET_FUN_SUCCESS ){
+		// Display state is unknown after a failed update
+		shadow.valid = 0;
+		gamma_gate_reset();
+		return RET_FUN_FAILED;
+	}
+	shadow.valid = 1;
+	shadow.temp = temp;
+	shadow.brightness = brightness;
+	shadow.gamma = tweak;
+	return RET_FUN_SUCCESS;
+}
+
+/* Applies temperature on the calling thread, for the gamma worker. */
+int gamma_method_apply(int temp, gamma_s gamma, float brightness,
+		gamma_s tweak)
 {
 	if( methods[active_method].func_set_temp )
-		return methods[active_method].func_set_temp(DEFAULT_DAY_TEMP,default_gam);
-	else
-		LOG(LOGERR,_("Invalid active method for restoring ramps"));
+		return gamma_shadow_apply(temp,gamma,brightness,tweak);
 	return RET_FUN_FAILED;
 }
 
+/* Handles display changes on the calling thread, for the gamma worker. */
+int gamma_method_poll(void){
+	if( methods[active_method].func_poll )
+		return methods[active_method].func_poll();
+	return RET_FUN_SUCCESS;
+}
+
+/* Retrieves the display change descriptor, for the gamma worker. */
+int gamma_method_get_fd(void){
+	if( methods[active_method].func_get_fd )
+		return methods[active_method].func_get_fd();
+	return -1;
+}
+
+/* Restores saved ramps on the calling thread, for the gamma worker. */
+int gamma_method_restore(void)
+{
+	int ret;
+
+	// Without saved ramps, go back to the default temperature
+	if( !ramps_saved || (methods[active_method].func_restore==NULL) ){
+		if( methods[active_method].func_set_temp )
+			return gamma_shadow_apply(DEFAULT_DAY_TEMP,default_gam,
+					opt_get_brightness(),opt_get_gamma());
+		LOG(LOGERR,_("Invalid active method for restoring ramps"));
+		return RET_FUN_FAILED;
+	}
+	ret = methods[active_method].func_restore();
+	// The saved ramps need not match any temperature
+	shadow.valid = 0;
+	gamma_gate_reset();
+	return ret;
+}
+
+/* Restore saved gamma ramps with the appropriate adjustment method. */
+int gamma_state_restore(void)
+{
+	if( gamma_worker_running() )
+		return gamma_worker_restore();
+	return gamma_method_restore();
+}
+
 /* Free the state associated with the appropriate adjustment method. */
 int gamma_state_free(void)
 {
-	if(gamma_free_ramps(&ramp)!=RET_FUN_SUCCESS)
-		return RET_FUN_FAILED;
+	int ret = RET_FUN_FAILED;
+
+	// Lets the worker finish queued commands and hand the method back
+	gamma_worker_stop();
+	if( ramps_saved && (methods[active_method].func_restore!=NULL)
+			&& !methods[active_method].func_restore() )
+		LOG(LOGWARN,_("Unable to restore saved gamma ramps"));
+	ramps_saved = 0;
+	// Methods may still build ramps while shutting down
 	if( methods[active_method].func_end!=NULL ){
 		if( methods[active_method].func_end()==RET_FUN_SUCCESS ){
 			active_method = GAMMA_METHOD_NONE;
-			return RET_FUN_SUCCESS;
+			ret = RET_FUN_SUCCESS;
 		}
 	}
-	LOG(LOGERR,_("Invalid active method for freeing"));
-	return RET_FUN_FAILED;
+	gamma_ramp_release(ramp);
+	ramp.all = NULL;
+	ramp.size = 0;
+	gamma_cache_free();
+	gamma_pool_free();
+	free(ratio_index);
+	ratio_index = NULL;
+	ratio_index_size = 0;
+	shadow.valid = 0;
+	gamma_gate_free();
+	if( !ret )
+		LOG(LOGERR,_("Invalid active method for freeing"));
+	return ret;
 }
 
-/* Calculate color temperature for the specified solar elevation. */
-int gamma_calc_temp(double elevation, int temp_day, int temp_night)
+// Walks the map for the temperature percentage at an elevation, for
+// elevations and maps the compiled map does not cover
+static double gamma_calc_perc_walk(double elevation)
 {
-	int temp = 0;
 	int i;
 	int size;
 	pair *map = opt_get_map(&size);
@@ -257,25 +857,38 @@ int gamma_calc_temp(double elevation, int temp_day, int temp_night)
 		if( (elevation<=prevelev)
 				&& (elevation>=currelev) ){
 			double ratio;
-			double temp_perc;
-			/* Found target elevation */
-			LOG(LOGVERBOSE,_("Found target elevation "
-					"between %f and %f"),prevelev,currelev);
+			/* Found target elevation, not logged since schedules and
+			   previews call this many times over */
 			ratio = (elevation-currelev)
 				/(prevelev-currelev);
-			temp_perc= ratio*(prevtemp-currtemp)
+			return ratio*(prevtemp-currtemp)
 				+currtemp;
-			temp = (int)((0.01*temp_perc)*(temp_day-temp_night)
-				+temp_night);
-			LOG(LOGVERBOSE,_("Target temp %d (ratio %f,%f)"),
-					temp,ratio,temp_perc);
-			return temp;
 		}
 		prevelev = currelev;
 		prevtemp = currtemp;
 	}
+	return -1.0;
+}
 
-	return temp;
+/* Calculate color temperature for the specified solar elevation. */
+int gamma_calc_temp(double elevation, int temp_day, int temp_night)
+{
+	const map_lut_s *lut = opt_get_map_lut();
+	double temp_perc;
+	int i = (int)floor((elevation+180.0)/MAP_LUT_STEP);
+
+	if( lut->valid && (i>=0) && (i<=MAP_LUT_SIZE) ){
+		/* Steps up to the next segment past a breakpoint in the bucket */
+		int seg = lut->bucket[i];
+		seg -= (elevation>=lut->lower[seg-1]);
+		temp_perc = (elevation-lut->lower[seg])/lut->span[seg]
+			*lut->delta[seg]+lut->base[seg];
+	}else{
+		temp_perc = gamma_calc_perc_walk(elevation);
+		if( temp_perc<0.0 )
+			return 0;
+	}
+	return (int)((0.01*temp_perc)*(temp_day-temp_night)+temp_night);
 }
 
 /* Calculates the current target temperature */
@@ -305,15 +918,57 @@ int gamma_state_set_temperature(int temp, gamma_s gamma)
 		LOG(LOGERR,_("Invalid temperature specified"));
 		return RET_FUN_FAILED;
 	}
-	if( methods[active_method].func_set_temp )
-		return methods[active_method].func_set_temp(temp,gamma);
-	return RET_FUN_FAILED;
+	if( gamma_worker_running() )
+		return gamma_worker_set_temperature(temp,gamma,
+				opt_get_brightness(),opt_get_gamma());
+	return gamma_method_apply(temp,gamma,opt_get_brightness(),
+			opt_get_gamma());
+}
+
+/* Retrieves capabilities of the active method. */
+int gamma_state_get_caps(void){
+	return methods[active_method].caps;
+}
+
+/* Lets the active method handle pending display changes. */
+int gamma_state_poll(void){
+	// The worker watches the display itself
+	if( gamma_worker_running() )
+		return RET_FUN_SUCCESS;
+	return gamma_method_poll();
+}
+
+/* Retrieves descriptor that signals pending display changes. */
+int gamma_state_get_fd(void){
+	if( gamma_worker_running() )
+		return -1;
+	return gamma_method_get_fd();
+}
+
+/* Reads the temperature back from the display, for the gamma worker. */
+int gamma_method_get_temperature(void){
+	int temp;
+
+	if( !methods[active_method].func_get_temp )
+		return RET_FUN_FAILED;
+	temp = methods[active_method].func_get_temp();
+	if( shadow.valid && (temp>0)
+			&& (abs(temp-shadow.temp)>GAMMA_VERIFY_TOLERANCE) ){
+		LOG(LOGWARN,_("Display reports %dK but %dK was applied,"
+					" ramps were changed externally."),temp,shadow.temp);
+		shadow.valid = 0;
+		gamma_gate_reset();
+	}
+	return temp;
 }
 
-/* Retrieves temperature with the appropriate adjustment method. */
 int gamma_state_get_temperature(void){
-	if( methods[active_method].func_get_temp )
-		return methods[active_method].func_get_temp();
-	return RET_FUN_FAILED;
+	// The worker owns the display, it reads back on its own thread
+	if( gamma_worker_running() )
+		return opt_get_verify_gamma() ? gamma_worker_verify_temperature()
+			: gamma_worker_get_temperature();
+	if( shadow.valid && !opt_get_verify_gamma() )
+		return shadow.temp;
+	return gamma_method_get_temperature();
 }
 
@@ -15,6 +15,12 @@
 #define MIN_TEMP	3400
 /**\brief Maximum temperature */
 #define MAX_TEMP	7000
+/**\brief Temperature key of the identity ramp, outside the valid range */
+#define GAMMA_TEMP_IDENTITY	0
+
+/**\brief Method capability: can apply a 3x3 color transform matrix (CTM)
+ * in hardware instead of uploading ramps */
+#define GAMMA_CAP_CTM	1
 
 /**\brief Default brightness */
 #define DEFAULT_BRIGHTNESS	1.0f
@@ -43,6 +49,38 @@ typedef struct{
 	double temp;
 } pair;
 
+/**\brief Width of the buckets of a compiled map in degrees */
+#define MAP_LUT_STEP	0.05
+
+/**\brief Number of buckets of a compiled map, which covers -180 to 180
+ * degrees */
+#define MAP_LUT_SIZE	7200
+
+/**\brief Temperature map compiled for constant time lookups
+ * \details The map is split into linear segments, ordered from the highest
+ * elevation down, the first being a sentinel above everything. Each bucket
+ * holds the segment its elevations fall in, or the one below when one
+ * breakpoint falls inside the bucket. Segments are stored as arrays per
+ * field, and interpolate exactly like walking the map does.
+ */
+typedef struct{
+	/**\brief set once compiled, cleared if some bucket holds more than one
+	 * breakpoint and the map must be walked instead */
+	int valid;
+	/**\brief segment of each bucket */
+	uint16_t bucket[MAP_LUT_SIZE+1];
+	/**\brief number of segments, sentinel included */
+	int size;
+	/**\brief lower elevation of each segment */
+	/*@null@*/ /*@owned@*/ double *lower;
+	/**\brief elevation the segment spans */
+	/*@null@*/ /*@dependent@*/ double *span;
+	/**\brief temperature percentage at the lower elevation */
+	/*@null@*/ /*@dependent@*/ double *base;
+	/**\brief change of temperature percentage across the segment */
+	/*@null@*/ /*@dependent@*/ double *delta;
+} map_lut_s;
+
 /**\brief Maps temperature to RGB */
 typedef struct{
 	/**\brief Temperature */
@@ -67,8 +105,9 @@ typedef /*@partial@*/ struct{
 
 /**\brief Gamma method functions */
 typedef struct{
-	/**\brief Function to initialize method */
-	/*@null@*/ int (*func_init)(int screen_num,int crtc_num);
+	/**\brief Function to initialize method, saves current ramps if
+	 * save_ramps is set */
+	/*@null@*/ int (*func_init)(int screen_num,int crtc_num,int save_ramps);
 	/**\brief Function to shutdown method */
 	/*@null@*/ int (*func_end)(void);
 	/**\brief Function to set the temperature */
@@ -77,6 +116,13 @@ typedef struct{
 	/*@null@*/ int (*func_get_temp)(void);
 	/**\brief Function to restore the saved ramps */
 	/*@null@*/ int (*func_restore)(void);
+	/**\brief Function to handle pending display changes */
+	/*@null@*/ int (*func_poll)(void);
+	/**\brief Function to get a descriptor that is readable when
+	 * func_poll has work to do, -1 if there is none */
+	/*@null@*/ int (*func_get_fd)(void);
+	/**\brief GAMMA_CAP_* flags */
+	int caps;
 	/**\brief Method name. */
 	/*@observer@*/ char *name;
 } gamma_method_s;
@@ -85,24 +131,83 @@ typedef struct{
 typedef enum {
 	GAMMA_METHOD_NONE,		/**< No method defined */
 	GAMMA_METHOD_AUTO,		/**< Try all methods */
+	GAMMA_METHOD_WAYLAND,	/**< Wayland wlr-gamma-control */
 	GAMMA_METHOD_RANDR,		/**< Linux RANDR */
 	GAMMA_METHOD_VIDMODE,	/**< Linux VidMode */
 	GAMMA_METHOD_WINGDI,	/**< Win32 GDI */
+	GAMMA_METHOD_NULL,		/**< Headless, records ramps (not tried by Auto) */
 	GAMMA_METHOD_MAX		/**< Tracks the highest value */
 } gamma_method_t;
 
-/**\brief Re-allocates ramps if size changed, otherwise return pointer to ramp */
+/**\brief Returns a scratch ramp of the given size
+ * \details The buffer comes from the ramp pool and stays valid until the
+ * next call with a different size.
+ */
 gamma_ramp_s gamma_get_ramps(int size)
 	/*@modifies internalState@*/;
 
-/**\brief Updates gamma ramp structure */
+/**\brief Hands out a ramp buffer of the given size from the pool
+ * \details Buffers are kept per size, so mixed ramp sizes do not allocate
+ * once the pool is warm. Return the buffer with gamma_ramp_release().
+ */
+gamma_ramp_s gamma_ramp_acquire(int size)
+	/*@modifies internalState@*/;
+
+/**\brief Returns a ramp buffer to the pool */
+void gamma_ramp_release(gamma_ramp_s ramp)
+	/*@modifies internalState@*/;
+
+/**\brief Updates gamma ramp structure
+ * \details Ramps are cached by size, temperature, brightness and gamma, so
+ * the returned ramp is shared, must not be modified and may be reused by
+ * later calls.
+ */
 gamma_ramp_s gamma_ramp_fill(int size,int temp);
 
+/**\brief Retrieves a cached ramp that passes colors through unchanged,
+ * shared the same way as ramps from gamma_ramp_fill */
+gamma_ramp_s gamma_ramp_identity(int size);
+
+/**\brief Checks whether the ramps for temp only scale each channel
+ *
+ * True when no additional gamma adjustment is set, in which case the
+ * ramps equal the identity ramp scaled by white point and brightness.
+ * \param temp temperature
+ * \param scale receives the red, green and blue scale factors
+ */
+int gamma_white_scale(int temp, /*@out@*/ float *scale);
+
+/**\brief Retrieves ramp cache hit/miss counters */
+void gamma_cache_stats(/*@out@*/ unsigned long *hits,
+		/*@out@*/ unsigned long *misses);
+
+/**\brief Checks whether an upload would change what an output shows
+ *
+ * Compares the ramp with the last one passed for the same output key and
+ * returns 0 when it is identical, or when no entry differs by a full
+ * output step at the configured gate depth. Otherwise the ramp is
+ * remembered as uploaded and 1 is returned.
+ * \param key backend specific output identifier (e.g. CRTC index)
+ * \param ramp ramp about to be uploaded
+ */
+int gamma_gate_pass(int key, gamma_ramp_s ramp);
+
+/**\brief Forgets uploaded ramps so the next upload to each output passes */
+void gamma_gate_reset(void);
+
+/**\brief Retrieves upload gate counters */
+void gamma_gate_stats(/*@out@*/ unsigned long *uploads,
+		/*@out@*/ unsigned long *skip_exact,
+		/*@out@*/ unsigned long *skip_threshold);
+
 /**\brief Retrieves method name by id */
 extern /*@observer@*/ char *gamma_get_method_name(gamma_method_t method)
 	/*@modifies internalState@*/;
 
-/**\brief Find the temperature based on red:blue ratio */
+/**\brief Find the temperature based on red:blue ratio
+ * \details Uses an index of the gamma map built when methods are loaded,
+ * interpolating between entries for 1K resolution.
+ */
 int gamma_find_temp(float ratio);
 
 /**\brief Load methods available */
@@ -111,14 +216,23 @@ int gamma_load_methods(void);
 /**\brief Looks up method by name */
 gamma_method_t gamma_lookup_method(char *name);
 
-/**\brief Initialize gamma changing method. */
+/**\brief Initialize gamma changing method.
+ * \param save_ramps set to 0 when the current ramps will never be restored,
+ *	which lets backends skip reading them back from the display
+ */
 gamma_method_t gamma_init_method(int screen_num, int crtc_num,
-		gamma_method_t method);
+		int save_ramps, gamma_method_t method);
 
-/**\brief Restores gamma ramps to default values */
+/**\brief Restores the ramps saved by the method, or the default
+ * temperature for methods without saved ramps
+ * \details Queued to the worker while it runs, see gamma_worker.h.
+ */
 int gamma_state_restore(void);
 
-/**\brief Free the state associated with the appropriate adjustment method. */
+/**\brief Free the state associated with the appropriate adjustment method.
+ * \details Stops the worker first, if running. Ramps saved at
+ * initialization are restored.
+ */
 int gamma_state_free(void);
 
 /**\brief Calculate temperature based on elevation. */
@@ -128,10 +242,65 @@ int gamma_calc_temp(double elevation, int temp_day, int temp_night);
 int gamma_calc_curr_target_temp(float lat, float lon,
 		int temp_day, int temp_night);
 
-/**\brief Sets the temperature */
+/**\brief Sets the temperature
+ * \details While the gamma worker runs this only queues the temperature,
+ * with the brightness and gamma adjustment options as they are now, and
+ * fails if an earlier temperature failed to apply.
+ */
 int gamma_state_set_temperature(int temp, gamma_s gamma);
 
-/**\brief Retrieves current temperature */
+/**\brief Retrieves current temperature
+ * \details While the gamma worker runs, the last temperature it applied.
+ * With --verify-gamma the worker reads it back from the display, which
+ * waits for the commands queued before.
+ */
 int gamma_state_get_temperature(void);
 
+/**\brief Retrieves GAMMA_CAP_* flags of the active method */
+int gamma_state_get_caps(void);
+
+/**\brief Handles pending display changes (e.g. monitor hotplug)
+ *
+ * Must be called whenever gamma_state_get_fd() becomes readable, and
+ * before waiting on it, since other requests may have queued events.
+ * Does nothing while the gamma worker runs, which handles them itself.
+ */
+int gamma_state_poll(void);
+
+/**\brief Retrieves descriptor to wait on for display changes
+ * \return descriptor, or -1 if the method has none or the gamma worker
+ * runs
+ */
+int gamma_state_get_fd(void);
+
+/**\brief Applies a temperature through the active method on the calling
+ * thread
+ * \details For the gamma worker, everyone else goes through
+ * gamma_state_set_temperature().
+ * \param brightness brightness the ramps are built with
+ * \param tweak gamma adjustment the ramps are built with
+ */
+int gamma_method_apply(int temp, gamma_s gamma, float brightness,
+		gamma_s tweak);
+
+/**\brief Reads the temperature back from the display on the calling
+ * thread, for the gamma worker
+ * \details Invalidates the shadow if the display does not show what was
+ * applied.
+ */
+int gamma_method_get_temperature(void);
+
+/**\brief Restores saved ramps on the calling thread, for the gamma worker
+ * \details See gamma_state_restore().
+ */
+int gamma_method_restore(void);
+
+/**\brief Handles pending display changes on the calling thread, for the
+ * gamma worker */
+int gamma_method_poll(void);
+
+/**\brief Retrieves the display change descriptor of the active method, for
+ * the gamma worker */
+int gamma_method_get_fd(void);
+
 #endif//__GAMMA_H__
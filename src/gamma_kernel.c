@@ -0,0 +1,136 @@
+#include "common.h"
+#include "gamma_kernel.h"
+
+/* SSE2 is part of every x86_64 target, AVX is dispatched at runtime
+   where the compiler lets us build functions for other targets. */
+#if !defined(S_SPLINT_S)
+# if defined(__SSE2__) || defined(_M_X64) \
+	|| (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  define GAMMA_KERNEL_SSE2
+#  include <emmintrin.h>
+# endif
+# if defined(GAMMA_KERNEL_SSE2) && (defined(__clang__) \
+	|| (defined(__GNUC__) && ((__GNUC__ > 4) \
+	|| ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))))
+#  define GAMMA_KERNEL_AVX
+#  include <immintrin.h>
+# endif
+#endif
+
+/**\brief Kernel function type */
+typedef void (*gamma_kernel_fn)(const double *curve, int size,
+		float white, float brightness, uint16_t *out);
+
+static /*@null@*/ gamma_kernel_fn kernel=NULL;
+static /*@observer@*/ const char *kernel_name="None";
+
+// Plain C kernel, also used for the tails of the vector kernels
+static void _scale_scalar(const double *curve, int size,
+		float white, float brightness, uint16_t *out)
+{
+	int i;
+	for( i=0; i<size; ++i ){
+		double val = brightness*(curve[i]*UINT16_MAX*white);
+		out[i] = (val >= UINT16_MAX) ? UINT16_MAX : (uint16_t)val;
+	}
+}
+
+#ifdef GAMMA_KERNEL_SSE2
+// Packs 8 int32 values (0-65535) into unsigned 16 bit values,
+// SSE2 only has a signed saturating pack so values are biased around it
+static __inline __m128i _pack_u16(__m128i lo, __m128i hi){
+	const __m128i bias32 = _mm_set1_epi32(32768);
+	const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+	return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(lo,bias32),
+				_mm_sub_epi32(hi,bias32)),bias16);
+}
+
+// SSE2 kernel, two doubles per register
+static void _scale_sse2(const double *curve, int size,
+		float white, float brightness, uint16_t *out)
+{
+	int i;
+	const __m128d vmax = _mm_set1_pd((double)UINT16_MAX);
+	const __m128d vwhite = _mm_set1_pd((double)white);
+	const __m128d vbright = _mm_set1_pd((double)brightness);
+	for( i=0; i+8<=size; i+=8 ){
+		__m128d v0 = _mm_loadu_pd(curve+i);
+		__m128d v1 = _mm_loadu_pd(curve+i+2);
+		__m128d v2 = _mm_loadu_pd(curve+i+4);
+		__m128d v3 = _mm_loadu_pd(curve+i+6);
+		__m128i lo,hi;
+		v0 = _mm_min_pd(_mm_mul_pd(vbright,
+					_mm_mul_pd(_mm_mul_pd(v0,vmax),vwhite)),vmax);
+		v1 = _mm_min_pd(_mm_mul_pd(vbright,
+					_mm_mul_pd(_mm_mul_pd(v1,vmax),vwhite)),vmax);
+		v2 = _mm_min_pd(_mm_mul_pd(vbright,
+					_mm_mul_pd(_mm_mul_pd(v2,vmax),vwhite)),vmax);
+		v3 = _mm_min_pd(_mm_mul_pd(vbright,
+					_mm_mul_pd(_mm_mul_pd(v3,vmax),vwhite)),vmax);
+		lo = _mm_unpacklo_epi64(_mm_cvttpd_epi32(v0),_mm_cvttpd_epi32(v1));
+		hi = _mm_unpacklo_epi64(_mm_cvttpd_epi32(v2),_mm_cvttpd_epi32(v3));
+		_mm_storeu_si128((__m128i*)(out+i),_pack_u16(lo,hi));
+	}
+	_scale_scalar(curve+i,size-i,white,brightness,out+i);
+}
+#endif
+
+#ifdef GAMMA_KERNEL_AVX
+// AVX kernel, four doubles per register
+__attribute__((target("avx")))
+static void _scale_avx(const double *curve, int size,
+		float white, float brightness, uint16_t *out)
+{
+	int i;
+	const __m256d vmax = _mm256_set1_pd((double)UINT16_MAX);
+	const __m256d vwhite = _mm256_set1_pd((double)white);
+	const __m256d vbright = _mm256_set1_pd((double)brightness);
+	for( i=0; i+8<=size; i+=8 ){
+		__m256d v0 = _mm256_loadu_pd(curve+i);
+		__m256d v1 = _mm256_loadu_pd(curve+i+4);
+		v0 = _mm256_min_pd(_mm256_mul_pd(vbright,
+					_mm256_mul_pd(_mm256_mul_pd(v0,vmax),vwhite)),vmax);
+		v1 = _mm256_min_pd(_mm256_mul_pd(vbright,
+					_mm256_mul_pd(_mm256_mul_pd(v1,vmax),vwhite)),vmax);
+		_mm_storeu_si128((__m128i*)(out+i),_pack_u16(
+					_mm256_cvttpd_epi32(v0),_mm256_cvttpd_epi32(v1)));
+	}
+	_scale_scalar(curve+i,size-i,white,brightness,out+i);
+}
+#endif
+
+// Picks the best kernel for this CPU
+static void _kernel_select(void)
+	/*@globals kernel,kernel_name@*/
+{
+	kernel = &_scale_scalar;
+	kernel_name = "Scalar";
+#ifdef GAMMA_KERNEL_SSE2
+	kernel = &_scale_sse2;
+	kernel_name = "SSE2";
+#endif
+#ifdef GAMMA_KERNEL_AVX
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx") ){
+		kernel = &_scale_avx;
+		kernel_name = "AVX";
+	}
+#endif
+	LOG(LOGVERBOSE,_("Using %s ramp kernel"),kernel_name);
+}
+
+/* Scales a normalized curve into a ramp channel */
+void gamma_kernel_scale(const double *curve, int size,
+		float white, float brightness, uint16_t *out)
+{
+	if( kernel==NULL )
+		_kernel_select();
+	/*@i@*/kernel(curve,size,white,brightness,out);
+}
+
+/* Name of the selected kernel */
+const char *gamma_kernel_name(void){
+	if( kernel==NULL )
+		_kernel_select();
+	return kernel_name;
+}
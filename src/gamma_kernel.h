@@ -0,0 +1,26 @@
+/**\file		gamma_kernel.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Gamma ramp generation kernels.
+ */
+
+#ifndef __GAMMA_KERNEL_H__
+#define __GAMMA_KERNEL_H__
+
+/**\brief Scales a normalized curve into a 16 bit ramp channel
+ * \details Computes brightness*(curve[i]*UINT16_MAX*white) in double
+ * precision and truncates, so every kernel matches the scalar path bit for
+ * bit. Results above UINT16_MAX are clamped.
+ * \param curve normalized curve values (0-1)
+ * \param size number of entries
+ * \param white white point of the channel
+ * \param brightness brightness scale
+ * \param out ramp channel to fill
+ */
+void gamma_kernel_scale(const double *curve, int size,
+		float white, float brightness, /*@out@*/ uint16_t *out);
+
+/**\brief Name of the kernel selected for this CPU */
+/*@observer@*/ const char *gamma_kernel_name(void);
+
+#endif//__GAMMA_KERNEL_H__
@@ -0,0 +1,361 @@
+#include "common.h"
+#include "gamma.h"
+#include "gamma_worker.h"
+#ifndef _WIN32
+# include <fcntl.h>
+# include <poll.h>
+# include <pthread.h>
+# include <signal.h>
+#endif
+
+/*@ignore@*/
+#ifdef _MSC_VER
+# define ATOMIC_LOAD(X)		InterlockedCompareExchange((volatile LONG*)&(X),0,0)
+# define ATOMIC_STORE(X,V)	(void)InterlockedExchange((volatile LONG*)&(X),(LONG)(V))
+# define ATOMIC_EXCHANGE(X,V)	InterlockedExchange((volatile LONG*)&(X),(LONG)(V))
+# define ATOMIC_FENCE()		MemoryBarrier()
+#else
+# define ATOMIC_LOAD(X)		__atomic_load_n(&(X),__ATOMIC_ACQUIRE)
+# define ATOMIC_STORE(X,V)	__atomic_store_n(&(X),(V),__ATOMIC_RELEASE)
+# define ATOMIC_EXCHANGE(X,V)	__atomic_exchange_n(&(X),(V),__ATOMIC_ACQ_REL)
+# define ATOMIC_FENCE()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+/*@end@*/
+
+/**\brief Command for the worker */
+typedef struct{
+	/**\brief order the command was queued in, starting at 1 */
+	long serial;
+	/**\brief set to restore the saved ramps, the rest is unused */
+	int restore;
+	/**\brief temperature */
+	int temp;
+	/**\brief gamma */
+	gamma_s gamma;
+	/**\brief brightness */
+	float brightness;
+	/**\brief gamma adjustment */
+	gamma_s tweak;
+} gamma_worker_cmd_s;
+
+/**\brief Worker state */
+typedef struct{
+	/**\brief set while the thread runs */
+	int running;
+	/**\brief set to stop the thread */
+	int exiting;
+	/**\brief set while a wakeup is pending */
+	int pending;
+	/**\brief commands */
+	gamma_worker_cmd_s ring[GAMMA_WORKER_RING];
+	/**\brief commands queued, written by the producer */
+	long head;
+	/**\brief commands taken, written by the worker */
+	long tail;
+	/**\brief command queued while the ring was full */
+	gamma_worker_cmd_s mailbox;
+	/**\brief odd while the mailbox is being written */
+	long mailbox_seq;
+	/**\brief mailbox_seq the worker last read */
+	long mailbox_seen;
+	/**\brief serial of the last command queued */
+	long queued;
+	/**\brief temperature last applied or read back by the worker */
+	int applied_temp;
+	/**\brief set by the worker when a command failed, cleared once
+	 * reported */
+	int failed;
+	/**\brief read backs asked for, written by the producer */
+	long verify_asked;
+	/**\brief read backs done, written by the worker */
+	long verify_done;
+	/**\brief commands applied, read once stopped */
+	long applied;
+#ifndef _WIN32
+	/**\brief thread */
+	pthread_t thread;
+	/**\brief wakes the worker, read end first */
+	int wake[2];
+#else
+	/**\brief thread */
+	HANDLE thread;
+	/**\brief wakes the worker */
+	HANDLE wake;
+#endif
+} gamma_worker_s;
+
+static gamma_worker_s worker;
+
+// Wakes the worker unless a wakeup is already on its way
+static void gamma_worker_wake(void)
+{
+	if( ATOMIC_EXCHANGE(worker.pending,1) )
+		return;
+#ifndef _WIN32
+	/* A full pipe already holds a wakeup */
+	(void)write(worker.wake[1],"",1);
+#else
+	(void)SetEvent(worker.wake);
+#endif
+}
+
+// Waits for a wakeup or a display change
+static void gamma_worker_wait(void)
+{
+#ifndef _WIN32
+	struct pollfd pfd[2];
+	char buf[16];
+	nfds_t cnt = 1;
+
+	pfd[0].fd = worker.wake[0];
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = gamma_method_get_fd();
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+	if( pfd[1].fd >= 0 )
+		cnt = 2;
+	if( poll(pfd,cnt,-1)<0 )
+		return;
+	if( pfd[0].revents & POLLIN )
+		while( read(worker.wake[0],buf,sizeof(buf))>0 )
+			;
+#else
+	(void)WaitForSingleObject(worker.wake,INFINITE);
+#endif
+}
+
+// Takes the newest command queued since the last call, if newer than
+// serial
+static int gamma_worker_take(gamma_worker_cmd_s *cmd, long serial)
+{
+	long head = ATOMIC_LOAD(worker.head);
+	long seq;
+	int found = 0;
+
+	/* Only the newest command of the ring counts */
+	if( head!=worker.tail ){
+		gamma_worker_cmd_s *last = &worker.ring[(head-1)&(GAMMA_WORKER_RING-1)];
+		if( last->serial>serial ){
+			*cmd = *last;
+			serial = cmd->serial;
+			found = 1;
+		}
+		ATOMIC_STORE(worker.tail,head);
+	}
+	/* The mailbox may be newer or older than the ring, serials tell. If
+	   it is rewritten while copied, the writer wakes us again. */
+	seq = ATOMIC_LOAD(worker.mailbox_seq);
+	if( (seq!=worker.mailbox_seen) && !(seq&1) ){
+		gamma_worker_cmd_s copy = worker.mailbox;
+		ATOMIC_FENCE();
+		if( ATOMIC_LOAD(worker.mailbox_seq)==seq ){
+			worker.mailbox_seen = seq;
+			if( copy.serial>serial ){
+				*cmd = copy;
+				found = 1;
+			}
+		}
+	}
+	return found;
+}
+
+// Applies commands until stopped
+static void gamma_worker_loop(void)
+{
+	gamma_worker_cmd_s cmd;
+	long serial = 0;
+	long asked;
+	int exiting;
+	int ok,temp;
+
+	do{
+		/* Checked first so that commands queued before stopping apply */
+		exiting = ATOMIC_LOAD(worker.exiting);
+		ATOMIC_STORE(worker.pending,0);
+		asked = ATOMIC_LOAD(worker.verify_asked);
+		if( gamma_worker_take(&cmd,serial) ){
+			serial = cmd.serial;
+			++worker.applied;
+			if( cmd.restore ){
+				if( !(ok=gamma_method_restore()) )
+					LOG(LOGERR,_("Unable to restore saved gamma ramps"));
+				/* Saved ramps are whatever the display had */
+				temp = gamma_method_get_temperature();
+			}else{
+				if( !(ok=gamma_method_apply(cmd.temp,cmd.gamma,
+							cmd.brightness,cmd.tweak)) )
+					LOG(LOGERR,_("Temperature adjustment failed (Target %d)."),
+							cmd.temp);
+				temp = cmd.temp;
+			}
+			if( ok && (temp>0) )
+				ATOMIC_STORE(worker.applied_temp,temp);
+			ATOMIC_STORE(worker.failed,!ok);
+		}
+		/* Read back after the commands queued before the request */
+		if( asked!=worker.verify_done ){
+			temp = gamma_method_get_temperature();
+			if( temp>0 )
+				ATOMIC_STORE(worker.applied_temp,temp);
+			ATOMIC_STORE(worker.verify_done,asked);
+		}
+		if( exiting )
+			break;
+		if( !gamma_method_poll() )
+			LOG(LOGWARN,_("Unable to handle display change."));
+		gamma_worker_wait();
+	}while(1);
+}
+
+#ifndef _WIN32
+static void *gamma_worker_thread(/*@unused@*/ void *arg)
+{
+	gamma_worker_loop();
+	return NULL;
+}
+#else
+static DWORD WINAPI gamma_worker_thread(/*@unused@*/ LPVOID arg)
+{
+	gamma_worker_loop();
+	return 0;
+}
+#endif
+
+int gamma_worker_start(void)
+{
+	int temp = gamma_state_get_temperature();
+#ifndef _WIN32
+	sigset_t all,old;
+	int err;
+#endif
+
+	if( worker.running )
+		return RET_FUN_SUCCESS;
+	memset(&worker,0,sizeof(worker));
+	worker.applied_temp = temp;
+#ifndef _WIN32
+	if( pipe(worker.wake) ){
+		LOG(LOGERR,_("Unable to create gamma worker pipe"));
+		return RET_FUN_FAILED;
+	}
+	(void)fcntl(worker.wake[0],F_SETFL,O_NONBLOCK);
+	(void)fcntl(worker.wake[1],F_SETFL,O_NONBLOCK);
+	// Signals are left to the main thread, the worker inherits the mask
+	(void)sigfillset(&all);
+	(void)pthread_sigmask(SIG_SETMASK,&all,&old);
+	err = pthread_create(&worker.thread,NULL,gamma_worker_thread,NULL);
+	(void)pthread_sigmask(SIG_SETMASK,&old,NULL);
+	if( err ){
+		LOG(LOGERR,_("Unable to start gamma worker thread"));
+		(void)close(worker.wake[0]);
+		(void)close(worker.wake[1]);
+		return RET_FUN_FAILED;
+	}
+#else
+	if( !(worker.wake=CreateEvent(NULL,FALSE,FALSE,NULL)) ){
+		LOG(LOGERR,_("Unable to create gamma worker event"));
+		return RET_FUN_FAILED;
+	}
+	if( !(worker.thread=CreateThread(NULL,0,gamma_worker_thread,NULL,0,NULL)) ){
+		LOG(LOGERR,_("Unable to start gamma worker thread"));
+		(void)CloseHandle(worker.wake);
+		return RET_FUN_FAILED;
+	}
+#endif
+	worker.running = 1;
+	LOG(LOGVERBOSE,_("Gamma worker started"));
+	return RET_FUN_SUCCESS;
+}
+
+void gamma_worker_stop(void)
+{
+	if( !worker.running )
+		return;
+	ATOMIC_STORE(worker.exiting,1);
+	ATOMIC_STORE(worker.pending,0);
+	gamma_worker_wake();
+#ifndef _WIN32
+	(void)pthread_join(worker.thread,NULL);
+	(void)close(worker.wake[0]);
+	(void)close(worker.wake[1]);
+#else
+	(void)WaitForSingleObject(worker.thread,INFINITE);
+	(void)CloseHandle(worker.thread);
+	(void)CloseHandle(worker.wake);
+#endif
+	worker.running = 0;
+	LOG(LOGVERBOSE,_("Gamma worker stopped: %ld commands, %ld coalesced"),
+			worker.queued,worker.queued-worker.applied);
+}
+
+int gamma_worker_running(void)
+{return worker.running;}
+
+// Queues a command, serial is filled in
+static void gamma_worker_queue(gamma_worker_cmd_s *cmd)
+{
+	long head = worker.head;
+
+	cmd->serial = ++worker.queued;
+	if( head-ATOMIC_LOAD(worker.tail)<GAMMA_WORKER_RING ){
+		worker.ring[head&(GAMMA_WORKER_RING-1)] = *cmd;
+		ATOMIC_STORE(worker.head,head+1);
+	}else{
+		/* The worker is behind, this command supersedes the ring anyway */
+		long seq = worker.mailbox_seq;
+		ATOMIC_STORE(worker.mailbox_seq,seq+1);
+		ATOMIC_FENCE();
+		worker.mailbox = *cmd;
+		ATOMIC_STORE(worker.mailbox_seq,seq+2);
+	}
+	gamma_worker_wake();
+}
+
+int gamma_worker_set_temperature(int temp, gamma_s gamma, float brightness,
+		gamma_s tweak)
+{
+	gamma_worker_cmd_s cmd;
+
+	cmd.restore = 0;
+	cmd.temp = temp;
+	cmd.gamma = gamma;
+	cmd.brightness = brightness;
+	cmd.tweak = tweak;
+	gamma_worker_queue(&cmd);
+	/* A failure is reported once, with the command queued after it */
+	if( ATOMIC_EXCHANGE(worker.failed,0) )
+		return RET_FUN_FAILED;
+	return RET_FUN_SUCCESS;
+}
+
+int gamma_worker_restore(void)
+{
+	gamma_worker_cmd_s cmd;
+
+	memset(&cmd,0,sizeof(cmd));
+	cmd.restore = 1;
+	gamma_worker_queue(&cmd);
+	if( ATOMIC_EXCHANGE(worker.failed,0) )
+		return RET_FUN_FAILED;
+	return RET_FUN_SUCCESS;
+}
+
+int gamma_worker_get_temperature(void)
+{return ATOMIC_LOAD(worker.applied_temp);}
+
+int gamma_worker_verify_temperature(void)
+{
+	long asked = worker.verify_asked+1;
+	int waited;
+
+	ATOMIC_STORE(worker.verify_asked,asked);
+	gamma_worker_wake();
+	for( waited=0; waited<GAMMA_WORKER_VERIFY_WAIT; ++waited ){
+		if( ATOMIC_LOAD(worker.verify_done)-asked>=0 )
+			return ATOMIC_LOAD(worker.applied_temp);
+		SLEEP(1);
+	}
+	LOG(LOGWARN,_("Gamma worker busy, temperature not read back"));
+	return ATOMIC_LOAD(worker.applied_temp);
+}
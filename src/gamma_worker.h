@@ -0,0 +1,73 @@
+/**\file		gamma_worker.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Thread that owns the gamma method
+ * \details Uploading ramps can take milliseconds per CRTC, and with a slow
+ * server far longer. Once started, the worker is the only thread that
+ * talks to the active method: gamma_state_set_temperature() and
+ * gamma_state_restore() queue a command and return right away.
+ *
+ * Commands go through a lock-free single producer, single consumer ring.
+ * When the ring is full the newest command waits in a mailbox instead, so
+ * the caller never blocks. The worker only ever applies the newest command
+ * it has received, commands superseded while it was busy are dropped. It
+ * also waits on the display change descriptor and handles hotplugs itself.
+ *
+ * The worker publishes the temperature it last applied, and whether that
+ * failed, for the next command to report. Reading the temperature back
+ * from the display is the one request that waits for the worker.
+ *
+ * Commands must all come from one thread, the one that started the worker.
+ */
+
+#ifndef _REDSHIFT_GAMMA_WORKER_H
+#define _REDSHIFT_GAMMA_WORKER_H
+
+#include "gamma.h"
+
+/**\brief Number of commands the ring holds, a power of two */
+#define GAMMA_WORKER_RING	64
+
+/**\brief Milliseconds to wait for the worker to read the temperature back */
+#define GAMMA_WORKER_VERIFY_WAIT	1000
+
+/**\brief Starts the worker for the active method
+ * \return RET_FUN_FAILED if the thread could not be started, in which case
+ * the method is still driven directly
+ */
+int gamma_worker_start(void);
+
+/**\brief Applies the commands still queued and stops the worker
+ * \details Does nothing if the worker is not running.
+ */
+void gamma_worker_stop(void);
+
+/**\brief Checks whether the worker is running */
+int gamma_worker_running(void);
+
+/**\brief Queues a temperature to apply
+ * \param brightness brightness the ramps are built with
+ * \param tweak gamma adjustment the ramps are built with
+ * \return RET_FUN_FAILED if a command applied since the last call failed,
+ * the temperature is queued either way
+ */
+int gamma_worker_set_temperature(int temp, gamma_s gamma, float brightness,
+		gamma_s tweak);
+
+/**\brief Queues restoring the saved ramps, see gamma_state_restore()
+ * \return as gamma_worker_set_temperature()
+ */
+int gamma_worker_restore(void);
+
+/**\brief Retrieves the temperature the worker last applied or read back */
+int gamma_worker_get_temperature(void);
+
+/**\brief Has the worker read the temperature back from the display
+ * \details Waits until the worker has applied the commands queued so far
+ * and read back, at most GAMMA_WORKER_VERIFY_WAIT.
+ * \return the temperature read back, the last one applied if the worker
+ * did not answer in time
+ */
+int gamma_worker_verify_temperature(void);
+
+#endif /* ! _REDSHIFT_GAMMA_WORKER_H */
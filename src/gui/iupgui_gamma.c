@@ -1,77 +1,118 @@
 #include "common.h"
 #include "gamma.h"
 #include "options.h"
+#include "scheduler.h"
+#include "systemtime.h"
+#include "transition.h"
 #include "gui/iupgui.h"
 #include "gui/iupgui_main.h"
 #include "gui/iupgui_gamma.h"
+#ifndef _WIN32
+/*@ignore@*/
+# include <glib.h>
+/*@end@*/
+#endif
 
 /*@null@*/ static Ihandle *timer_gamma_check=NULL;
 /*@null@*/ static Ihandle *timer_gamma_transition=NULL;
 
-static int curr_temp=1000;
-static int target_temp=1000;
+static transition_s transition;
 static int timers_disabled = 0;
+#ifndef _WIN32
+static guint display_watch = 0;
+static guint clock_watch = 0;
+
+// Handles display changes signalled by the gamma method
+static gboolean _gamma_display_changed(/*@unused@*/ GIOChannel *source,
+		/*@unused@*/ GIOCondition cond, /*@unused@*/ gpointer data){
+	if( !gamma_state_poll() )
+		LOG(LOGWARN,_("Unable to handle display change."));
+	return TRUE;
+}
+#endif
+
+// Times the transition timer for the next frame, or stops it
+static void _gamma_transition_schedule(void){
+	int wait = systemtime_scale_wait(transition_wait(&transition));
+
+	IupSetAttribute(timer_gamma_transition,"RUN","NO");
+	if( wait < 0 )
+		return;
+	// IUP timers need at least a millisecond
+	IupSetfAttribute(timer_gamma_transition,"TIME","%d",wait>0 ? wait : 1);
+	IupSetAttribute(timer_gamma_transition,"RUN","YES");
+}
 
 // Changes temperature
 static int _gamma_transition(/*@unused@*/ Ihandle *ih){
-	int transpeed = opt_get_trans_speed();
-	if( curr_temp > target_temp ){
-		curr_temp -= transpeed/10;
-		if( curr_temp < target_temp ){
-			(void)guigamma_set_temp(target_temp);
-			IupSetAttribute(timer_gamma_transition,"RUN","NO");
-			IupSetAttribute(timer_gamma_check,"RUN","YES");
-			return IUP_DEFAULT;
-		}
-	}else{
-		curr_temp += transpeed/10;
-		if( curr_temp > target_temp ){
-			(void)guigamma_set_temp(target_temp);
-			IupSetAttribute(timer_gamma_transition,"RUN","NO");
-			IupSetAttribute(timer_gamma_check,"RUN","YES");
-			return IUP_DEFAULT;
-		}
-	}
-
-	LOG(LOGVERBOSE,_("Transition color: %dK"),curr_temp);
-	if( !gamma_state_set_temperature(
-				curr_temp,opt_get_gamma()) ){
-		LOG(LOGERR,_("Temperature adjustment failed (Target %d."),
-			curr_temp);
-		//IupSetAttribute(timer_gamma_transition,"RUN","NO");
-		//return IUP_DEFAULT;
-	}
+	(void)transition_update(&transition);
+	_gamma_transition_schedule();
 	guimain_update_info();
 	return IUP_DEFAULT;
 }
 
 // Returns current temperature as known by GUI
 int guigamma_get_temp(void){
-	return curr_temp;
+	return transition_get_temp(&transition);
 }
 
 // Sets the current temperature in GUI
 int guigamma_set_temp(int temp){
 	(void)gamma_state_set_temperature(temp,opt_get_gamma());
-	curr_temp = temp;
+	// Setting a temperature directly ends any transition
+	transition_init(&transition,temp);
+	if( timer_gamma_transition )
+		IupSetAttribute(timer_gamma_transition,"RUN","NO");
 	return RET_FUN_SUCCESS;
 }
 
+// Times the check timer for the next change of the target
+static void _gamma_check_schedule(double next_change){
+	int wait = systemtime_scale_wait(scheduler_wait(next_change));
+
+	IupSetAttribute(timer_gamma_check,"RUN","NO");
+	IupSetfAttribute(timer_gamma_check,"TIME","%d",wait>0 ? wait : 1);
+	IupSetAttribute(timer_gamma_check,"RUN","YES");
+	// Timers stop while suspended, the alarm goes off on resume
+	(void)systemtime_set_alarm(next_change);
+}
+
+#ifndef _WIN32
+// Checks right away when the clock alarm goes off or the clock jumps
+static gboolean _gamma_clock_changed(/*@unused@*/ GIOChannel *source,
+		/*@unused@*/ GIOCondition cond, /*@unused@*/ gpointer data){
+	(void)systemtime_clock_changed();
+	(void)guigamma_check(timer_gamma_check);
+	return TRUE;
+}
+#endif
+
 // Check if temperature needs to be corrected
 int guigamma_check(/*@unused@*/ Ihandle *ih){
+	int target_temp;
+	double now;
+	double next_change;
 
+	// Catch display changes queued while waiting on the display
+	(void)gamma_state_poll();
 	if( timers_disabled )
 		return IUP_DEFAULT;
 
-	target_temp = gamma_calc_curr_target_temp(
+	if( !systemtime_get_time(&now) ){
+		LOG(LOGERR,_("Unable to read system time."));
+		return IUP_DEFAULT;
+	}
+	target_temp = scheduler_next_change(now,
 			opt_get_lat(),opt_get_lon(),
-			opt_get_temp_day(),opt_get_temp_night());
+			opt_get_temp_day(),opt_get_temp_night(),&next_change);
+	_gamma_check_schedule(next_change);
 	LOG(LOGINFO,_("Gamma check, current: %d, target: %d"),
-			curr_temp,target_temp);
-	if( fabs((double)(curr_temp - target_temp)) >= 1.0 ){
-		// Disable current timer
-		IupSetAttribute(timer_gamma_check,"RUN","NO");
-		IupSetAttribute(timer_gamma_transition,"RUN","YES");
+			transition_get_temp(&transition),target_temp);
+	// A running transition turns toward the new target where it is
+	if( (transition_get_target(&transition) != target_temp)
+			|| (transition_get_temp(&transition) != target_temp) ){
+		transition_retarget(&transition,target_temp,opt_get_trans_speed());
+		_gamma_transition_schedule();
 	}
 	guimain_update_info();
 	return IUP_DEFAULT;
@@ -88,31 +129,67 @@ void guigamma_disable(void){
 
 // Enables gamma timers
 void guigamma_enable(void){
-	IupSetAttribute(timer_gamma_check,"RUN","YES");
 	timers_disabled = 0;
+	(void)guigamma_check(timer_gamma_check);
+}
+
+// Watches the gamma method for display changes
+void guigamma_watch_display(void){
+#ifndef _WIN32
+	int fd;
+	if( display_watch ){
+		(void)g_source_remove(display_watch);
+		display_watch = 0;
+	}
+	fd = gamma_state_get_fd();
+	if( fd >= 0 ){
+		GIOChannel *channel = g_io_channel_unix_new(fd);
+		display_watch = g_io_add_watch(channel,G_IO_IN,
+				_gamma_display_changed,NULL);
+		g_io_channel_unref(channel);
+	}
+#endif
 }
 
 // Initialize timer to run gamma correction
 void guigamma_init_timers(void){
-	// Re-check every 5 minute
+	// Re-checks are timed by the scheduler
 	timer_gamma_check = IupTimer();
-	IupSetfAttribute(timer_gamma_check,"TIME","%d",1000*60*5);
 	(void)IupSetCallback(timer_gamma_check,"ACTION_CB",(Icallback)guigamma_check);
-	IupSetAttribute(timer_gamma_check,"RUN","YES");
 
-	// Transition step size is 100 ms
+	// Transition frames are timed by the transition engine
 	timer_gamma_transition = IupTimer();
 	IupSetfAttribute(timer_gamma_transition,"TIME","%d",100);
 	(void)IupSetCallback(timer_gamma_transition,"ACTION_CB",(Icallback)_gamma_transition);
 
+	guigamma_watch_display();
+#ifndef _WIN32
+	if( systemtime_get_alarm_fd() >= 0 ){
+		GIOChannel *channel = g_io_channel_unix_new(systemtime_get_alarm_fd());
+		clock_watch = g_io_add_watch(channel,G_IO_IN,_gamma_clock_changed,NULL);
+		g_io_channel_unref(channel);
+	}
+#endif
+
 	// Make sure gamma is synced up
-	curr_temp = gamma_state_get_temperature();
-	(void)gamma_state_set_temperature(curr_temp,opt_get_gamma());
+	transition_init(&transition,gamma_state_get_temperature());
+	(void)gamma_state_set_temperature(transition_get_temp(&transition),
+			opt_get_gamma());
 	(void)guigamma_check(timer_gamma_check);
 }
 
 // Destroys timers
 void guigamma_end_timers(void){
+#ifndef _WIN32
+	if( display_watch ){
+		(void)g_source_remove(display_watch);
+		display_watch = 0;
+	}
+	if( clock_watch ){
+		(void)g_source_remove(clock_watch);
+		clock_watch = 0;
+	}
+#endif
 	if( timer_gamma_check )
 		IupDestroy(timer_gamma_check);
 
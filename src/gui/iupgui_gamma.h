@@ -22,6 +22,10 @@ void guigamma_enable(void);
 /**\brief Initializes timers to change gamma */
 void guigamma_init_timers(void);
 
+/**\brief (Re)starts watching the gamma method for display changes,
+ * needed again whenever the method is changed */
+void guigamma_watch_display(void);
+
 /**\brief Destroys timers */
 void guigamma_end_timers(void);
 
@@ -3,6 +3,7 @@
 #include "solar.h"
 #include "gamma.h"
 #include "options.h"
+#include "scheduler.h"
 #include "gui/iupgui.h"
 #include "gui/iupgui_main.h"
 #include "gui/iupgui_settings.h"
@@ -16,8 +17,8 @@ extern Hcntrl himg_sunback,himg_sun;
 
 // Main dialog handles
 static Hnullc dialog=NULL;
-static Hnullc infotitle[4]={NULL,NULL,NULL,NULL};
-static Hnullc infovals[4]={NULL,NULL,NULL,NULL};
+static Hnullc infotitle[5]={NULL,NULL,NULL,NULL,NULL};
+static Hnullc infovals[5]={NULL,NULL,NULL,NULL,NULL};
 static Hnullc lbl_elevation=NULL;
 static Hnullc chk_color=NULL;
 static Hnullc chk_bright=NULL;
@@ -249,8 +250,38 @@ static int _tray_click(Hcntrl ih, int but, int pressed,
 	return IUP_DEFAULT;
 }
 
+// Formats the transitions of the next day as start-end times
+static void _format_transitions(double now, char *buf, size_t size){
+	int cnt,i;
+	size_t len=0;
+	const scheduler_run_s *runs = scheduler_get_table(now,opt_get_lat(),
+			opt_get_lon(),opt_get_temp_day(),opt_get_temp_night(),&cnt);
+
+	buf[0]='\0';
+	// Gaps between runs are transitions
+	for( i=1; (i<cnt) && runs && (len<size); ++i ){
+		time_t start = (time_t)runs[i-1].end;
+		time_t end = (time_t)runs[i].start;
+		char from[8],to[8];
+		struct tm *tm;
+		if( ((double)end<=now) || ((double)start>=now+24*60*60) )
+			continue;
+		if( !(tm=localtime(&start)) )
+			continue;
+		(void)strftime(from,sizeof(from),"%H:%M",tm);
+		if( !(tm=localtime(&end)) )
+			continue;
+		(void)strftime(to,sizeof(to),"%H:%M",tm);
+		len += (size_t)snprintf(buf+len,size-len,"%s%s-%s",
+				len ? ", " : "",from,to);
+	}
+	if( !buf[0] )
+		(void)snprintf(buf,size,_("None"));
+}
+
 // Updates info display
 void guimain_update_info(void){
+	char transitions[128];
 	double now;
 	if ( !systemtime_get_time(&now) ){
 		LOG(LOGERR,_("Unable to read system time."));
@@ -263,6 +294,8 @@ void guimain_update_info(void){
 		LOG(LOGVERBOSE,_("Elevation - now: %f"),
 				elevation);
 		_set_sun_pos(elevation);
+		_format_transitions(now,transitions,sizeof(transitions));
+		IupSetfAttribute(infovals[4],"TITLE","%s",transitions);
 	}
 
 	IupSetfAttribute(infovals[0],"TITLE",_("%d K"),guigamma_get_temp());
@@ -319,20 +352,24 @@ static Hcntrl _main_create_info(void){
 	infotitle[1]=IupLabel(_("Day:"));
 	infotitle[2]=IupLabel(_("Night:"));
 	infotitle[3]=IupLabel(_("Location:"));
+	infotitle[4]=IupLabel(_("Transitions:"));
 	IupSetAttribute(infotitle[0],"EXPAND","HORIZONTAL");
 	IupSetAttribute(infotitle[1],"EXPAND","HORIZONTAL");
 	IupSetAttribute(infotitle[2],"EXPAND","HORIZONTAL");
 	IupSetAttribute(infotitle[3],"EXPAND","HORIZONTAL");
+	IupSetAttribute(infotitle[4],"EXPAND","HORIZONTAL");
 	infovals[0]=IupLabel(NULL);
 	infovals[1]=IupLabel(NULL);
 	infovals[2]=IupLabel(NULL);
 	infovals[3]=IupLabel(NULL);
+	infovals[4]=IupLabel(NULL);
 	guimain_update_info();
 	fvboxtitle= IupVbox(
 		infotitle[0],
 		infotitle[1],
 		infotitle[2],
 		infotitle[3],
+		infotitle[4],
 		IupFill(),
 		NULL);
 	IupSetAttribute(fvboxtitle,"MARGIN","5");
@@ -341,6 +378,7 @@ static Hcntrl _main_create_info(void){
 		infovals[1],
 		infovals[2],
 		infovals[3],
+		infovals[4],
 		IupFill(),
 		NULL);
 	IupSetAttribute(fvboxinfo,"MARGIN","5");
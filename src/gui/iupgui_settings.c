@@ -1,5 +1,6 @@
 #include "common.h"
 #include "gamma.h"
+#include "gamma_worker.h"
 #include "options.h"
 #include "gui/iupgui.h"
 #include "gui/iupgui_main.h"
@@ -109,6 +110,7 @@ static int _setting_save(/*@unused@*/ Hcntrl ih){
 	int disable=0;
 	char *min_str,*dis_str,*elev_map,*method_cnt;
 	int methodsuccess=0;
+	int methodactive=0;
 
 	if( (val_day==NULL)
 			||(val_night==NULL)
@@ -146,14 +148,21 @@ static int _setting_save(/*@unused@*/ Hcntrl ih){
 				LOG(LOGINFO,_("Gamma method changed to %s"),method);
 				(void)gamma_state_free();
 				if( !gamma_init_method(opt_get_screen(),opt_get_crtc(),
-						newmethod)){
+						1,newmethod)){
 					LOG(LOGERR,_("Unable to set new gamma method, reverting..."));
 					if(!gamma_init_method(opt_get_screen(),opt_get_crtc(),
-							oldmethod)){
+							1,oldmethod)){
 						LOG(LOGERR,_("Unable to revert to old method."));
-					}
+					}else
+						methodactive=1;
 				}else
-					methodsuccess=1;
+					methodactive=methodsuccess=1;
+				/* Nothing to drive without a method */
+				if( methodactive ){
+					if( !gamma_worker_start() )
+						LOG(LOGWARN,_("Adjusting gamma on the main thread."));
+					guigamma_watch_display();
+				}
 			}else
 				methodsuccess=1;
 		}
@@ -196,6 +205,9 @@ static Hcntrl _settings_create_methods(void){
 	IupSetAttribute(listmethod,"DROPDOWN","YES");
 	IupSetAttribute(listmethod,"EXPAND","HORIZONTAL");
 	for( method=GAMMA_METHOD_AUTO; method<GAMMA_METHOD_MAX; ++method){
+		// Null does not change the display, only offered on the command line
+		if( method == GAMMA_METHOD_NULL )
+			continue;
 		method_name = gamma_get_method_name(method);
 		if( (strcmp(method_name,"None")!=0) ){
 			(void)snprintf(list_count,3,"%d",++avail_methods);
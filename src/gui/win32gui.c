@@ -91,6 +91,15 @@ INT_PTR CALLBACK DialogProc(HWND hDlg, UINT uMsg, WPARAM wParam, LPARAM lParam)
 				guimain_update_info();
 			}
 			break;
+		case WM_TIMECHANGE:
+			// Timers count from before the clock was set, check now
+			(void)guigamma_check((HWND)NULL,(UINT)NULL,(UINT)NULL,(DWORD)NULL);
+			break;
+		case WM_POWERBROADCAST:
+			// Timers stop while suspended, check now
+			if( wParam == PBT_APMRESUMEAUTOMATIC )
+				(void)guigamma_check((HWND)NULL,(UINT)NULL,(UINT)NULL,(DWORD)NULL);
+			break;
 		case WM_CLOSE:
 			guigamma_end_timers();
 			DestroyWindow(hDlg);
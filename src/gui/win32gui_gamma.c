@@ -1,6 +1,9 @@
 #include "common.h"
 #include "gamma.h"
 #include "options.h"
+#include "scheduler.h"
+#include "systemtime.h"
+#include "transition.h"
 #include "gui/win32gui.h"
 #include "gui/win32gui_gamma.h"
 
@@ -10,97 +13,84 @@ static UINT timer_gamma_transition=(UINT)NULL;
 #define IDT_GAMMA_CHECK 2000
 #define IDT_GAMMA_TRANS 2001
 
-static int curr_temp=1000;
-static int target_temp=1000;
+static transition_s transition;
 static int timers_disabled = 0;
 
+static double next_change = 0.0;
+
 static void _gamma_toggle_timer_trans(int onoff);
 static void _gamma_toggle_timer_check(int onoff);
 
 // Changes temperature
 static void _gamma_transition(HWND hwnd,UINT uMsg,UINT_PTR idEvent,DWORD dwTime){
-	int transpeed = opt_get_trans_speed();
-	if( curr_temp > target_temp ){
-		curr_temp -= transpeed/10;
-		if( curr_temp < target_temp ){
-			(void)guigamma_set_temp(target_temp);
-			_gamma_toggle_timer_trans(0);
-			_gamma_toggle_timer_check(1);
-			return;
-		}
-	}else{
-		curr_temp += transpeed/10;
-		if( curr_temp > target_temp ){
-			(void)guigamma_set_temp(target_temp);
-			_gamma_toggle_timer_trans(0);
-			_gamma_toggle_timer_check(1);
-			return;
-		}
-	}
-
-	LOG(LOGVERBOSE,_("Transition color: %dK"),curr_temp);
-	if( !gamma_state_set_temperature(
-				curr_temp,opt_get_gamma()) ){
-		LOG(LOGERR,_("Temperature adjustment failed (Target %d."),
-			curr_temp);
-	}
+	(void)transition_update(&transition);
+	_gamma_toggle_timer_trans(transition_is_active(&transition));
 	guimain_update_info();
 	return;
 }
 
 
-// Toggles transition timer
+// Toggles transition timer, timed for the next frame when on
 static void _gamma_toggle_timer_trans(int onoff){
+	if(timer_gamma_transition){
+		KillTimer(NULL,timer_gamma_transition);
+		timer_gamma_transition = (UINT) NULL;
+	}
 	if(onoff){
-		// Transition step size is 100 ms
-		timer_gamma_transition = SetTimer(NULL,IDT_GAMMA_TRANS,100,(TIMERPROC)_gamma_transition);
-	}else{
-		if(timer_gamma_transition){
-			KillTimer(NULL,timer_gamma_transition);
-			timer_gamma_transition = (UINT) NULL;
-		}
+		int wait = systemtime_scale_wait(transition_wait(&transition));
+		timer_gamma_transition = SetTimer(NULL,IDT_GAMMA_TRANS,
+				wait>0 ? wait : USER_TIMER_MINIMUM,(TIMERPROC)_gamma_transition);
 	}
 }
 
-// Toggles check timer
+// Toggles check timer, timed for the next change of the target when on
 static void _gamma_toggle_timer_check(int onoff){
+	if(timer_gamma_check){
+		KillTimer(NULL,timer_gamma_check);
+		timer_gamma_check = (UINT)NULL;
+	}
 	if(onoff){
-		// Re-check every 5 minute
-		timer_gamma_check = SetTimer(NULL,IDT_GAMMA_CHECK,1000*60*5,(TIMERPROC) guigamma_check);
-	}else{
-		if(timer_gamma_check){
-			KillTimer(NULL,timer_gamma_check);
-			timer_gamma_check = (UINT)NULL;
-		}
+		int wait = systemtime_scale_wait(scheduler_wait(next_change));
+		timer_gamma_check = SetTimer(NULL,IDT_GAMMA_CHECK,
+				wait>0 ? wait : USER_TIMER_MINIMUM,(TIMERPROC) guigamma_check);
 	}
 }
 
 // Returns current temperature as known by GUI
 int guigamma_get_temp(void){
-	return curr_temp;
+	return transition_get_temp(&transition);
 }
 
 // Sets the current temperature in GUI
 int guigamma_set_temp(int temp){
 	(void)gamma_state_set_temperature(temp,opt_get_gamma());
-	curr_temp = temp;
+	// Setting a temperature directly ends any transition
+	transition_init(&transition,temp);
+	_gamma_toggle_timer_trans(0);
 	return RET_FUN_SUCCESS;
 }
 
 // Check if temperature needs to be corrected
 void guigamma_check(HWND hwnd,UINT uMsg,UINT_PTR idEvent,DWORD dwTime){
+	int target_temp;
+	double now;
 
 	if( timers_disabled )
 		return;
 
-	target_temp = gamma_calc_curr_target_temp(
+	if( !systemtime_get_time(&now) ){
+		LOG(LOGERR,_("Unable to read system time."));
+		return;
+	}
+	target_temp = scheduler_next_change(now,
 			opt_get_lat(),opt_get_lon(),
-			opt_get_temp_day(),opt_get_temp_night());
+			opt_get_temp_day(),opt_get_temp_night(),&next_change);
+	_gamma_toggle_timer_check(1);
 	LOG(LOGINFO,_("Gamma check, current: %d, target: %d"),
-			curr_temp,target_temp);
-	if( fabs((double)(curr_temp - target_temp)) >= 100 ){
-		// Transition
-		_gamma_toggle_timer_check(0);
+			transition_get_temp(&transition),target_temp);
+	if( fabs((double)(transition_get_temp(&transition) - target_temp)) >= 100 ){
+		// A running transition turns toward the new target where it is
+		transition_retarget(&transition,target_temp,opt_get_trans_speed());
 		_gamma_toggle_timer_trans(1);
 	}
 	guimain_update_info();
@@ -126,9 +116,9 @@ void guigamma_enable(void){
 void guigamma_init_timers(void){
 
 	// Make sure gamma is synced up
-	curr_temp = gamma_state_get_temperature();
-	(void)gamma_state_set_temperature(curr_temp,opt_get_gamma());
-	_gamma_toggle_timer_check(1);
+	transition_init(&transition,gamma_state_get_temperature());
+	(void)gamma_state_set_temperature(transition_get_temp(&transition),
+			opt_get_gamma());
 	(void)guigamma_check((HWND)NULL,(UINT)NULL,(UINT)NULL,(DWORD)NULL);
 }
 
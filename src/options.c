@@ -36,6 +36,20 @@ typedef struct{
 	int portable;
 	/**\brief Console mode enabled? */
 	int nogui;
+	/**\brief Print the schedule and exit? */
+	int print_schedule;
+	/**\brief Read temperature back from the display instead of the shadow */
+	int verify_gamma;
+	/**\brief Effective display bit depth for the upload gate, 0 disables */
+	int gate_depth;
+	/**\brief Number of CRTCs simulated by the null method */
+	int null_crtcs;
+	/**\brief Ramp size of the null method */
+	int null_size;
+	/**\brief Latency of each null method request in milliseconds */
+	float null_latency;
+	/**\brief File the null method records to, empty to keep in memory */
+	char null_file[LONGEST_PATH];
 	/**\brief Verbosity level */
 	int verbose;
 	/**\brief Start GUI minimized */
@@ -51,6 +65,7 @@ typedef struct{
 } rs_opts;
 
 static rs_opts Rs_opts;
+static map_lut_s map_lut;
 static pair default_map[]={
 	{177.0,	100},
 	{3.0,	100},
@@ -110,6 +125,10 @@ void opt_init(char *exename){
 	(void)opt_set_transpeed(1000);
 	(void)opt_set_oneshot(0);
 	(void)opt_set_nogui(0);
+	(void)opt_set_print_schedule(0);
+	(void)opt_set_verify_gamma(0);
+	(void)opt_set_gate_depth(DEFAULT_GATE_DEPTH);
+	(void)opt_set_null(1,256,0.0f,NULL);
 	if(sep && (sep<(exename+LONGEST_PATH-10))){
 		strncpy(Rs_opts.exepath,exename,sep-exename+1);
 	}else{
@@ -214,6 +233,13 @@ int opt_parse_method(char *val){
 	int ret;
 	if (strcmp(val, "auto") == 0 || strcmp(val, "Auto") == 0 ){
 		ret = opt_set_method(GAMMA_METHOD_AUTO);
+	}else if (strcmp(val, "wayland") == 0 || strcmp(val, "Wayland") == 0) {
+#ifdef ENABLE_WAYLAND
+		ret = opt_set_method(GAMMA_METHOD_WAYLAND);
+#else
+		LOG(LOGERR,_("Wayland method was not enabled at compile time.\n"));
+		ret = RET_FUN_FAILED;
+#endif
 	}else if (strcmp(val, "randr") == 0 || strcmp(val, "RANDR") == 0) {
 #ifdef ENABLE_RANDR
 		ret = opt_set_method(GAMMA_METHOD_RANDR);
@@ -227,6 +253,13 @@ int opt_parse_method(char *val){
 #else
 		LOG(LOGERR,_("VidMode method was not enabled at compile time.\n"));
 		ret = RET_FUN_FAILED;
+#endif
+	} else if (strcmp(val, "null") == 0 || strcmp(val, "Null") == 0) {
+#ifdef ENABLE_NULL
+		ret = opt_set_method(GAMMA_METHOD_NULL);
+#else
+		LOG(LOGERR,_("Null method was not enabled at compile time.\n"));
+		ret = RET_FUN_FAILED;
 #endif
 	} else if (strcmp(val, "wingdi") == 0 || strcmp(val, "WinGDI") == 0) {
 #ifdef ENABLE_WINGDI
@@ -249,6 +282,67 @@ int opt_set_oneshot(int onoff){
 	return RET_FUN_SUCCESS;
 }
 
+// Sets schedule printing mode
+int opt_set_print_schedule(int onoff){
+	Rs_opts.print_schedule = onoff;
+	return RET_FUN_SUCCESS;
+}
+
+// Sets gamma verification mode
+int opt_set_verify_gamma(int onoff){
+	Rs_opts.verify_gamma = onoff;
+	return RET_FUN_SUCCESS;
+}
+
+// Sets bit depth the upload gate compares at
+int opt_set_gate_depth(int bits){
+	if( (bits<0) || (bits>16) ){
+		LOG(LOGERR,_("Gate depth must be between 0 and 16 bits."));
+		return RET_FUN_FAILED;
+	}
+	Rs_opts.gate_depth = bits;
+	return RET_FUN_SUCCESS;
+}
+
+// Configures the null method
+int opt_set_null(int crtcs, int size, float latency, const char *file){
+	if( (crtcs<1) || (size<2) || (size>65535) || (latency<0.0f) ){
+		LOG(LOGERR,_("Invalid null method configuration."));
+		return RET_FUN_FAILED;
+	}
+	if( file && (strlen(file)>=LONGEST_PATH) ){
+		LOG(LOGERR,_("Null method record file name too long."));
+		return RET_FUN_FAILED;
+	}
+	Rs_opts.null_crtcs = crtcs;
+	Rs_opts.null_size = size;
+	Rs_opts.null_latency = latency;
+	strcpy(Rs_opts.null_file,file ? file : "");
+	return RET_FUN_SUCCESS;
+}
+
+// Parses null method configuration
+int opt_parse_null(char *val){
+	char *size,*latency,*file=NULL;
+	size = strchr(val, ':');
+	if (size == NULL) {
+		LOG(LOGERR,_("Malformed null argument: %s.\n"),val);
+		return RET_FUN_FAILED;
+	}
+	*(size++) = '\0';
+	latency = strchr(size, ':');
+	if (latency == NULL) {
+		LOG(LOGERR,_("Malformed null argument: %s.\n"),val);
+		return RET_FUN_FAILED;
+	}
+	*(latency++) = '\0';
+	/* Whatever follows is the file name, which may contain ':' */
+	file = strchr(latency, ':');
+	if (file != NULL)
+		*(file++) = '\0';
+	return opt_set_null(atoi(val),atoi(size),(float)atof(latency),file);
+}
+
 // Set portable mode
 int opt_set_portable(int onoff){
 	Rs_opts.portable = onoff;
@@ -307,6 +401,68 @@ int opt_set_disabled(int val){
 	return RET_FUN_SUCCESS;
 }
 
+// Bucket an elevation falls in, also for breakpoints so that both agree
+static int _map_bucket(double elev){
+	return (int)floor((elev+180.0)/MAP_LUT_STEP);
+}
+
+// Compiles the map for constant time lookups, the same segments as
+// gamma_calc_temp walks
+static int _compile_map(const pair *map, int size){
+	double prevelev = map[size-1].elev+360;
+	double prevtemp = map[size-1].temp;
+	int seg = 1;
+	int i;
+
+	free(map_lut.lower);
+	map_lut.lower = (double*)malloc(sizeof(double)*4*(size+2));
+	map_lut.valid = 0;
+	if( !map_lut.lower || (size+2>UINT16_MAX) ){
+		LOG(LOGWARN,_("Unable to compile temperature map"));
+		return RET_FUN_FAILED;
+	}
+	map_lut.span = map_lut.lower+(size+2);
+	map_lut.base = map_lut.span+(size+2);
+	map_lut.delta = map_lut.base+(size+2);
+	map_lut.lower[0] = HUGE_VAL;
+	map_lut.span[0] = map_lut.base[0] = map_lut.delta[0] = 0.0;
+	for( i=0; i<=size; ++i ){
+		double currelev = (i<size) ? map[i].elev : map[0].elev-360.0;
+		double currtemp = (i<size) ? map[i].temp : map[0].temp;
+		/* Segments the walk never settles in are left out */
+		if( prevelev>currelev ){
+			map_lut.lower[seg] = currelev;
+			map_lut.span[seg] = prevelev-currelev;
+			map_lut.base[seg] = currtemp;
+			map_lut.delta[seg] = prevtemp-currtemp;
+			++seg;
+		}
+		prevelev = currelev;
+		prevtemp = currtemp;
+	}
+	map_lut.size = seg;
+
+	/* Each bucket starts in the highest segment whose breakpoint lies in
+	   an earlier bucket, and can step up once within itself */
+	seg = map_lut.size-1;
+	for( i=0; i<=MAP_LUT_SIZE; ++i ){
+		int inside = 0;
+		while( (seg>1) && (_map_bucket(map_lut.lower[seg-1])<i) )
+			--seg;
+		map_lut.bucket[i] = (uint16_t)seg;
+		while( (seg-1-inside>0)
+				&& (_map_bucket(map_lut.lower[seg-1-inside])==i) )
+			++inside;
+		if( inside>1 ){
+			LOG(LOGVERBOSE,_("Map breakpoints closer than %.2f degrees, "
+					"not compiled"),MAP_LUT_STEP);
+			return RET_FUN_SUCCESS;
+		}
+	}
+	map_lut.valid = 1;
+	return RET_FUN_SUCCESS;
+}
+
 // Parse temperature map
 int opt_parse_map(char *map){
 	char *currstr=map; /* Pointer string */
@@ -357,6 +513,7 @@ int opt_parse_map(char *map){
 		free(Rs_opts.map);
 	Rs_opts.map = curr_map;
 	Rs_opts.map_size=cnt;
+	(void)_compile_map(curr_map,cnt);
 	return RET_FUN_SUCCESS;
 }
 
@@ -387,6 +544,22 @@ int opt_get_oneshot(void)
 int opt_get_portable(void)
 {return Rs_opts.portable;}
 
+int opt_get_print_schedule(void)
+{return Rs_opts.print_schedule;}
+
+int opt_get_verify_gamma(void)
+{return Rs_opts.verify_gamma;}
+
+int opt_get_gate_depth(void)
+{return Rs_opts.gate_depth;}
+
+void opt_get_null(int *crtcs, int *size, float *latency, char **file){
+	*crtcs = Rs_opts.null_crtcs;
+	*size = Rs_opts.null_size;
+	*latency = Rs_opts.null_latency;
+	*file = Rs_opts.null_file[0] ? Rs_opts.null_file : NULL;
+}
+
 int opt_get_trans_speed(void)
 {return Rs_opts.trans_speed;}
 
@@ -418,6 +591,13 @@ pair *opt_get_map(int *size){
 	}
 }
 
+const map_lut_s *opt_get_map_lut(void){
+	// The default map is compiled on first use
+	if( !Rs_opts.map && !map_lut.lower )
+		(void)_compile_map(default_map,(int)SIZEOF(default_map));
+	return &map_lut;
+}
+
 temp_gamma *opt_get_gammap(int *size){
 	(*size)=(int)SIZEOF(blackbody_color);
 	return blackbody_color;
@@ -457,4 +637,7 @@ void opt_free(void){
 	LOG(LOGVERBOSE,_("Freeing options"));
 	if( Rs_opts.map )
 		free(Rs_opts.map);
+	free(map_lut.lower);
+	map_lut.lower = NULL;
+	map_lut.valid = 0;
 }
@@ -22,6 +22,9 @@
 /**\brief Default transition speed */
 #define DEFAULT_TRANSPEED   1000
 
+/**\brief Default bit depth for gating ramp uploads */
+#define DEFAULT_GATE_DEPTH  10
+
 /**\brief Retrieves full path of the configuration file.
  * \param buffer buffer to store the configuration file.
  * \param bufsize size of the buffer.
@@ -77,9 +80,11 @@ int opt_set_method(gamma_method_t method);
 
 /**\brief Parses a string of the method
  * \param val string containing either 
+ *		"wayland" (or "Wayland"),
  *		"randr" (or "RANDR"),
  *		"vidmode" (or "VidMode"),
- *	or	"wingdi" (or "WinGDI")
+ *		"wingdi" (or "WinGDI"),
+ *	or	"null" (or "Null")
  */
 int opt_parse_method(char *val);
 
@@ -88,6 +93,37 @@ int opt_parse_method(char *val);
  */
 int opt_set_oneshot(int onoff);
 
+/**\brief Sets schedule printing mode (print the day's schedule and exit)
+ * \param onoff set to 1 to enable
+ */
+int opt_set_print_schedule(int onoff);
+
+/**\brief Sets gamma verification mode
+ * \param onoff set to 1 to read the temperature back from the display
+ *	instead of trusting the last applied state
+ */
+int opt_set_verify_gamma(int onoff);
+
+/**\brief Sets bit depth of the display for gating ramp uploads
+ * \param bits uploads that change no entry by a full step at this depth
+ *	are skipped, 16 skips only identical ramps, 0 disables the gate
+ */
+int opt_set_gate_depth(int bits);
+
+/**\brief Configures the null method
+ * \param crtcs number of simulated CRTCs
+ * \param size ramp size of each CRTC
+ * \param latency milliseconds each request takes
+ * \param file file to record applied ramps to, NULL to keep them in memory
+ */
+int opt_set_null(int crtcs, int size, float latency,
+		/*@null@*/ const char *file);
+
+/**\brief Parses null method configuration
+ * \param val string in the format CRTCS:SIZE:LATENCY[:FILE]
+ */
+int opt_parse_null(char *val);
+
 /**\brief Sets portable mode (Save settings to program folder)
  * \param onoff set to 1 to enable
  */
@@ -161,6 +197,20 @@ int opt_get_oneshot(void);
 /**\brief Retrieves portable mode */
 int opt_get_portable(void);
 
+/**\brief Retrieves schedule printing mode */
+int opt_get_print_schedule(void);
+
+/**\brief Retrieves gamma verification mode */
+int opt_get_verify_gamma(void);
+
+/**\brief Retrieves upload gate bit depth */
+int opt_get_gate_depth(void);
+
+/**\brief Retrieves null method configuration, file is NULL when
+ * recording to memory */
+void opt_get_null(/*@out@*/ int *crtcs, /*@out@*/ int *size,
+		/*@out@*/ float *latency, /*@out@*/ char **file);
+
 /**\brief Retrieves transition speed */
 int opt_get_trans_speed(void);
 
@@ -185,6 +235,11 @@ int opt_get_disabled(void);
 /**\brief Retrieves current temperature map */
 /*@dependent@*/ pair *opt_get_map(/*@out@*/ int *size);
 
+/**\brief Retrieves current temperature map, compiled for lookups
+ * \details Compiled whenever the map is set, see map_lut_s.
+ */
+/*@observer@*/ const map_lut_s *opt_get_map_lut(void);
+
 /**\brief Retrieves current gamma map */
 /*@dependent@*/ temp_gamma *opt_get_gammap(/*@out@*/ int *size);
 
@@ -4,16 +4,28 @@
 
 #include "common.h"
 #include "gamma.h"
+#include "gamma_worker.h"
 #include "options.h"
 #include "solar.h"
 #include "location.h"
+#include "scheduler.h"
 #include "systemtime.h"
+#include "transition.h"
 #include "netutils.h"
 #include "thirdparty/argparser.h"
 
 #ifdef HAVE_SYS_SIGNAL_H
 # include <sys/signal.h>
 #endif
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_SIGNALFD_H)
+/**\brief Console waits on one epoll instance, signals included */
+# define CONSOLE_EPOLL
+# include <signal.h>
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+#elif !defined(_WIN32)
+# include <poll.h>
+#endif
 
 #if defined(ENABLE_IUP)
 # include "gui/iupgui.h"
@@ -27,6 +39,11 @@
 #define RET_MAIN_OK 0
 #define RET_MAIN_ERR -1
 
+#ifdef ENABLE_WAYLAND
+# define WAYLAND_TXT ", Wayland"
+#else
+# define WAYLAND_TXT ""
+#endif
 #ifdef ENABLE_RANDR
 # define RANDR_TXT ", RANDR"
 #else
@@ -42,40 +59,63 @@
 #else
 # define WINGDI_TXT ""
 #endif
+#ifdef ENABLE_NULL
+# define NULL_TXT ", Null"
+#else
+# define NULL_TXT ""
+#endif
+
+// Internal function to add an option, an option the parser refuses would
+// otherwise be silently missing from the command line and config file
+static void _add_option(/*@null@*/ const ArgStr sname, const ArgStr lname,
+		const ArgStr help, const ArgValType type){
+	if( args_addarg(sname,lname,help,type)!=ARGRET_OK )
+		LOG(LOGERR,_("Unable to add option --%s"),lname);
+}
 
 // Internal function to parse arguments
 static int _parse_options(int argc, char *argv[]){
-	(void)args_addarg("b","bright",
+	_add_option("b","bright",
 		_("<BRIGHTNESS> Brightness (0.1 - 1)"),ARGVAL_STRING);
-	(void)args_addarg("c","crt",
-		_("<CRTC> CRTC to apply adjustment to (RANDR only)"),ARGVAL_STRING);
-	(void)args_addarg("g","gamma",
+	_add_option(NULL,"clock",
+		_("<real|fixed:T|scale:N[:T[:LEN]]> (Advanced) Clock to run on, T and LEN in seconds"),ARGVAL_STRING);
+	_add_option("c","crt",
+		_("<CRTC> CRTC to apply adjustment to (RANDR, Wayland outputs)"),ARGVAL_STRING);
+	_add_option("g","gamma",
 		_("<R:G:B> Additional gamma correction to apply"),ARGVAL_STRING);
-	(void)args_addarg("l","latlon",
+	_add_option("l","latlon",
 		_("<LAT:LON> Latitude and longitude"),ARGVAL_STRING);
-	(void)args_addarg("m","method",
-		_("<METHOD> Method to use (Auto" RANDR_TXT VIDMODE_TXT WINGDI_TXT ")"),ARGVAL_STRING);
-	(void)args_addarg("n","no-gui",
+	_add_option("m","method",
+		_("<METHOD> Method to use (Auto" WAYLAND_TXT RANDR_TXT VIDMODE_TXT WINGDI_TXT NULL_TXT ")"),ARGVAL_STRING);
+	_add_option("n","no-gui",
 		_("Run in console mode (no GUI)."),ARGVAL_NONE);
-	(void)args_addarg("o","oneshot",
+	_add_option("o","oneshot",
 		_("Adjust color and then exit (no GUI)"),ARGVAL_NONE);
-	(void)args_addarg("p","portable",
+	_add_option(NULL,"print-schedule",
+		_("Print the solar events and color temperatures of the day and exit"),ARGVAL_NONE);
+	_add_option("p","portable",
 		_("Save to executable folder"),ARGVAL_NONE);
-	(void)args_addarg("r","speed",
+	_add_option("r","speed",
 		_("<SPEED> Transition speed (default 1000 K/s)"),ARGVAL_STRING);
-	(void)args_addarg("s","screen",
+	_add_option("s","screen",
 		_("<SCREEN> Screen to apply to"),ARGVAL_STRING);
-	(void)args_addarg("t","temps",
+	_add_option("t","temps",
 		_("<DAY:NIGHT> Color temperature to set at daytime/night"),ARGVAL_STRING);
-	(void)args_addarg("v","verbose",
+	_add_option("v","verbose",
 		_("<LEVEL> Verbosity of output (0 = err/warn, 1 = info, 2 = verbose)"),ARGVAL_STRING);
-	(void)args_addarg(NULL,"map",
+	_add_option(NULL,"map",
 		_("(Advanced) Temperature map"),ARGVAL_STRING);
-	(void)args_addarg(NULL,"min",
+	_add_option(NULL,"verify-gamma",
+		_("(Advanced) Read color temperature back from the display"),ARGVAL_NONE);
+	_add_option(NULL,"gate-depth",
+		_("<BITS> (Advanced) Skip ramp uploads invisible at this bit depth (default 10, 0 = off)"),ARGVAL_STRING);
+	_add_option(NULL,"null",
+		_("<CRTCS:SIZE:LATENCY[:FILE]> (Advanced) Null method CRTCs, ramp size, ms per request and record file"),ARGVAL_STRING);
+	_add_option(NULL,"min",
 		_("Start GUI minimized"),ARGVAL_NONE);
-	(void)args_addarg("d","disable",
+	_add_option("d","disable",
 		_("Start GUI disabled"),ARGVAL_NONE);
-	(void)args_addarg("h","help",
+	_add_option("h","help",
 		_("Display this help message"),ARGVAL_NONE);
 	if( (args_parse(argc,argv) != ARGRET_OK) ){
 		LOG(LOGERR,_("Error occurred parsing options,"
@@ -107,6 +147,8 @@ static int _parse_options(int argc, char *argv[]){
 				|| err;
 		if( (val=args_getnamed("b")) )
 			err = (!opt_set_brightness(atof(val))) || err;
+		if( (val=args_getnamed("clock")) )
+			err = (!systemtime_parse_clock(val)) || err;
 		if( (val=args_getnamed("c")) )
 			err = (!opt_set_crtc(atoi(val))) || err;
 		if( (val=args_getnamed("g")) )
@@ -119,12 +161,20 @@ static int _parse_options(int argc, char *argv[]){
 			err = (!opt_parse_method(val)) || err;
 		if( (val=args_getnamed("o")) )
 			err = (!opt_set_oneshot(1) ) || err;
+		if( (val=args_getnamed("print-schedule")) )
+			err = (!opt_set_print_schedule(1) ) || err;
 		if( (val=args_getnamed("r")) )
 			err = (!opt_set_transpeed(atoi(val))) || err;
 		if( (val=args_getnamed("s")) )
 			err = (!opt_set_screen(atoi(val))) || err;
 		if( (val=args_getnamed("t")) )
 			err = (!opt_parse_temperatures(val)) || err;
+		if( (val=args_getnamed("verify-gamma")) )
+			err = (!opt_set_verify_gamma(1)) || err;
+		if( (val=args_getnamed("gate-depth")) )
+			err = (!opt_set_gate_depth(atoi(val))) || err;
+		if( (val=args_getnamed("null")) )
+			err = (!opt_parse_null(val)) || err;
 		if( (val=args_getnamed("min")) )
 			err = (!opt_set_min(1)) || err;
 		if( (val=args_getnamed("d")) )
@@ -162,19 +212,139 @@ static int _do_oneshot(void){
 	return RET_FUN_SUCCESS;
 }
 
+// Formats a time of day, or dashes for times that do not occur
+static void _format_time(double t, char *buf, size_t size){
+	time_t tt = (time_t)t;
+	struct tm *tm;
+	if( (t != t) || !(tm=localtime(&tt)) ){
+		(void)snprintf(buf,size,"--:--");
+		return;
+	}
+	(void)strftime(buf,size,"%H:%M",tm);
+}
+
+// Prints one stretch of the schedule, clipped to the day
+static void _print_stretch(double start, double end, double day_start,
+		double day_end, int temp_from, int temp_to){
+	char from[16],to[16];
+	if( start < day_start )
+		start = day_start;
+	if( end > day_end )
+		end = day_end;
+	if( end <= start )
+		return;
+	_format_time(start,from,sizeof(from));
+	_format_time(end,to,sizeof(to));
+	if( temp_from == temp_to )
+		printf(_("  %s - %s  %dK\n"),from,to,temp_from);
+	else
+		printf(_("  %s - %s  %dK -> %dK\n"),from,to,temp_from,temp_to);
+}
+
+/* Print the schedule of the day and exit. */
+static int _do_print_schedule(void){
+	const solar_time_t order[] = {
+		SOLAR_TIME_ASTRO_DAWN, SOLAR_TIME_NAUT_DAWN, SOLAR_TIME_CIVIL_DAWN,
+		SOLAR_TIME_SUNRISE, SOLAR_TIME_NOON, SOLAR_TIME_SUNSET,
+		SOLAR_TIME_CIVIL_DUSK, SOLAR_TIME_NAUT_DUSK, SOLAR_TIME_ASTRO_DUSK,
+		SOLAR_TIME_MIDNIGHT};
+	const char *names[SOLAR_TIME_MAX];
+	double times[SOLAR_TIME_MAX];
+	double now,day_start,day_end;
+	const scheduler_run_s *runs;
+	time_t tt;
+	struct tm *tm;
+	char buf[16];
+	int size,i;
+
+	names[SOLAR_TIME_NOON] = _("Noon");
+	names[SOLAR_TIME_MIDNIGHT] = _("Midnight");
+	names[SOLAR_TIME_ASTRO_DAWN] = _("Astronomical dawn");
+	names[SOLAR_TIME_NAUT_DAWN] = _("Nautical dawn");
+	names[SOLAR_TIME_CIVIL_DAWN] = _("Civil dawn");
+	names[SOLAR_TIME_SUNRISE] = _("Sunrise");
+	names[SOLAR_TIME_SUNSET] = _("Sunset");
+	names[SOLAR_TIME_CIVIL_DUSK] = _("Civil dusk");
+	names[SOLAR_TIME_NAUT_DUSK] = _("Nautical dusk");
+	names[SOLAR_TIME_ASTRO_DUSK] = _("Astronomical dusk");
+
+	if( !systemtime_get_time(&now) ){
+		LOG(LOGERR,_("Unable to read system time."));
+		return RET_FUN_FAILED;
+	}
+	// Local day containing now
+	tt = (time_t)now;
+	if( !(tm=localtime(&tt)) )
+		return RET_FUN_FAILED;
+	tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
+	tm->tm_isdst = -1;
+	day_start = (double)mktime(tm);
+	++tm->tm_mday;
+	tm->tm_isdst = -1;
+	day_end = (double)mktime(tm);
+	(void)strftime(buf,sizeof(buf),"%Y-%m-%d",localtime(&tt));
+
+	printf(_("Schedule for %s at %.2f Lat, %.2f Lon:\n"),buf,
+			opt_get_lat(),opt_get_lon());
+	solar_table_fill((day_start+day_end)/2,opt_get_lat(),opt_get_lon(),times);
+	for( i=0; i<(int)(sizeof(order)/sizeof(order[0])); ++i ){
+		_format_time(times[order[i]],buf,sizeof(buf));
+		printf("  %-20s %s\n",names[order[i]],buf);
+	}
+
+	// Runs hold a temperature, the gaps between them are transitions
+	printf("\n");
+	runs = scheduler_get_table(now,opt_get_lat(),opt_get_lon(),
+			opt_get_temp_day(),opt_get_temp_night(),&size);
+	for( i=0; (i<size) && runs; ++i ){
+		if( i > 0 )
+			_print_stretch(runs[i-1].end,runs[i].start,day_start,day_end,
+					runs[i-1].temp,runs[i].temp);
+		_print_stretch(runs[i].start,runs[i].end,day_start,day_end,
+				runs[i].temp,runs[i].temp);
+	}
+	return RET_FUN_SUCCESS;
+}
+
+/**\brief Console loop state */
+typedef struct{
+	/**\brief set once an exit signal arrived */
+	int exiting;
+	/**\brief set once SIGHUP asked to re-check the target */
+	int recheck;
+	/**\brief waits, reported on exit */
+	unsigned long wakeups;
+	/**\brief transitions started, reported on exit */
+	unsigned long transitions;
+	/**\brief transition frames applied, reported on exit */
+	unsigned long frames;
+	/**\brief set when a wait saw the clock jump, until the loop handles it */
+	int clock_changed;
+#ifdef CONSOLE_EPOLL
+	/**\brief epoll instance all descriptors are waited on with */
+	int epfd;
+	/**\brief signals blocked and read from sigfd instead */
+	sigset_t sigmask;
+	/**\brief signal descriptor */
+	int sigfd;
+	/**\brief display change descriptor, -1 if none */
+	int displayfd;
+#endif
+} console_s;
+
 #ifdef _WIN32
-	static int exiting=0;
-	/* Signal handler for exit signals */
+	static volatile LONG console_signal=0;
+	/* Signal handler for exit signals, runs on its own thread */
 	static BOOL CtrlHandler( DWORD fdwCtrlType ){
 		switch( fdwCtrlType ){
 		case CTRL_C_EVENT:
 			LOG(LOGINFO,_("Ctrl-C event."));
-			exiting=1;
+			console_signal=1;
 			return( TRUE );
 		// CTRL-CLOSE: confirm that the user wants to exit.
 		case CTRL_CLOSE_EVENT:
 			LOG(LOGINFO,_("Ctrl-Close event."));
-			exiting=1;
+			console_signal=1;
 			return( TRUE );
 		// Pass other signals to the next handler.
 		case CTRL_BREAK_EVENT:
@@ -195,13 +365,12 @@ static int _do_oneshot(void){
 		if( !SetConsoleCtrlHandler( (PHANDLER_ROUTINE) CtrlHandler, TRUE ) )
 			LOG(LOGERR,_("Unable to register Control Handler."));
 	}
-#elif defined(HAVE_SYS_SIGNAL_H)
-	static volatile sig_atomic_t exiting = 0;
-	/* Signal handler for exit signals */
+#elif defined(HAVE_SYS_SIGNAL_H) && !defined(CONSOLE_EPOLL)
+	static volatile sig_atomic_t console_signal = 0;
+	/* Signal handler for exit signals, only async-signal-safe work here */
 	static void
 	sigexit(int signo)
-	{	LOG(LOGINFO,_("Detected exit signal: %d"),signo);
-		exiting = 1;}
+	{console_signal = signo;}
 	/* Register signal handler */
 	static void sig_register(void){
 		struct sigaction sigact;
@@ -210,72 +379,213 @@ static int _do_oneshot(void){
 		sigact.sa_flags = 0;
 		/*@i@*/(void)sigaction(SIGINT, &sigact, NULL);
 		/*@i@*/(void)sigaction(SIGTERM, &sigact, NULL);
+		/*@i@*/(void)sigaction(SIGHUP, &sigact, NULL);
 	/*@i@*/}
-#else /* ! HAVE_SYS_SIGNAL_H */
-	static int exiting = 0;
+#elif !defined(CONSOLE_EPOLL)
+	static int console_signal = 0;
 #	define sig_register()
-#endif /* ! HAVE_SYS_SIGNAL_H */
+#endif
+
+// Handles a signal received by the console
+static void _console_signal(console_s *con, int signo){
+#ifdef SIGHUP
+	if( signo == SIGHUP ){
+		LOG(LOGINFO,_("Hangup signal, re-checking target"));
+		con->recheck = 1;
+		return;
+	}
+#endif
+	LOG(LOGINFO,_("Detected exit signal: %d"),signo);
+	con->exiting = 1;
+}
 
-static void transition_to_temp(int curr, int target, int speed){
-	int currtemp = curr;
+#ifdef CONSOLE_EPOLL
+// Watches a descriptor for input
+static int _console_watch(console_s *con, int fd){
+	struct epoll_event ev;
 
-	do{
-		if( curr > target ){
-			currtemp-=speed/10;
-			if( currtemp < target )
-				break;
-		}else{
-			currtemp+=speed/10;
-			if( currtemp > target )
-				break;
+	if( fd < 0 )
+		return RET_FUN_SUCCESS;
+	memset(&ev,0,sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if( epoll_ctl(con->epfd,EPOLL_CTL_ADD,fd,&ev) < 0 ){
+		LOG(LOGERR,_("Unable to watch descriptor %d"),fd);
+		return RET_FUN_FAILED;
+	}
+	return RET_FUN_SUCCESS;
+}
+#endif
+
+// Sets up the descriptors and signals the console waits on
+static int _console_open(console_s *con){
+	memset(con,0,sizeof(*con));
+#ifdef CONSOLE_EPOLL
+	con->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if( con->epfd < 0 ){
+		LOG(LOGERR,_("Unable to create event loop"));
+		return RET_FUN_FAILED;
+	}
+	// Signals are read like any other event, no handler runs
+	(void)sigemptyset(&con->sigmask);
+	(void)sigaddset(&con->sigmask,SIGINT);
+	(void)sigaddset(&con->sigmask,SIGTERM);
+	(void)sigaddset(&con->sigmask,SIGHUP);
+	(void)sigprocmask(SIG_BLOCK,&con->sigmask,NULL);
+	con->sigfd = signalfd(-1,&con->sigmask,SFD_NONBLOCK|SFD_CLOEXEC);
+	con->displayfd = gamma_state_get_fd();
+	if( (con->sigfd < 0) || !_console_watch(con,con->sigfd)
+			|| !_console_watch(con,con->displayfd)
+			|| !_console_watch(con,systemtime_get_alarm_fd()) ){
+		LOG(LOGERR,_("Unable to set up event loop"));
+		if( con->sigfd >= 0 )
+			(void)close(con->sigfd);
+		(void)close(con->epfd);
+		(void)sigprocmask(SIG_UNBLOCK,&con->sigmask,NULL);
+		return RET_FUN_FAILED;
+	}
+#else
+	sig_register();
+#endif
+	return RET_FUN_SUCCESS;
+}
+
+// Releases the descriptors and signals of the console
+static void _console_close(console_s *con){
+#ifdef CONSOLE_EPOLL
+	(void)close(con->sigfd);
+	(void)close(con->epfd);
+	(void)sigprocmask(SIG_UNBLOCK,&con->sigmask,NULL);
+#else
+	(void)con;
+#endif
+}
+
+// Waits for an event or the timeout, -1 to wait for events only, and
+// handles it
+static void _console_wait(console_s *con, int msec){
+#ifdef CONSOLE_EPOLL
+	struct epoll_event ev[4];
+	int cnt,i;
+#elif !defined(_WIN32)
+	struct pollfd pfd[2];
+#endif
+
+	// Waits are in clock time, which may run faster than real time
+	msec = systemtime_scale_wait(msec);
+	++con->wakeups;
+#ifdef CONSOLE_EPOLL
+	cnt = epoll_wait(con->epfd,ev,(int)(sizeof(ev)/sizeof(ev[0])),msec);
+	for( i=0; i<cnt; ++i ){
+		if( ev[i].data.fd == con->sigfd ){
+			struct signalfd_siginfo info;
+			while( read(con->sigfd,&info,sizeof(info)) == sizeof(info) )
+				_console_signal(con,(int)info.ssi_signo);
+		}else if( ev[i].data.fd == con->displayfd ){
+			if( !gamma_state_poll() )
+				LOG(LOGWARN,_("Unable to handle display change."));
+		}else if( ev[i].data.fd == systemtime_get_alarm_fd() ){
+			// Clear the alarm here, left readable it ends every wait
+			if( systemtime_clock_changed() )
+				con->clock_changed = 1;
 		}
+	}
+#else
+# ifndef _WIN32
+	pfd[0].fd = gamma_state_get_fd();
+	pfd[1].fd = systemtime_get_alarm_fd();
+	pfd[0].events = pfd[1].events = POLLIN;
+	pfd[0].revents = pfd[1].revents = 0;
+	// Interrupted by signals. Negative descriptors, e.g. while the gamma
+	// worker runs, are ignored.
+	(void)poll(pfd,2,msec);
+	if( (pfd[0].fd >= 0) && !gamma_state_poll() )
+		LOG(LOGWARN,_("Unable to handle display change."));
+	// Clear the alarm here, left readable it ends every wait
+	if( (pfd[1].fd >= 0) && (pfd[1].revents & POLLIN)
+			&& systemtime_clock_changed() )
+		con->clock_changed = 1;
+# else
+	SLEEP(msec);
+# endif
+	if( console_signal ){
+		_console_signal(con,(int)console_signal);
+		console_signal = 0;
+	}
+#endif
+}
 
-		LOG(LOGVERBOSE,_("Transition color: %dK"),currtemp);
-		if( !gamma_state_set_temperature(currtemp,opt_get_gamma()) ){
-			LOG(LOGERR,_("Temperature adjustment failed."));
-			exiting = 1;
-			break;
+// Moves to the target temperature, handling events in between
+static void transition_to_temp(console_s *con, int curr, int target,
+		int speed){
+	transition_s tr;
+
+	transition_init(&tr,curr);
+	transition_retarget(&tr,target,speed);
+	if( transition_is_active(&tr) )
+		++con->transitions;
+	while( transition_is_active(&tr) && !con->exiting ){
+		if( !transition_update(&tr) ){
+			con->exiting = 1;
+			return;
 		}
-		/*@i@*/SLEEP(100);
-	}while(!exiting);
+		if( transition_is_active(&tr) )
+			_console_wait(con,transition_wait(&tr));
+	}
+	con->frames += tr.frames;
+	if( transition_get_temp(&tr)==target )
+		return;
 
+	// Interrupted, finish in one step
 	LOG(LOGVERBOSE,_("Target color reached: %dK"),target);
 	if( !gamma_state_set_temperature(target,opt_get_gamma()) ){
 		LOG(LOGERR,_("Temperature adjustment failed."));
-		exiting = 1;
+		con->exiting = 1;
 	}
 }
 
 /* Change gamma continuously until break signal. */
 static int _do_console(void)
 {
+	console_s con;
 	int target_temp;
 	int transpeed = opt_get_trans_speed();
-	int sec_countdown=0;
+	double now;
+	double next_change=0.0;
+	int alarm_set=0;
 	int saved_temp = gamma_state_get_temperature();
 	int curr_temp = saved_temp;
 
 	LOG(LOGVERBOSE,_("Original temp: %dK"),saved_temp);
-	sig_register();
+	if( !_console_open(&con) )
+		return RET_FUN_FAILED;
 	do{
-		// Re-check every 20 minutes
-		if( sec_countdown <= 0 ){
+		// Resuming or setting the clock makes the deadline meaningless
+		if( systemtime_clock_changed() || con.clock_changed || con.recheck )
+			next_change = 0.0;
+		con.clock_changed = con.recheck = 0;
+		// Sleep until the target changes, not on a fixed interval
+		if( systemtime_get_time(&now) && (now >= next_change) ){
 			curr_temp=gamma_state_get_temperature();
-			target_temp=gamma_calc_curr_target_temp(
+			target_temp=scheduler_next_change(now,
 				opt_get_lat(),opt_get_lon(),
-				opt_get_temp_day(),opt_get_temp_night());
-			transition_to_temp(curr_temp,target_temp,transpeed);
-			sec_countdown = 60*20;
-		}else{
-			--sec_countdown;
+				opt_get_temp_day(),opt_get_temp_night(),&next_change);
+			transition_to_temp(&con,curr_temp,target_temp,transpeed);
+			// Armed once the transition is done, it has no use during it
+			alarm_set=systemtime_set_alarm(next_change);
 		}
-		LOG(LOGVERBOSE,_("Countdown: %d"),sec_countdown);
-		SLEEP(1000);
-	}while(!exiting);
-	exiting=0;
+		if( con.exiting )
+			break;
+		// The alarm wakes us at the change, otherwise wake up now and then
+		_console_wait(&con,alarm_set ? -1 : scheduler_wait(next_change));
+	}while(!con.exiting && !systemtime_expired());
+	con.exiting=0;
+	LOG(LOGINFO,_("Console: %lu wakeups, %lu transitions, %lu frames"),
+			con.wakeups,con.transitions,con.frames);
 	curr_temp=gamma_state_get_temperature();
 	// Use a constant 2000K/s transition speed to exit
-	transition_to_temp(curr_temp,DEFAULT_DAY_TEMP,2000);
+	transition_to_temp(&con,curr_temp,DEFAULT_DAY_TEMP,2000);
+	_console_close(&con);
 	return RET_FUN_SUCCESS;
 }
 
@@ -301,14 +611,24 @@ int main(int argc, char *argv[]){
 	if( !(_parse_options(argc,argv)) )
 		goto end;
 
+	// Printing the schedule needs no display
+	if( opt_get_print_schedule() ){
+		ret = _do_print_schedule();
+		goto end;
+	}
+
 	// Initialize gamma method
 	if( !gamma_load_methods() )
 		goto end;
 
+	// Ramps are never restored after a one-shot adjustment
 	method = gamma_init_method(opt_get_screen(),opt_get_crtc(),
-			opt_get_method());
+			!opt_get_oneshot(),opt_get_method());
 	if( !method )
 		goto end;
+	// Ramps are uploaded off the main thread, unless applied just once
+	if( !opt_get_oneshot() && !gamma_worker_start() )
+		LOG(LOGWARN,_("Adjusting gamma on the main thread."));
 
 	// Initialize location method
 	if( !net_init() ){
@@ -342,6 +662,8 @@ int main(int argc, char *argv[]){
 	(void)gamma_state_free();
 
 	end:
+	scheduler_free();
+	systemtime_free();
 	opt_free();
 	args_free();
 	log_end();
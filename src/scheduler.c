@@ -0,0 +1,324 @@
+#include "common.h"
+#include "gamma.h"
+#include "options.h"
+#include "scheduler.h"
+#include "solar.h"
+#include "systemtime.h"
+#include "transition.h"
+
+/* Seconds in a day */
+#define SCHEDULER_DAY	86400.0
+
+/**\brief Table of runs along with the inputs it was computed from */
+typedef struct{
+	/**\brief UTC day the table was computed for, 0 if empty */
+	double day;
+	/**\brief Latitude */
+	float lat;
+	/**\brief Longitude */
+	float lon;
+	/**\brief Day temperature */
+	int temp_day;
+	/**\brief Night temperature */
+	int temp_night;
+	/**\brief Copy of the elevation map */
+	/*@null@*/ /*@only@*/ pair *map;
+	/**\brief Number of map entries */
+	int map_size;
+	/**\brief Runs in order */
+	/*@null@*/ /*@only@*/ scheduler_run_s *runs;
+	/**\brief Number of runs */
+	int size;
+} scheduler_table_s;
+
+static scheduler_table_s table = {0.0,0.0f,0.0f,0,0,NULL,0,NULL,0};
+
+// Target temperature at a time, from solar calculations
+static int scheduler_target_solar(double t, float lat, float lon,
+		int temp_day, int temp_night)
+{
+	return gamma_calc_temp(solar_elevation(t,lat,lon),temp_day,temp_night);
+}
+
+// Finds the run containing a time
+static /*@null@*/ /*@observer@*/ const scheduler_run_s *scheduler_find_run(
+		double t)
+{
+	int i;
+
+	for( i=0; i<table.size; ++i ){
+		if( t<table.runs[i].start )
+			break;
+		if( t<table.runs[i].end )
+			return &table.runs[i];
+	}
+	return NULL;
+}
+
+// Target temperature at a time, from the table while it holds still
+static int scheduler_target_at(double t, float lat, float lon,
+		int temp_day, int temp_night)
+{
+	const scheduler_run_s *run = scheduler_find_run(t);
+
+	if( run )
+		return run->temp;
+	return scheduler_target_solar(t,lat,lon,temp_day,temp_night);
+}
+
+// Checks whether the map holds the same temperature around an elevation
+static int scheduler_map_flat(double elevation)
+{
+	double prevelev = table.map[table.map_size-1].elev+360.0;
+	double prevtemp = table.map[table.map_size-1].temp;
+	int i;
+
+	for( i=0; i<=table.map_size; ++i ){
+		/* Wraps around like gamma_calc_temp */
+		double currelev = (i<table.map_size) ? table.map[i].elev
+				: table.map[0].elev-360.0;
+		double currtemp = (i<table.map_size) ? table.map[i].temp
+				: table.map[0].temp;
+		if( (elevation<=prevelev) && (elevation>=currelev) )
+			return currtemp==prevtemp;
+		prevelev = currelev;
+		prevtemp = currtemp;
+	}
+	return 0;
+}
+
+// Narrows down where the target settles on temp, between a time outside
+// and a time inside the run
+static double scheduler_run_edge(double outside, double inside, int temp)
+{
+	if( scheduler_target_solar(outside,table.lat,table.lon,
+				table.temp_day,table.temp_night)==temp )
+		return outside;
+	while( fabs(inside-outside)>SCHEDULER_PRECISION ){
+		double mid = (inside+outside)/2;
+		if( scheduler_target_solar(mid,table.lat,table.lon,
+					table.temp_day,table.temp_night)==temp )
+			inside = mid;
+		else
+			outside = mid;
+	}
+	return inside;
+}
+
+// Sorts times
+static int scheduler_compare_time(const void *a, const void *b)
+{
+	double ta = *(const double*)a;
+	double tb = *(const double*)b;
+
+	if( ta<tb )
+		return -1;
+	return ta>tb ? 1 : 0;
+}
+
+// Appends the times the sun passes the map breakpoints, and solar noon
+// and midnight where the elevation map wraps, on the day of date
+static int scheduler_add_events(double date, float lat, float lon,
+		/*@out@*/ double *events)
+{
+	double times[SOLAR_TIME_MAX];
+	int i;
+	int cnt=0;
+
+	solar_table_fill(date,lat,lon,times);
+	events[cnt++] = times[SOLAR_TIME_NOON];
+	events[cnt++] = times[SOLAR_TIME_MIDNIGHT];
+	for( i=0; i<table.map_size; ++i ){
+		double elev = table.map[i].elev;
+		int rising = 1;
+		/* The map counts the rising sun from the far side of 90 degrees */
+		if( elev>90.0 )
+			elev = 180.0-elev;
+		else if( elev<-90.0 )
+			elev = -180.0-elev;
+		else
+			rising = 0;
+		if( solar_time_of_elevation(date,lat,lon,elev,rising,&events[cnt]) )
+			++cnt;
+	}
+	return cnt;
+}
+
+// Works out the runs of the table for its day
+static int scheduler_build(void)
+{
+	double start = table.day-SCHEDULER_DAY;
+	double end = table.day+2*SCHEDULER_DAY;
+	double *events;
+	int max = 5*(table.map_size+2)+2;
+	int cnt=0;
+	int last=-1;
+	int i;
+
+	events = (double*)malloc(sizeof(double)*max);
+	table.runs = (scheduler_run_s*)malloc(sizeof(scheduler_run_s)*max);
+	if( !events || !table.runs ){
+		LOG(LOGERR,_("Insufficient memory"));
+		free(events);
+		free(table.runs);
+		table.runs = NULL;
+		return RET_FUN_FAILED;
+	}
+	/* Events of the days around the table too, since local solar days
+	   reach past UTC days */
+	events[cnt++] = start;
+	events[cnt++] = end;
+	for( i=-2; i<=2; ++i )
+		cnt += scheduler_add_events(table.day+(i+0.5)*SCHEDULER_DAY,
+				table.lat,table.lon,events+cnt);
+	qsort(events,(size_t)cnt,sizeof(double),scheduler_compare_time);
+
+	/* Between events the sun stays within one segment of the map, and the
+	   target holds still where that segment is flat. The event times are
+	   approximate, so the ends of each run are found by bisection. */
+	table.size = 0;
+	for( i=1; i<cnt; ++i ){
+		double mid = (events[i-1]+events[i])/2;
+		double a,b;
+		int temp;
+		if( (events[i-1]<start) || (events[i]>end)
+				|| (events[i]-events[i-1]<=2*SCHEDULER_PRECISION)
+				|| !scheduler_map_flat(solar_elevation(mid,table.lat,
+						table.lon)) )
+			continue;
+		temp = scheduler_target_solar(mid,table.lat,table.lon,
+				table.temp_day,table.temp_night);
+		a = scheduler_run_edge(events[i-1],mid,temp);
+		b = scheduler_run_edge(events[i],mid,temp);
+		/* Runs either side of one event are a single run */
+		if( (last==i-1) && (table.runs[table.size-1].temp==temp) ){
+			table.runs[table.size-1].end = b;
+		}else{
+			table.runs[table.size].start = a;
+			table.runs[table.size].end = b;
+			table.runs[table.size].temp = temp;
+			++table.size;
+		}
+		last = i;
+	}
+	free(events);
+	LOG(LOGVERBOSE,_("Schedule table: %d runs"),table.size);
+	return RET_FUN_SUCCESS;
+}
+
+// Recomputes the table on a new day or when its inputs change
+static void scheduler_update(double date, float lat, float lon,
+		int temp_day, int temp_night)
+{
+	double day = floor(date/SCHEDULER_DAY)*SCHEDULER_DAY;
+	int map_size;
+	pair *map = opt_get_map(&map_size);
+
+	if( table.map && (table.day==day) && (table.lat==lat)
+			&& (table.lon==lon) && (table.temp_day==temp_day)
+			&& (table.temp_night==temp_night)
+			&& (table.map_size==map_size)
+			&& (memcmp(table.map,map,sizeof(pair)*map_size)==0) )
+		return;
+
+	scheduler_free();
+	table.map = (pair*)malloc(sizeof(pair)*map_size);
+	if( !table.map ){
+		LOG(LOGERR,_("Insufficient memory"));
+		return;
+	}
+	memcpy(table.map,map,sizeof(pair)*map_size);
+	table.map_size = map_size;
+	table.day = day;
+	table.lat = lat;
+	table.lon = lon;
+	table.temp_day = temp_day;
+	table.temp_night = temp_night;
+	(void)scheduler_build();
+}
+
+const scheduler_run_s *scheduler_get_table(double date, float lat, float lon,
+		int temp_day, int temp_night, int *size)
+{
+	scheduler_update(date,lat,lon,temp_day,temp_night);
+	*size = table.size;
+	return table.runs;
+}
+
+// Checks whether the target moved far enough to be seen, or settled on
+// the day or night temperature, which it should reach exactly
+static int scheduler_is_step(int from, int to, int temp_day, int temp_night)
+{
+	if( from==to )
+		return 0;
+	if( (from<=0) || (to<=0) || (to==temp_day) || (to==temp_night) )
+		return 1;
+	return fabs(1e6/from-1e6/to)>=TRANSITION_JND_MIRED;
+}
+
+int scheduler_next_change(double now, float lat, float lon,
+		int temp_day, int temp_night, double *when)
+{
+	int temp;
+	double before = now;
+	double after = now;
+	int found = 0;
+
+	scheduler_update(now,lat,lon,temp_day,temp_night);
+	temp = scheduler_target_at(now,lat,lon,temp_day,temp_night);
+	/* Runs are skipped whole, transitions are sampled */
+	while( !found && (after<now+SCHEDULER_HORIZON) ){
+		const scheduler_run_s *run = scheduler_find_run(after);
+		before = after;
+		after = run ? run->end : after+SCHEDULER_SCAN;
+		if( after>now+SCHEDULER_HORIZON )
+			after = now+SCHEDULER_HORIZON;
+		found = scheduler_is_step(temp,
+				scheduler_target_at(after,lat,lon,temp_day,temp_night),
+				temp_day,temp_night);
+	}
+	if( !found ){
+		*when = now+SCHEDULER_HORIZON;
+		LOG(LOGINFO,_("Target temp %dK, no change within %ds"),
+				temp,SCHEDULER_HORIZON);
+		return temp;
+	}
+
+	/* The target is a step away at after but not yet at before */
+	while( after-before>SCHEDULER_PRECISION ){
+		double mid = (before+after)/2;
+		if( scheduler_is_step(temp,
+				scheduler_target_at(mid,lat,lon,temp_day,temp_night),
+				temp_day,temp_night) )
+			after = mid;
+		else
+			before = mid;
+	}
+	*when = after;
+	LOG(LOGINFO,_("Target temp %dK, next change in %.0fs"),temp,after-now);
+	return temp;
+}
+
+int scheduler_wait(double when)
+{
+	double now;
+
+	if( !systemtime_get_time(&now) )
+		return SCHEDULER_MAX_WAIT*1000;
+	if( when<=now )
+		return 0;
+	if( when-now>SCHEDULER_MAX_WAIT )
+		return SCHEDULER_MAX_WAIT*1000;
+	return (int)ceil((when-now)*1000.0);
+}
+
+void scheduler_free(void)
+{
+	free(table.map);
+	table.map = NULL;
+	table.map_size = 0;
+	free(table.runs);
+	table.runs = NULL;
+	table.size = 0;
+	table.day = 0.0;
+}
@@ -0,0 +1,73 @@
+/**\file		scheduler.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Finds when the target temperature next changes
+ * \details The target temperature follows the sun through the elevation
+ * map and stays put for most of the day. Instead of re-checking on a fixed
+ * interval, callers sleep until the time found here, when the target has
+ * moved by a visible step.
+ *
+ * Once a day, and whenever the location, temperatures or elevation map
+ * change, the times the sun passes the map breakpoints are worked out and
+ * the stretches in between where the target holds still are kept in a
+ * table. Queries outside the transitions are answered from that table
+ * without any solar calculations.
+ */
+
+#ifndef _REDSHIFT_SCHEDULER_H
+#define _REDSHIFT_SCHEDULER_H
+
+/**\brief Seconds searched ahead for a change */
+#define SCHEDULER_HORIZON	(24*60*60)
+
+/**\brief Seconds between samples of the search, short enough that the
+ * target cannot change and change back in between */
+#define SCHEDULER_SCAN		300
+
+/**\brief Seconds the time of a change is narrowed down to */
+#define SCHEDULER_PRECISION	1.0
+
+/**\brief Longest single sleep in seconds, so that time lost to suspend or
+ * clock changes is noticed where there is no clock alarm to wake on */
+#define SCHEDULER_MAX_WAIT	(30*60)
+
+/**\brief Stretch of time over which the target temperature holds still */
+typedef struct{
+	/**\brief start in seconds since the epoch */
+	double start;
+	/**\brief end in seconds since the epoch, not included */
+	double end;
+	/**\brief target temperature */
+	int temp;
+} scheduler_run_s;
+
+/**\brief Retrieves the table for the day of date
+ * \details The table covers the day before through the day after, in UTC,
+ * with runs in order. The gaps between runs are transitions.
+ * \param size receives the number of runs
+ */
+/*@observer@*/ /*@null@*/ const scheduler_run_s *scheduler_get_table(
+		double date, float lat, float lon, int temp_day, int temp_night,
+		/*@out@*/ int *size);
+
+/**\brief Finds the next time the target temperature changes
+ * \param now time to search from, in seconds since the epoch
+ * \param when receives the first time the target differs by a visible step
+ * from the target at now, or now+SCHEDULER_HORIZON if it does not change
+ * that soon
+ * \return target temperature at now
+ */
+int scheduler_next_change(double now, float lat, float lon,
+		int temp_day, int temp_night, /*@out@*/ double *when);
+
+/**\brief Retrieves milliseconds until a deadline on the system clock,
+ * at most SCHEDULER_MAX_WAIT seconds
+ * \details Waits are recomputed from the absolute deadline every time, so
+ * early wakeups do not push the deadline back.
+ */
+int scheduler_wait(double when);
+
+/**\brief Frees the table */
+void scheduler_free(void);
+
+#endif /* ! _REDSHIFT_SCHEDULER_H */
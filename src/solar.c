@@ -15,8 +15,10 @@ static double copysign(double x, double y){
 }
 #endif
 
-/* Angels of various times of day. */
+/* Angels of various times of day, indexed by solar_time_t. Noon and
+   midnight are not found by angle. */
 static const double time_angle[] = {
+	RAD(0.0),
 	RAD(0.0),
 	RAD(-90.0 + SOLAR_ASTRO_TWILIGHT_ELEV),
 	RAD(-90.0 + SOLAR_NAUT_TWILIGHT_ELEV),
@@ -288,6 +290,28 @@ double solar_elevation(double date, double lat, double lon)
 	return elev;
 }
 
+int solar_time_of_elevation(double date, double lat, double lon,
+		double elev, int rising, double *time)
+{
+	/* Calculate Julian day number */
+	double jdn = round(jd_from_epoch(date));
+	double t = jcent_from_jd(jdn);
+
+	/* Calculate apparent solar noon */
+	double sol_noon = time_of_solar_noon(t, lon);
+	double t_noon = jcent_from_jd(jdn - 0.5 + sol_noon/1440.0);
+	double angle = rising ? RAD(-90.0 + elev) : RAD(90.0 - elev);
+	double offset = time_of_solar_elevation(t, t_noon, lat, lon, angle);
+
+	/* Not a number when the sun stays above or below elev all day */
+	if( offset != offset ){
+		*time = 0.0;
+		return RET_FUN_FAILED;
+	}
+	*time = epoch_from_jd(jdn - 0.5 + offset/1440.0);
+	return RET_FUN_SUCCESS;
+}
+
 void solar_table_fill(double date, double lat, double lon, double *table)
 {
 	/* Calculate Julian day */
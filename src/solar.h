@@ -54,7 +54,20 @@ typedef enum {
 /**\brief Calculates solar elevation given date, latitude, and longitude */
 double solar_elevation(double date, double lat, double lon);
 
-/**\brief Solar table initialization function, no idea */
-void solar_table_fill(double date, double lat, double lon, double *table);
+/**\brief Calculates when the sun passes an elevation on the day of date
+ * \param elev elevation in degrees
+ * \param rising nonzero for the morning pass, zero for the evening pass
+ * \param time receives the time in seconds since the epoch
+ * \return RET_FUN_FAILED if the sun does not pass elev that day
+ */
+int solar_time_of_elevation(double date, double lat, double lon,
+		double elev, int rising, /*@out@*/ double *time);
+
+/**\brief Fills a table with the times of the day of date, in seconds
+ * since the epoch, indexed by solar_time_t
+ * \details Times the sun does not reach that day are not a number.
+ */
+void solar_table_fill(double date, double lat, double lon,
+		/*@out@*/ double *table);
 
 #endif /* ! _SOLAR_H */
@@ -19,8 +19,40 @@
 
 #include "common.h"
 #include "systemtime.h"
+#ifdef HAVE_SYS_TIMERFD_H
+# include <errno.h>
+# include <sys/timerfd.h>
+# ifndef TFD_TIMER_CANCEL_ON_SET
+#  define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+# endif
+#endif
 
-int systemtime_get_time(double *t){
+/* Offsets from the monotonic clock as of the last check */
+static int offsets_valid = 0;
+static double offset_time = 0.0;
+static double offset_boot = 0.0;
+#ifdef HAVE_SYS_TIMERFD_H
+static int alarm_fd = -1;
+#endif
+
+/**\brief Clock everything time dependent runs on */
+typedef struct{
+	/**\brief real, fixed or scaled */
+	systemtime_clock_t mode;
+	/**\brief seconds of clock time per real second, when scaled */
+	double factor;
+	/**\brief system time the clock starts at, when fixed or scaled */
+	double start;
+	/**\brief seconds of clock time the clock runs for, 0 for no end */
+	double length;
+	/**\brief real monotonic time the clock started at, when scaled */
+	double origin;
+} systemtime_clock_s;
+
+static systemtime_clock_s clock_src = {SYSTEMTIME_CLOCK_REAL,1.0,0.0,0.0,0.0};
+
+// Retrieves the real system time
+static int systemtime_real_time(double *t){
 #ifndef _WIN32
 	struct timespec now;
 	/*@i@*/int r = clock_gettime(CLOCK_REALTIME, &now);
@@ -44,3 +76,231 @@ int systemtime_get_time(double *t){
 
 	return RET_FUN_SUCCESS;
 }
+
+// Retrieves the real monotonic time
+static int systemtime_real_monotonic(double *t){
+#ifndef _WIN32
+	struct timespec now;
+	/*@i@*/int r = clock_gettime(CLOCK_MONOTONIC, &now);
+	if (r < 0) {
+		*t=0.0;
+		perror("clock_gettime");
+		return RET_FUN_FAILED;
+	}
+
+	/*@i@*/*t = now.tv_sec + (now.tv_nsec / 1000000000.0);
+#else /* _WIN32 */
+	LARGE_INTEGER count;
+	LARGE_INTEGER freq;
+	if( !QueryPerformanceCounter(&count)
+			|| !QueryPerformanceFrequency(&freq) ){
+		*t=0.0;
+		return RET_FUN_FAILED;
+	}
+	/*@i@*/*t = (double)count.QuadPart / (double)freq.QuadPart;
+#endif /* _WIN32 */
+
+	return RET_FUN_SUCCESS;
+}
+
+// Retrieves seconds from a clock that keeps counting while suspended,
+// or the monotonic clock where there is none
+static int systemtime_get_boottime(double *t){
+#if !defined(_WIN32) && defined(CLOCK_BOOTTIME)
+	struct timespec now;
+	/*@i@*/if( clock_gettime(CLOCK_BOOTTIME, &now) < 0 )
+		return systemtime_real_monotonic(t);
+	/*@i@*/*t = now.tv_sec + (now.tv_nsec / 1000000000.0);
+	return RET_FUN_SUCCESS;
+#else
+	return systemtime_real_monotonic(t);
+#endif
+}
+
+int systemtime_get_time(double *t){
+	double mono;
+
+	switch( clock_src.mode ){
+	case SYSTEMTIME_CLOCK_FIXED:
+		*t = clock_src.start;
+		return RET_FUN_SUCCESS;
+	case SYSTEMTIME_CLOCK_SCALED:
+		if( !systemtime_real_monotonic(&mono) ){
+			*t = 0.0;
+			return RET_FUN_FAILED;
+		}
+		*t = clock_src.start+(mono-clock_src.origin)*clock_src.factor;
+		return RET_FUN_SUCCESS;
+	default:
+		return systemtime_real_time(t);
+	}
+}
+
+int systemtime_get_monotonic(double *t){
+	double mono;
+
+	if( !systemtime_real_monotonic(&mono) ){
+		*t = 0.0;
+		return RET_FUN_FAILED;
+	}
+	// Transitions speed up along with the system time
+	if( clock_src.mode == SYSTEMTIME_CLOCK_SCALED )
+		mono = clock_src.origin+(mono-clock_src.origin)*clock_src.factor;
+	*t = mono;
+	return RET_FUN_SUCCESS;
+}
+
+int systemtime_get_real_monotonic(double *t){
+	return systemtime_real_monotonic(t);
+}
+
+int systemtime_set_clock(systemtime_clock_t mode, double factor,
+		double start, double length){
+	double now;
+
+	if( (mode<SYSTEMTIME_CLOCK_REAL) || (mode>SYSTEMTIME_CLOCK_SCALED)
+			|| (factor<=0.0) || (length<0.0) ){
+		LOG(LOGERR,_("Invalid clock configuration."));
+		return RET_FUN_FAILED;
+	}
+	if( !systemtime_real_monotonic(&clock_src.origin) )
+		return RET_FUN_FAILED;
+	// A clock without a start time starts at the real time
+	if( (start<=0.0) && systemtime_real_time(&now) )
+		start = now;
+	clock_src.mode = mode;
+	clock_src.factor = (mode==SYSTEMTIME_CLOCK_SCALED) ? factor : 1.0;
+	clock_src.start = start;
+	clock_src.length = length;
+	if( mode != SYSTEMTIME_CLOCK_REAL )
+		LOG(LOGINFO,_("Simulated clock from %.0f, %.0fx real time"),
+				start,clock_src.factor);
+	return RET_FUN_SUCCESS;
+}
+
+int systemtime_parse_clock(char *val){
+	char *factor,*start,*length;
+
+	if( strcmp(val,"real")==0 )
+		return systemtime_set_clock(SYSTEMTIME_CLOCK_REAL,1.0,0.0,0.0);
+	if( strncmp(val,"fixed:",6)==0 )
+		return systemtime_set_clock(SYSTEMTIME_CLOCK_FIXED,1.0,
+				atof(val+6),0.0);
+	if( strncmp(val,"scale:",6)==0 ){
+		factor = val+6;
+		start = strchr(factor,':');
+		length = NULL;
+		if( start ){
+			*(start++) = '\0';
+			length = strchr(start,':');
+			if( length )
+				*(length++) = '\0';
+		}
+		return systemtime_set_clock(SYSTEMTIME_CLOCK_SCALED,atof(factor),
+				start ? atof(start) : 0.0,length ? atof(length) : 0.0);
+	}
+	LOG(LOGERR,_("Malformed clock argument: %s.\n"),val);
+	return RET_FUN_FAILED;
+}
+
+int systemtime_scale_wait(int msec){
+	if( (msec<=0) || (clock_src.mode != SYSTEMTIME_CLOCK_SCALED) )
+		return msec;
+	return (int)ceil(msec/clock_src.factor);
+}
+
+int systemtime_expired(void){
+	double now;
+
+	if( (clock_src.mode != SYSTEMTIME_CLOCK_SCALED)
+			|| (clock_src.length<=0.0) || !systemtime_get_time(&now) )
+		return 0;
+	return now >= clock_src.start+clock_src.length;
+}
+
+int systemtime_get_alarm_fd(void){
+#ifdef HAVE_SYS_TIMERFD_H
+	// Only the real clock can be waited on
+	if( clock_src.mode != SYSTEMTIME_CLOCK_REAL )
+		return -1;
+	if( alarm_fd < 0 ){
+		alarm_fd = timerfd_create(CLOCK_REALTIME,TFD_NONBLOCK|TFD_CLOEXEC);
+		if( alarm_fd < 0 )
+			LOG(LOGWARN,_("Unable to create clock alarm, clock jumps are "
+					"noticed late"));
+	}
+	return alarm_fd;
+#else
+	return -1;
+#endif
+}
+
+int systemtime_set_alarm(double when){
+#ifdef HAVE_SYS_TIMERFD_H
+	struct itimerspec spec;
+
+	if( systemtime_get_alarm_fd() < 0 )
+		return RET_FUN_FAILED;
+	memset(&spec,0,sizeof(spec));
+	/*@i@*/spec.it_value.tv_sec = (time_t)floor(when);
+	/*@i@*/spec.it_value.tv_nsec = (long)((when-floor(when))*1000000000.0);
+	if( timerfd_settime(alarm_fd,TFD_TIMER_ABSTIME|TFD_TIMER_CANCEL_ON_SET,
+			&spec,NULL) < 0 ){
+		LOG(LOGWARN,_("Unable to set clock alarm"));
+		return RET_FUN_FAILED;
+	}
+	return RET_FUN_SUCCESS;
+#else
+	return RET_FUN_FAILED;
+#endif
+}
+
+int systemtime_clock_changed(void){
+	double now,mono,boot;
+	int cancelled = 0;
+	int changed = 0;
+
+	// Simulated clocks never jump
+	if( clock_src.mode != SYSTEMTIME_CLOCK_REAL )
+		return 0;
+#ifdef HAVE_SYS_TIMERFD_H
+	if( alarm_fd >= 0 ){
+		uint64_t expirations;
+		// A cancelled alarm reads as ECANCELED, one that went off as a count
+		if( (read(alarm_fd,&expirations,sizeof(expirations)) < 0)
+				&& (errno == ECANCELED) )
+			cancelled = 1;
+	}
+#endif
+	if( !systemtime_real_time(&now) || !systemtime_real_monotonic(&mono)
+			|| !systemtime_get_boottime(&boot) )
+		return cancelled;
+	if( offsets_valid ){
+		double slept = (boot-mono)-offset_boot;
+		double jumped = (now-mono)-offset_time;
+		if( slept > SYSTEMTIME_JUMP ){
+			LOG(LOGINFO,_("Resumed after %.0fs suspended"),slept);
+			changed = 1;
+		}else if( fabs(jumped) > SYSTEMTIME_JUMP ){
+			LOG(LOGINFO,_("System time jumped by %.0fs"),jumped);
+			changed = 1;
+		}
+	}
+	if( cancelled && !changed ){
+		LOG(LOGINFO,_("System time was set"));
+		changed = 1;
+	}
+	offsets_valid = 1;
+	offset_time = now-mono;
+	offset_boot = boot-mono;
+	return changed;
+}
+
+void systemtime_free(void){
+#ifdef HAVE_SYS_TIMERFD_H
+	if( alarm_fd >= 0 )
+		(void)close(alarm_fd);
+	alarm_fd = -1;
+#endif
+	offsets_valid = 0;
+}
@@ -2,12 +2,82 @@
  * \author		Mao Yu,Jon Lund Steffensen
  * \date		Modified: Saturday, July 10, 2010
  * \brief		Gets system time in a platform independent way
+ * \details Everything time dependent reads the time from here, so the clock
+ * can be replaced by one that stands still or runs faster than real time,
+ * e.g. to replay a day of scheduling in seconds.
  */
 
 #ifndef _REDSHIFT_SYSTEMTIME_H
 #define _REDSHIFT_SYSTEMTIME_H
 
+/**\brief Clock sources */
+typedef enum{
+	SYSTEMTIME_CLOCK_REAL,
+	SYSTEMTIME_CLOCK_FIXED,
+	SYSTEMTIME_CLOCK_SCALED
+} systemtime_clock_t;
+
 /**\brief Retrieves system time for solar elevation calculation */
 int systemtime_get_time(/*@out@*/ double *now);
 
+/**\brief Retrieves seconds from a monotonic clock, for measuring intervals
+ * \details Runs as fast as a scaled clock, so transitions speed up too.
+ */
+int systemtime_get_monotonic(/*@out@*/ double *now);
+
+/**\brief Retrieves seconds from a monotonic clock at real speed, for timing
+ * how long work takes
+ * \details Unlike systemtime_get_monotonic() it is never scaled.
+ */
+int systemtime_get_real_monotonic(/*@out@*/ double *now);
+
+/**\brief Selects the clock
+ * \param factor seconds of clock time per real second, when scaled
+ * \param start system time the clock starts at, 0 for the real time now
+ * \param length seconds of clock time a scaled clock runs for before
+ * systemtime_expired(), 0 for no end
+ */
+int systemtime_set_clock(systemtime_clock_t mode, double factor,
+		double start, double length);
+
+/**\brief Parses clock configuration
+ * \param val string in the format real, fixed:TIME or
+ * scale:FACTOR[:TIME[:LENGTH]], with times in seconds since the epoch
+ */
+int systemtime_parse_clock(char *val);
+
+/**\brief Converts a wait in clock milliseconds to real milliseconds */
+int systemtime_scale_wait(int msec);
+
+/**\brief Checks whether a scaled clock has run for its length */
+int systemtime_expired(void);
+
+/**\brief Seconds the system time may move against the monotonic clock
+ * between checks before it counts as a jump */
+#define SYSTEMTIME_JUMP	2.0
+
+/**\brief Retrieves descriptor that becomes readable when the system time
+ * reaches the alarm, or when it jumps
+ * \details Uses a timerfd that is cancelled whenever the clock is set,
+ * which includes resuming from suspend. Once readable, call
+ * systemtime_clock_changed() to clear it.
+ * \return descriptor, or -1 where not supported or the clock is simulated
+ */
+int systemtime_get_alarm_fd(void);
+
+/**\brief Arms the alarm for a system time, in seconds since the epoch */
+int systemtime_set_alarm(double when);
+
+/**\brief Checks whether the system time jumped or the system was suspended
+ * since the last check
+ * \details Besides the alarm descriptor, the offsets of the system time and
+ * of the boot time from the monotonic clock are compared against the last
+ * check, which also catches jumps where there is no descriptor. The first
+ * call only records the offsets.
+ */
+int systemtime_clock_changed(void);
+
+/**\brief Frees the alarm */
+void systemtime_free(void);
+
 #endif /* ! _REDSHIFT_SYSTEMTIME_H */
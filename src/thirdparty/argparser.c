@@ -42,7 +42,7 @@ static ArgItem *validitems = NULL;		// Valid arguments
 static ArgItem *unknown = NULL;			// Unknown arguments
 static ArgItem *unnamed = NULL;			// Additional unnamed arguments
 static ArgBool parsed = ARGBOOL_FALSE;	// Whether parsed or not
-static const unsigned int MAX_LONG_LEN = 10;	// Maximum length of long names
+static const unsigned int MAX_LONG_LEN = 16;	// Maximum length of long names
 static const unsigned int MAX_HELP_LEN = 2048;	// Maximum length of help strings
 
 // Internal function to validate inputs
@@ -250,9 +250,9 @@ void _args_DEBUGprintfound(void)
 			else
 				printf(_("   %-2s"),"");
 			if( curr->longname )
-				printf(_(" --%-12s"),curr->longname);
+				printf(_(" --%-16s"),curr->longname);
 			else
-				printf(_("   %-12s"),"");
+				printf(_("   %-16s"),"");
 			printf(_(" %s\n"),curr->value);
 		}
 		curr = curr->next;
@@ -499,9 +499,9 @@ void args_print(void)
 		else
 			printf(_("   %-2s"),"");
 		if( curr->longname )
-			printf(_(" --%-12s"),curr->longname);
+			printf(_(" --%-16s"),curr->longname);
 		else
-			printf(_("   %-12s"),"");
+			printf(_("   %-16s"),"");
 		printf(_(" %s\n"),curr->helpstring);
 		curr = curr->next;
 	}
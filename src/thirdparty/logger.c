@@ -119,7 +119,8 @@ LogReturn log_log(int level,
 		return LOGRET_OK;
 	else{
 		va_list args;
-		static LogChar buffer[BUFSIZE];
+		/* On the stack so threads can log at the same time */
+		LogChar buffer[BUFSIZE];
 		int charwritten=0;
 		int temp;
 		int bufsizeleft=BUFSIZE-1;
@@ -0,0 +1,158 @@
+#include "common.h"
+#include "gamma.h"
+#include "options.h"
+#include "systemtime.h"
+#include "transition.h"
+
+/* Weight of the newest sample in the smoothed update latency */
+#define TRANSITION_LATENCY_WEIGHT	0.25
+
+// Temperature at a step of the current leg, even steps in mired
+static double transition_position(const transition_s *tr, int step)
+{
+	double from_mired,to_mired;
+
+	if( step>=tr->steps )
+		return (double)tr->target;
+	from_mired = 1e6/tr->from;
+	to_mired = 1e6/(double)tr->target;
+	return 1e6/(from_mired+(to_mired-from_mired)*step/tr->steps);
+}
+
+// Step of the current leg the clock has reached
+static int transition_step_at(const transition_s *tr, double now)
+{
+	int step;
+
+	if( tr->duration<=0.0 )
+		return tr->steps;
+	step = (int)floor((now-tr->start)/tr->interval);
+	return step>tr->steps ? tr->steps : step;
+}
+
+// Plans the fewest steps that keep each below the JND, no closer together
+// than the display refresh
+static void transition_plan(transition_s *tr)
+{
+	double mired = fabs(1e6/tr->from-1e6/(double)tr->target);
+	int max_steps;
+
+	tr->duration = tr->speed>0 ? fabs((double)tr->target-tr->from)/tr->speed : 0.0;
+	tr->steps = (int)ceil(mired/TRANSITION_JND_MIRED);
+	max_steps = (int)floor(tr->duration*TRANSITION_REFRESH_HZ);
+	if( tr->steps>max_steps )
+		tr->steps = max_steps;
+	if( tr->steps<1 )
+		tr->steps = 1;
+	tr->interval = tr->duration/tr->steps;
+	tr->step = 0;
+	tr->next = tr->start+tr->interval;
+}
+
+void transition_init(transition_s *tr, int temp)
+{
+	tr->active = 0;
+	tr->from = (double)temp;
+	tr->start = 0.0;
+	tr->target = temp;
+	tr->speed = 0;
+	tr->current = temp;
+	tr->duration = 0.0;
+	tr->steps = 1;
+	tr->step = 1;
+	tr->next = 0.0;
+	tr->interval = 0.0;
+	tr->latency = 0.0;
+	tr->frames = 0;
+	tr->dropped = 0;
+}
+
+void transition_retarget(transition_s *tr, int target, int speed)
+{
+	double now;
+
+	(void)systemtime_get_monotonic(&now);
+	/* A running leg is left at the step it last applied */
+	tr->from = (double)tr->current;
+	tr->start = now;
+	tr->target = target;
+	tr->speed = speed;
+	if( !tr->active ){
+		tr->frames = 0;
+		tr->dropped = 0;
+	}
+	tr->active = (target!=tr->current);
+	if( !tr->active )
+		return;
+	transition_plan(tr);
+	LOG(LOGVERBOSE,_("Transition to %dK at %d K/s: %d steps over %.2fs"),
+			target,speed,tr->steps,tr->duration);
+}
+
+int transition_update(transition_s *tr)
+{
+	double now,done;
+	int step,temp,ret;
+
+	if( !tr->active )
+		return RET_FUN_SUCCESS;
+	(void)systemtime_get_monotonic(&now);
+	step = transition_step_at(tr,now);
+	if( step<=tr->step )
+		return RET_FUN_SUCCESS;
+
+	/* Steps missed while the last update ran are not caught up on,
+	   the clock says where the transition is now */
+	tr->dropped += (unsigned long)(step-tr->step-1);
+	tr->step = step;
+	temp = (int)floor(transition_position(tr,step)+0.5);
+	if( step==tr->steps )
+		tr->active = 0;
+
+	LOG(LOGVERBOSE,_("Transition color: %dK"),temp);
+	ret = gamma_state_set_temperature(temp,opt_get_gamma());
+	(void)systemtime_get_monotonic(&done);
+	if( tr->frames )
+		tr->latency += TRANSITION_LATENCY_WEIGHT*((done-now)-tr->latency);
+	else
+		tr->latency = done-now;
+	++tr->frames;
+	tr->current = temp;
+	if( !ret ){
+		LOG(LOGERR,_("Temperature adjustment failed (Target %d)."),temp);
+		tr->active = 0;
+		return RET_FUN_FAILED;
+	}
+
+	/* Steps falling due while updates run are skipped, so slow updates
+	   lower the frame rate rather than pile up */
+	tr->next = tr->start+(tr->step+1)*tr->interval;
+	if( tr->next<done+tr->latency )
+		tr->next = done+tr->latency;
+	if( !tr->active )
+		LOG(LOGVERBOSE,_("Target color reached: %dK (%lu frames, %lu "
+				"dropped, %.3f ms per update)"),tr->target,tr->frames,
+				tr->dropped,tr->latency*1000.0);
+	return RET_FUN_SUCCESS;
+}
+
+int transition_wait(const transition_s *tr)
+{
+	double now;
+
+	if( !tr->active )
+		return -1;
+	(void)systemtime_get_monotonic(&now);
+	if( tr->next<=now )
+		return 0;
+	return (int)ceil((tr->next-now)*1000.0);
+}
+
+int transition_get_temp(const transition_s *tr)
+{return tr->current;}
+
+int transition_get_target(const transition_s *tr)
+{return tr->target;}
+
+int transition_is_active(const transition_s *tr)
+{return tr->active;}
@@ -0,0 +1,83 @@
+/**\file		transition.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Time based temperature transitions
+ * \details A transition takes as long as its distance in Kelvin at the
+ * configured speed, following the monotonic clock, so slow updates only
+ * lower the frame rate. Within that time the temperature moves evenly in
+ * mired (1e6/K), where equal steps look equally large, using as few steps
+ * as keep each below TRANSITION_JND_MIRED. Frames that come due while an
+ * update runs are dropped rather than queued.
+ */
+
+#ifndef _REDSHIFT_TRANSITION_H
+#define _REDSHIFT_TRANSITION_H
+
+/**\brief Refresh rate frames are never spaced closer than */
+#define TRANSITION_REFRESH_HZ	60
+
+/**\brief Largest step in mired, kept well below the ~5 mired at which
+ * neighbouring color temperatures can be told apart */
+#define TRANSITION_JND_MIRED	2.0
+
+/**\brief Transition state */
+typedef struct{
+	/**\brief set while the target has not been reached */
+	int active;
+	/**\brief temperature the current leg started from */
+	double from;
+	/**\brief monotonic time the current leg started */
+	double start;
+	/**\brief target temperature */
+	int target;
+	/**\brief speed in K/s, 0 or less to jump straight to the target */
+	int speed;
+	/**\brief last temperature applied */
+	int current;
+	/**\brief seconds the current leg takes */
+	double duration;
+	/**\brief number of steps of the current leg */
+	int steps;
+	/**\brief last step applied */
+	int step;
+	/**\brief monotonic time the next frame is due */
+	double next;
+	/**\brief seconds between frames */
+	double interval;
+	/**\brief smoothed seconds an update takes to apply */
+	double latency;
+	/**\brief frames applied */
+	unsigned long frames;
+	/**\brief frames dropped because updates ran late */
+	unsigned long dropped;
+} transition_s;
+
+/**\brief Initializes an idle transition at the temperature applied now */
+void transition_init(/*@out@*/ transition_s *tr, int temp);
+
+/**\brief Starts moving toward a target
+ * \details An active transition continues from where it is now, so a new
+ * target never makes the temperature jump.
+ */
+void transition_retarget(transition_s *tr, int target, int speed);
+
+/**\brief Applies the temperature the transition has reached, if a frame
+ * is due
+ * \return RET_FUN_FAILED if the update failed, which ends the transition
+ */
+int transition_update(transition_s *tr);
+
+/**\brief Retrieves milliseconds until the next frame is due, -1 once the
+ * target is reached */
+int transition_wait(const transition_s *tr);
+
+/**\brief Retrieves the last temperature applied */
+int transition_get_temp(const transition_s *tr);
+
+/**\brief Retrieves the temperature being moved toward */
+int transition_get_target(const transition_s *tr);
+
+/**\brief Checks whether the target has not been reached yet */
+int transition_is_active(const transition_s *tr);
+
+#endif /* ! _REDSHIFT_TRANSITION_H */
@@ -0,0 +1,208 @@
+/**\file		randr.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Stand-in for the XCB RANDR header, for the tests.
+ * \details Variable length reply data follows the reply structure in the
+ * same allocation, as with XCB.
+ */
+
+#ifndef __MOCK_XCB_RANDR_H__
+#define __MOCK_XCB_RANDR_H__
+
+#include <xcb/xcb.h>
+
+typedef uint32_t xcb_randr_crtc_t;
+typedef uint32_t xcb_randr_output_t;
+typedef uint32_t xcb_randr_mode_t;
+
+extern xcb_extension_t xcb_randr_id;
+
+/**\brief Notification masks */
+typedef enum{
+	XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE = 1,
+	XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE = 2,
+	XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE = 4,
+	XCB_RANDR_NOTIFY_MASK_OUTPUT_PROPERTY = 8
+} xcb_randr_notify_mask_t;
+
+/**\brief Event codes, relative to the first event of the extension */
+#define XCB_RANDR_SCREEN_CHANGE_NOTIFY	0
+#define XCB_RANDR_NOTIFY				1
+
+/**\brief Notification kinds */
+typedef enum{
+	XCB_RANDR_NOTIFY_CRTC_CHANGE = 0,
+	XCB_RANDR_NOTIFY_OUTPUT_CHANGE = 1,
+	XCB_RANDR_NOTIFY_OUTPUT_PROPERTY = 2
+} xcb_randr_notify_t;
+
+/**\brief CRTC change */
+typedef struct{
+	xcb_timestamp_t timestamp;
+	xcb_window_t window;
+	xcb_randr_crtc_t crtc;
+	xcb_randr_mode_t mode;
+} xcb_randr_crtc_change_t;
+
+/**\brief Notification data */
+typedef union{
+	xcb_randr_crtc_change_t cc;
+} xcb_randr_notify_data_t;
+
+/**\brief Notification */
+typedef struct{
+	uint8_t response_type;
+	uint8_t subCode;
+	uint16_t sequence;
+	xcb_randr_notify_data_t u;
+} xcb_randr_notify_event_t;
+
+typedef struct{
+	unsigned int sequence;
+} xcb_randr_query_version_cookie_t;
+
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t length;
+	uint32_t major_version;
+	uint32_t minor_version;
+} xcb_randr_query_version_reply_t;
+
+typedef struct{
+	unsigned int sequence;
+} xcb_randr_get_screen_resources_current_cookie_t;
+
+/**\brief Followed by num_crtcs CRTCs */
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t length;
+	xcb_timestamp_t timestamp;
+	xcb_timestamp_t config_timestamp;
+	uint16_t num_crtcs;
+	uint16_t num_outputs;
+} xcb_randr_get_screen_resources_current_reply_t;
+
+typedef struct{
+	unsigned int sequence;
+} xcb_randr_get_crtc_info_cookie_t;
+
+/**\brief Followed by num_outputs outputs */
+typedef struct{
+	uint8_t response_type;
+	uint8_t status;
+	uint16_t sequence;
+	uint32_t length;
+	xcb_timestamp_t timestamp;
+	xcb_randr_mode_t mode;
+	uint16_t num_outputs;
+	uint16_t num_possible_outputs;
+} xcb_randr_get_crtc_info_reply_t;
+
+typedef struct{
+	unsigned int sequence;
+} xcb_randr_get_crtc_gamma_size_cookie_t;
+
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t length;
+	uint16_t size;
+} xcb_randr_get_crtc_gamma_size_reply_t;
+
+typedef struct{
+	unsigned int sequence;
+} xcb_randr_get_crtc_gamma_cookie_t;
+
+/**\brief Followed by the red, green and blue ramps */
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t length;
+	uint16_t size;
+} xcb_randr_get_crtc_gamma_reply_t;
+
+typedef struct{
+	unsigned int sequence;
+} xcb_randr_query_output_property_cookie_t;
+
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t length;
+	uint8_t pending;
+	uint8_t range;
+	uint8_t immutable;
+} xcb_randr_query_output_property_reply_t;
+
+xcb_randr_query_version_cookie_t xcb_randr_query_version(xcb_connection_t *c,
+		uint32_t major_version, uint32_t minor_version);
+xcb_randr_query_version_reply_t *xcb_randr_query_version_reply(
+		xcb_connection_t *c, xcb_randr_query_version_cookie_t cookie,
+		xcb_generic_error_t **e);
+xcb_void_cookie_t xcb_randr_select_input(xcb_connection_t *c,
+		xcb_window_t window, uint16_t enable);
+
+xcb_randr_get_screen_resources_current_cookie_t
+xcb_randr_get_screen_resources_current(xcb_connection_t *c,
+		xcb_window_t window);
+xcb_randr_get_screen_resources_current_reply_t *
+xcb_randr_get_screen_resources_current_reply(xcb_connection_t *c,
+		xcb_randr_get_screen_resources_current_cookie_t cookie,
+		xcb_generic_error_t **e);
+xcb_randr_crtc_t *xcb_randr_get_screen_resources_current_crtcs(
+		const xcb_randr_get_screen_resources_current_reply_t *R);
+
+xcb_randr_get_crtc_info_cookie_t xcb_randr_get_crtc_info(xcb_connection_t *c,
+		xcb_randr_crtc_t crtc, xcb_timestamp_t config_timestamp);
+xcb_randr_get_crtc_info_reply_t *xcb_randr_get_crtc_info_reply(
+		xcb_connection_t *c, xcb_randr_get_crtc_info_cookie_t cookie,
+		xcb_generic_error_t **e);
+xcb_randr_output_t *xcb_randr_get_crtc_info_outputs(
+		const xcb_randr_get_crtc_info_reply_t *R);
+int xcb_randr_get_crtc_info_outputs_length(
+		const xcb_randr_get_crtc_info_reply_t *R);
+
+xcb_randr_get_crtc_gamma_size_cookie_t xcb_randr_get_crtc_gamma_size(
+		xcb_connection_t *c, xcb_randr_crtc_t crtc);
+xcb_randr_get_crtc_gamma_size_reply_t *xcb_randr_get_crtc_gamma_size_reply(
+		xcb_connection_t *c, xcb_randr_get_crtc_gamma_size_cookie_t cookie,
+		xcb_generic_error_t **e);
+
+xcb_randr_get_crtc_gamma_cookie_t xcb_randr_get_crtc_gamma(
+		xcb_connection_t *c, xcb_randr_crtc_t crtc);
+xcb_randr_get_crtc_gamma_reply_t *xcb_randr_get_crtc_gamma_reply(
+		xcb_connection_t *c, xcb_randr_get_crtc_gamma_cookie_t cookie,
+		xcb_generic_error_t **e);
+uint16_t *xcb_randr_get_crtc_gamma_red(
+		const xcb_randr_get_crtc_gamma_reply_t *R);
+int xcb_randr_get_crtc_gamma_red_length(
+		const xcb_randr_get_crtc_gamma_reply_t *R);
+uint16_t *xcb_randr_get_crtc_gamma_green(
+		const xcb_randr_get_crtc_gamma_reply_t *R);
+uint16_t *xcb_randr_get_crtc_gamma_blue(
+		const xcb_randr_get_crtc_gamma_reply_t *R);
+int xcb_randr_get_crtc_gamma_blue_length(
+		const xcb_randr_get_crtc_gamma_reply_t *R);
+xcb_void_cookie_t xcb_randr_set_crtc_gamma_checked(xcb_connection_t *c,
+		xcb_randr_crtc_t crtc, uint16_t size, const uint16_t *red,
+		const uint16_t *green, const uint16_t *blue);
+
+xcb_randr_query_output_property_cookie_t xcb_randr_query_output_property(
+		xcb_connection_t *c, xcb_randr_output_t output, xcb_atom_t property);
+xcb_randr_query_output_property_reply_t *
+xcb_randr_query_output_property_reply(xcb_connection_t *c,
+		xcb_randr_query_output_property_cookie_t cookie,
+		xcb_generic_error_t **e);
+xcb_void_cookie_t xcb_randr_change_output_property_checked(
+		xcb_connection_t *c, xcb_randr_output_t output, xcb_atom_t property,
+		xcb_atom_t type, uint8_t format, uint8_t mode, uint32_t num_units,
+		const void *data);
+
+#endif//__MOCK_XCB_RANDR_H__
@@ -0,0 +1,121 @@
+/**\file		xcb.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Stand-in for the XCB core header, for the tests.
+ * \details Declares only what the backends use, with the fields they read.
+ * The functions are implemented against a simulated server in mock_xcb.c.
+ */
+
+#ifndef __MOCK_XCB_H__
+#define __MOCK_XCB_H__
+
+#include <stdint.h>
+
+#define XCB_NONE			0L
+#define XCB_ATOM_INTEGER	19
+
+typedef uint32_t xcb_window_t;
+typedef uint32_t xcb_atom_t;
+typedef uint32_t xcb_timestamp_t;
+
+/**\brief Property modes */
+typedef enum{
+	XCB_PROP_MODE_REPLACE = 0,
+	XCB_PROP_MODE_PREPEND = 1,
+	XCB_PROP_MODE_APPEND = 2
+} xcb_prop_mode_t;
+
+/**\brief Connection, opaque */
+typedef struct xcb_connection_t xcb_connection_t;
+
+/**\brief Extension, opaque */
+typedef struct xcb_extension_t xcb_extension_t;
+
+/**\brief Cookie of a request without reply */
+typedef struct{
+	unsigned int sequence;
+} xcb_void_cookie_t;
+
+/**\brief Error */
+typedef struct{
+	uint8_t response_type;
+	uint8_t error_code;
+	uint16_t sequence;
+	uint32_t resource_id;
+	uint16_t minor_code;
+	uint8_t major_code;
+	uint8_t pad0;
+	uint32_t pad[5];
+	uint32_t full_sequence;
+} xcb_generic_error_t;
+
+/**\brief Event */
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t pad[7];
+	uint32_t full_sequence;
+} xcb_generic_event_t;
+
+/**\brief Screen */
+typedef struct{
+	xcb_window_t root;
+} xcb_screen_t;
+
+/**\brief Screen iterator */
+typedef struct{
+	xcb_screen_t *data;
+	int rem;
+	int index;
+} xcb_screen_iterator_t;
+
+/**\brief Setup, opaque */
+typedef struct xcb_setup_t xcb_setup_t;
+
+/**\brief Extension information */
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t length;
+	uint8_t present;
+	uint8_t major_opcode;
+	uint8_t first_event;
+	uint8_t first_error;
+} xcb_query_extension_reply_t;
+
+/**\brief Cookie of InternAtom */
+typedef struct{
+	unsigned int sequence;
+} xcb_intern_atom_cookie_t;
+
+/**\brief Reply of InternAtom */
+typedef struct{
+	uint8_t response_type;
+	uint8_t pad0;
+	uint16_t sequence;
+	uint32_t length;
+	xcb_atom_t atom;
+} xcb_intern_atom_reply_t;
+
+xcb_connection_t *xcb_connect(const char *displayname, int *screenp);
+void xcb_disconnect(xcb_connection_t *c);
+int xcb_connection_has_error(xcb_connection_t *c);
+int xcb_flush(xcb_connection_t *c);
+int xcb_get_file_descriptor(xcb_connection_t *c);
+const xcb_setup_t *xcb_get_setup(xcb_connection_t *c);
+xcb_screen_iterator_t xcb_setup_roots_iterator(const xcb_setup_t *R);
+void xcb_screen_next(xcb_screen_iterator_t *i);
+const xcb_query_extension_reply_t *xcb_get_extension_data(
+		xcb_connection_t *c, xcb_extension_t *ext);
+xcb_generic_event_t *xcb_poll_for_event(xcb_connection_t *c);
+xcb_generic_error_t *xcb_request_check(xcb_connection_t *c,
+		xcb_void_cookie_t cookie);
+void xcb_discard_reply(xcb_connection_t *c, unsigned int sequence);
+xcb_intern_atom_cookie_t xcb_intern_atom(xcb_connection_t *c,
+		uint8_t only_if_exists, uint16_t name_len, const char *name);
+xcb_intern_atom_reply_t *xcb_intern_atom_reply(xcb_connection_t *c,
+		xcb_intern_atom_cookie_t cookie, xcb_generic_error_t **e);
+
+#endif//__MOCK_XCB_H__
@@ -0,0 +1,488 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+#include "mock_xcb.h"
+
+/* X error codes */
+#define MOCK_BAD_VALUE	2
+#define MOCK_BAD_MATCH	8
+#define MOCK_BAD_NAME	15
+
+/**\brief Answer to a request, kept until collected */
+typedef struct{
+	/**\brief reply, NULL for requests without one */
+	void *reply;
+	/**\brief error, NULL on success */
+	xcb_generic_error_t *error;
+} mock_answer_s;
+
+struct xcb_connection_t{
+	int connected;
+};
+
+struct xcb_setup_t{
+	int roots;
+};
+
+struct xcb_extension_t{
+	const char *name;
+	int global_id;
+};
+
+xcb_extension_t xcb_randr_id = {"RANDR",0};
+mock_xcb_s mock_xcb;
+
+static xcb_connection_t conn = {0};
+static xcb_setup_t setup = {1};
+static xcb_screen_t screen = {1};
+static xcb_query_extension_reply_t randr_ext = {1,0,0,0,1,140,89,147};
+/* Answers by sequence number, entry 0 is unused */
+static mock_answer_s *answers = NULL;
+static unsigned int answers_size = 0;
+/* Last request made and last one answered */
+static unsigned int seq = 0;
+static unsigned int answered = 0;
+
+// Queues the answer to a new request, returns its sequence number
+static unsigned int _request(void *reply, xcb_generic_error_t *error){
+	++seq;
+	++mock_xcb.requests;
+	if( seq >= answers_size ){
+		answers_size = 2*seq+16;
+		answers = realloc(answers,answers_size*sizeof(mock_answer_s));
+		if( answers==NULL )
+			abort();
+	}
+	answers[seq].reply = reply;
+	answers[seq].error = error;
+	return seq;
+}
+
+// Makes an error reply
+static xcb_generic_error_t *_error(uint8_t code){
+	xcb_generic_error_t *error = calloc(1,sizeof(xcb_generic_error_t));
+	if( error==NULL )
+		abort();
+	error->error_code = code;
+	return error;
+}
+
+// Makes a reply with room for extra data after it
+static void *_reply(size_t size, size_t extra){
+	void *reply = calloc(1,size+extra);
+	if( reply==NULL )
+		abort();
+	return reply;
+}
+
+// Waits for the answer to a request, which answers all sent so far
+static void _wait(unsigned int sequence){
+	if( sequence<=answered )
+		return;
+	++mock_xcb.round_trips;
+	if( mock_xcb.latency_us )
+		(void)usleep(mock_xcb.latency_us);
+	answered = seq;
+}
+
+// Takes the answer to a request, waiting for it first
+static void *_take(unsigned int sequence, xcb_generic_error_t **e){
+	void *reply;
+
+	_wait(sequence);
+	reply = answers[sequence].reply;
+	if( e )
+		*e = answers[sequence].error;
+	else
+		free(answers[sequence].error);
+	answers[sequence].reply = NULL;
+	answers[sequence].error = NULL;
+	return reply;
+}
+
+// Finds a CRTC by id
+static mock_xcb_crtc_s *_crtc(xcb_randr_crtc_t crtc){
+	int i = (int)crtc-MOCK_XCB_CRTC_ID(0);
+	if( (i<0) || (i>=mock_xcb.crtc_count) )
+		return NULL;
+	return &mock_xcb.crtcs[i];
+}
+
+// Finds an output by id
+static mock_xcb_output_s *_output(xcb_randr_output_t output){
+	int i = (int)output-MOCK_XCB_OUTPUT_ID(0,0);
+	if( (i<0) || (i>=mock_xcb.crtc_count*MOCK_XCB_OUTPUTS) )
+		return NULL;
+	return &mock_xcb.crtcs[i/MOCK_XCB_OUTPUTS].outputs[i%MOCK_XCB_OUTPUTS];
+}
+
+void mock_xcb_reset(int crtc_count, int ramp_size){
+	unsigned int s;
+	int i,k,c;
+
+	for( s=1; (answers!=NULL) && (s<=seq); ++s ){
+		free(answers[s].reply);
+		free(answers[s].error);
+	}
+	seq = answered = 0;
+	memset(&mock_xcb,0,sizeof(mock_xcb));
+	mock_xcb.crtc_count = crtc_count;
+	mock_xcb.ctm_atom = 1;
+	for( i=0; i<crtc_count; ++i ){
+		mock_xcb_crtc_s *crtc = &mock_xcb.crtcs[i];
+		crtc->enabled = 1;
+		crtc->ramp_size = ramp_size;
+		for( c=0; c<3; ++c )
+			for( k=0; k<ramp_size; ++k )
+				crtc->ramp[c*ramp_size+k] =
+					(uint16_t)(k*65535/(ramp_size>1 ? ramp_size-1 : 1));
+		for( k=0; k<MOCK_XCB_OUTPUTS; ++k )
+			crtc->outputs[k].ctm = 1;
+	}
+}
+
+xcb_connection_t *xcb_connect(const char *displayname, int *screenp){
+	(void)displayname;
+	conn.connected = 1;
+	if( screenp )
+		*screenp = 0;
+	return &conn;
+}
+
+void xcb_disconnect(xcb_connection_t *c){
+	c->connected = 0;
+}
+
+int xcb_connection_has_error(xcb_connection_t *c){
+	return !c->connected;
+}
+
+int xcb_flush(xcb_connection_t *c){
+	(void)c;
+	return 1;
+}
+
+int xcb_get_file_descriptor(xcb_connection_t *c){
+	(void)c;
+	return -1;
+}
+
+const xcb_setup_t *xcb_get_setup(xcb_connection_t *c){
+	(void)c;
+	return &setup;
+}
+
+xcb_screen_iterator_t xcb_setup_roots_iterator(const xcb_setup_t *R){
+	xcb_screen_iterator_t iter;
+	iter.data = &screen;
+	iter.rem = R->roots;
+	iter.index = 0;
+	return iter;
+}
+
+void xcb_screen_next(xcb_screen_iterator_t *i){
+	--i->rem;
+	++i->index;
+}
+
+const xcb_query_extension_reply_t *xcb_get_extension_data(
+		xcb_connection_t *c, xcb_extension_t *ext){
+	(void)c;
+	(void)ext;
+	return &randr_ext;
+}
+
+xcb_generic_event_t *xcb_poll_for_event(xcb_connection_t *c){
+	(void)c;
+	return NULL;
+}
+
+xcb_generic_error_t *xcb_request_check(xcb_connection_t *c,
+		xcb_void_cookie_t cookie){
+	xcb_generic_error_t *error;
+	(void)c;
+	free(_take(cookie.sequence,&error));
+	return error;
+}
+
+void xcb_discard_reply(xcb_connection_t *c, unsigned int sequence){
+	(void)c;
+	free(answers[sequence].reply);
+	free(answers[sequence].error);
+	answers[sequence].reply = NULL;
+	answers[sequence].error = NULL;
+}
+
+xcb_intern_atom_cookie_t xcb_intern_atom(xcb_connection_t *c,
+		uint8_t only_if_exists, uint16_t name_len, const char *name){
+	xcb_intern_atom_cookie_t cookie;
+	xcb_intern_atom_reply_t *reply = _reply(sizeof(*reply),0);
+	(void)c;
+	(void)only_if_exists;
+	if( mock_xcb.ctm_atom && (name_len==3) && (memcmp(name,"CTM",3)==0) )
+		reply->atom = MOCK_XCB_CTM_ATOM;
+	else
+		reply->atom = XCB_NONE;
+	cookie.sequence = _request(reply,NULL);
+	return cookie;
+}
+
+xcb_intern_atom_reply_t *xcb_intern_atom_reply(xcb_connection_t *c,
+		xcb_intern_atom_cookie_t cookie, xcb_generic_error_t **e){
+	(void)c;
+	return _take(cookie.sequence,e);
+}
+
+xcb_randr_query_version_cookie_t xcb_randr_query_version(xcb_connection_t *c,
+		uint32_t major_version, uint32_t minor_version){
+	xcb_randr_query_version_cookie_t cookie;
+	xcb_randr_query_version_reply_t *reply = _reply(sizeof(*reply),0);
+	(void)c;
+	(void)major_version;
+	(void)minor_version;
+	reply->major_version = 1;
+	reply->minor_version = 6;
+	cookie.sequence = _request(reply,NULL);
+	return cookie;
+}
+
+xcb_randr_query_version_reply_t *xcb_randr_query_version_reply(
+		xcb_connection_t *c, xcb_randr_query_version_cookie_t cookie,
+		xcb_generic_error_t **e){
+	(void)c;
+	return _take(cookie.sequence,e);
+}
+
+xcb_void_cookie_t xcb_randr_select_input(xcb_connection_t *c,
+		xcb_window_t window, uint16_t enable){
+	xcb_void_cookie_t cookie;
+	(void)c;
+	(void)window;
+	(void)enable;
+	cookie.sequence = _request(NULL,NULL);
+	return cookie;
+}
+
+xcb_randr_get_screen_resources_current_cookie_t
+xcb_randr_get_screen_resources_current(xcb_connection_t *c,
+		xcb_window_t window){
+	xcb_randr_get_screen_resources_current_cookie_t cookie;
+	xcb_randr_get_screen_resources_current_reply_t *reply;
+	xcb_randr_crtc_t *crtcs;
+	int i;
+	(void)c;
+	(void)window;
+	reply = _reply(sizeof(*reply),
+			mock_xcb.crtc_count*sizeof(xcb_randr_crtc_t));
+	reply->num_crtcs = (uint16_t)mock_xcb.crtc_count;
+	reply->num_outputs = (uint16_t)(mock_xcb.crtc_count*MOCK_XCB_OUTPUTS);
+	crtcs = xcb_randr_get_screen_resources_current_crtcs(reply);
+	for( i=0; i<mock_xcb.crtc_count; ++i )
+		crtcs[i] = MOCK_XCB_CRTC_ID(i);
+	cookie.sequence = _request(reply,NULL);
+	return cookie;
+}
+
+xcb_randr_get_screen_resources_current_reply_t *
+xcb_randr_get_screen_resources_current_reply(xcb_connection_t *c,
+		xcb_randr_get_screen_resources_current_cookie_t cookie,
+		xcb_generic_error_t **e){
+	(void)c;
+	return _take(cookie.sequence,e);
+}
+
+xcb_randr_crtc_t *xcb_randr_get_screen_resources_current_crtcs(
+		const xcb_randr_get_screen_resources_current_reply_t *R){
+	return (xcb_randr_crtc_t*)(R+1);
+}
+
+xcb_randr_get_crtc_info_cookie_t xcb_randr_get_crtc_info(xcb_connection_t *c,
+		xcb_randr_crtc_t crtc, xcb_timestamp_t config_timestamp){
+	xcb_randr_get_crtc_info_cookie_t cookie;
+	xcb_randr_get_crtc_info_reply_t *reply;
+	mock_xcb_crtc_s *state = _crtc(crtc);
+	int i;
+	(void)c;
+	(void)config_timestamp;
+	if( state==NULL ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_VALUE));
+		return cookie;
+	}
+	reply = _reply(sizeof(*reply),
+			MOCK_XCB_OUTPUTS*sizeof(xcb_randr_output_t));
+	if( state->enabled ){
+		xcb_randr_output_t *outputs = xcb_randr_get_crtc_info_outputs(reply);
+		reply->mode = 1;
+		reply->num_outputs = MOCK_XCB_OUTPUTS;
+		for( i=0; i<MOCK_XCB_OUTPUTS; ++i )
+			outputs[i] = MOCK_XCB_OUTPUT_ID(crtc-MOCK_XCB_CRTC_ID(0),i);
+	}
+	cookie.sequence = _request(reply,NULL);
+	return cookie;
+}
+
+xcb_randr_get_crtc_info_reply_t *xcb_randr_get_crtc_info_reply(
+		xcb_connection_t *c, xcb_randr_get_crtc_info_cookie_t cookie,
+		xcb_generic_error_t **e){
+	(void)c;
+	return _take(cookie.sequence,e);
+}
+
+xcb_randr_output_t *xcb_randr_get_crtc_info_outputs(
+		const xcb_randr_get_crtc_info_reply_t *R){
+	return (xcb_randr_output_t*)(R+1);
+}
+
+int xcb_randr_get_crtc_info_outputs_length(
+		const xcb_randr_get_crtc_info_reply_t *R){
+	return R->num_outputs;
+}
+
+xcb_randr_get_crtc_gamma_size_cookie_t xcb_randr_get_crtc_gamma_size(
+		xcb_connection_t *c, xcb_randr_crtc_t crtc){
+	xcb_randr_get_crtc_gamma_size_cookie_t cookie;
+	xcb_randr_get_crtc_gamma_size_reply_t *reply;
+	mock_xcb_crtc_s *state = _crtc(crtc);
+	(void)c;
+	if( state==NULL ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_VALUE));
+		return cookie;
+	}
+	reply = _reply(sizeof(*reply),0);
+	reply->size = (uint16_t)state->ramp_size;
+	cookie.sequence = _request(reply,NULL);
+	return cookie;
+}
+
+xcb_randr_get_crtc_gamma_size_reply_t *xcb_randr_get_crtc_gamma_size_reply(
+		xcb_connection_t *c, xcb_randr_get_crtc_gamma_size_cookie_t cookie,
+		xcb_generic_error_t **e){
+	(void)c;
+	return _take(cookie.sequence,e);
+}
+
+xcb_randr_get_crtc_gamma_cookie_t xcb_randr_get_crtc_gamma(
+		xcb_connection_t *c, xcb_randr_crtc_t crtc){
+	xcb_randr_get_crtc_gamma_cookie_t cookie;
+	xcb_randr_get_crtc_gamma_reply_t *reply;
+	mock_xcb_crtc_s *state = _crtc(crtc);
+	(void)c;
+	if( state==NULL ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_VALUE));
+		return cookie;
+	}
+	reply = _reply(sizeof(*reply),3*state->ramp_size*sizeof(uint16_t));
+	reply->size = (uint16_t)state->ramp_size;
+	memcpy(xcb_randr_get_crtc_gamma_red(reply),state->ramp,
+			3*state->ramp_size*sizeof(uint16_t));
+	cookie.sequence = _request(reply,NULL);
+	return cookie;
+}
+
+xcb_randr_get_crtc_gamma_reply_t *xcb_randr_get_crtc_gamma_reply(
+		xcb_connection_t *c, xcb_randr_get_crtc_gamma_cookie_t cookie,
+		xcb_generic_error_t **e){
+	(void)c;
+	return _take(cookie.sequence,e);
+}
+
+uint16_t *xcb_randr_get_crtc_gamma_red(
+		const xcb_randr_get_crtc_gamma_reply_t *R){
+	return (uint16_t*)(R+1);
+}
+
+int xcb_randr_get_crtc_gamma_red_length(
+		const xcb_randr_get_crtc_gamma_reply_t *R){
+	return R->size;
+}
+
+uint16_t *xcb_randr_get_crtc_gamma_green(
+		const xcb_randr_get_crtc_gamma_reply_t *R){
+	return xcb_randr_get_crtc_gamma_red(R)+R->size;
+}
+
+uint16_t *xcb_randr_get_crtc_gamma_blue(
+		const xcb_randr_get_crtc_gamma_reply_t *R){
+	return xcb_randr_get_crtc_gamma_red(R)+2*R->size;
+}
+
+int xcb_randr_get_crtc_gamma_blue_length(
+		const xcb_randr_get_crtc_gamma_reply_t *R){
+	return R->size;
+}
+
+xcb_void_cookie_t xcb_randr_set_crtc_gamma_checked(xcb_connection_t *c,
+		xcb_randr_crtc_t crtc, uint16_t size, const uint16_t *red,
+		const uint16_t *green, const uint16_t *blue){
+	xcb_void_cookie_t cookie;
+	mock_xcb_crtc_s *state = _crtc(crtc);
+	(void)c;
+	if( (state==NULL) || state->reject_gamma ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_VALUE));
+		return cookie;
+	}
+	if( size!=state->ramp_size ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_MATCH));
+		return cookie;
+	}
+	memcpy(state->ramp,red,size*sizeof(uint16_t));
+	memcpy(state->ramp+size,green,size*sizeof(uint16_t));
+	memcpy(state->ramp+2*size,blue,size*sizeof(uint16_t));
+	++state->gamma_sets;
+	cookie.sequence = _request(NULL,NULL);
+	return cookie;
+}
+
+xcb_randr_query_output_property_cookie_t xcb_randr_query_output_property(
+		xcb_connection_t *c, xcb_randr_output_t output, xcb_atom_t property){
+	xcb_randr_query_output_property_cookie_t cookie;
+	xcb_randr_query_output_property_reply_t *reply;
+	mock_xcb_output_s *state = _output(output);
+	(void)c;
+	if( (state==NULL) || !state->ctm || (property!=MOCK_XCB_CTM_ATOM) ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_NAME));
+		return cookie;
+	}
+	reply = _reply(sizeof(*reply),0);
+	reply->immutable = (uint8_t)state->immutable;
+	cookie.sequence = _request(reply,NULL);
+	return cookie;
+}
+
+xcb_randr_query_output_property_reply_t *
+xcb_randr_query_output_property_reply(xcb_connection_t *c,
+		xcb_randr_query_output_property_cookie_t cookie,
+		xcb_generic_error_t **e){
+	(void)c;
+	return _take(cookie.sequence,e);
+}
+
+xcb_void_cookie_t xcb_randr_change_output_property_checked(
+		xcb_connection_t *c, xcb_randr_output_t output, xcb_atom_t property,
+		xcb_atom_t type, uint8_t format, uint8_t mode, uint32_t num_units,
+		const void *data){
+	xcb_void_cookie_t cookie;
+	mock_xcb_output_s *state = _output(output);
+	(void)c;
+	if( (state==NULL) || !state->ctm || (property!=MOCK_XCB_CTM_ATOM) ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_NAME));
+		return cookie;
+	}
+	if( (type!=XCB_ATOM_INTEGER) || (format!=32)
+			|| (mode!=XCB_PROP_MODE_REPLACE)
+			|| (num_units!=MOCK_XCB_CTM_ITEMS) ){
+		state->ctm_malformed = 1;
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_MATCH));
+		return cookie;
+	}
+	if( state->immutable || state->reject_ctm ){
+		cookie.sequence = _request(NULL,_error(MOCK_BAD_MATCH));
+		return cookie;
+	}
+	memcpy(state->ctm_items,data,sizeof(state->ctm_items));
+	++state->ctm_sets;
+	cookie.sequence = _request(NULL,NULL);
+	return cookie;
+}
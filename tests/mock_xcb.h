@@ -0,0 +1,93 @@
+/**\file		mock_xcb.h
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Simulated X server behind the stand-in XCB headers.
+ * \details Requests are answered as they are made, but replies and errors
+ * only become visible once the client waits for them. The first wait after
+ * new requests counts as a round trip and answers everything sent so far,
+ * like flushing and waiting on a real connection does.
+ *
+ * Every CRTC has the same number of outputs, each of which has a CTM
+ * property unless turned off. Tests set the server up with
+ * mock_xcb_reset(), then adjust the fields below before connecting.
+ */
+
+#ifndef __MOCK_XCB_CTL_H__
+#define __MOCK_XCB_CTL_H__
+
+#include <xcb/xcb.h>
+
+/**\brief Most CRTCs of the server */
+#define MOCK_XCB_CRTCS		8
+/**\brief Outputs of each CRTC */
+#define MOCK_XCB_OUTPUTS	2
+/**\brief Largest ramp size */
+#define MOCK_XCB_RAMP		4096
+/**\brief Items of the CTM property */
+#define MOCK_XCB_CTM_ITEMS	18
+/**\brief Atom of the CTM property */
+#define MOCK_XCB_CTM_ATOM	300
+/**\brief Id of a CRTC */
+#define MOCK_XCB_CRTC_ID(C)	(100+(C))
+/**\brief Id of an output */
+#define MOCK_XCB_OUTPUT_ID(C,K)	(200+(C)*MOCK_XCB_OUTPUTS+(K))
+
+/**\brief Output state */
+typedef struct{
+	/**\brief set if the output has a CTM property */
+	int ctm;
+	/**\brief set if the CTM property cannot be changed */
+	int immutable;
+	/**\brief set to fail CTM changes with BadMatch */
+	int reject_ctm;
+	/**\brief last CTM written */
+	uint32_t ctm_items[MOCK_XCB_CTM_ITEMS];
+	/**\brief number of CTM changes */
+	int ctm_sets;
+	/**\brief set once a CTM change had the wrong type, format, mode or
+	 * length */
+	int ctm_malformed;
+} mock_xcb_output_s;
+
+/**\brief CRTC state */
+typedef struct{
+	/**\brief set if the CRTC has a mode */
+	int enabled;
+	/**\brief ramp size */
+	int ramp_size;
+	/**\brief current red, green and blue ramps */
+	uint16_t ramp[3*MOCK_XCB_RAMP];
+	/**\brief number of ramp changes */
+	int gamma_sets;
+	/**\brief set to fail ramp changes with BadValue */
+	int reject_gamma;
+	/**\brief outputs */
+	mock_xcb_output_s outputs[MOCK_XCB_OUTPUTS];
+} mock_xcb_crtc_s;
+
+/**\brief Server state */
+typedef struct{
+	/**\brief number of CRTCs */
+	int crtc_count;
+	/**\brief CRTCs */
+	mock_xcb_crtc_s crtcs[MOCK_XCB_CRTCS];
+	/**\brief set if the server knows the CTM atom */
+	int ctm_atom;
+	/**\brief requests made */
+	long requests;
+	/**\brief times the client waited on the server */
+	long round_trips;
+	/**\brief microseconds each round trip takes */
+	unsigned int latency_us;
+} mock_xcb_s;
+
+/**\brief The simulated server */
+extern mock_xcb_s mock_xcb;
+
+/**\brief Sets up a server with enabled CRTCs and CTM support on every
+ * output, ramps start out linear
+ * \details Replies not collected by the last test are dropped.
+ */
+void mock_xcb_reset(int crtc_count, int ramp_size);
+
+#endif//__MOCK_XCB_CTL_H__
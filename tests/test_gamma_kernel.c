@@ -0,0 +1,148 @@
+/**\file		test_gamma_kernel.c
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Checks that every ramp kernel matches the scalar one.
+ * \details Builds the kernels into this file so each can be called directly,
+ * not just the one picked for this CPU. Curves are made the way gamma.c
+ * makes them, and also include values outside 0-1 to exercise clamping.
+ */
+
+#include "gamma_kernel.c"
+#include "gamma.h"
+#include "gamma_vals.h"
+
+#define SIZEOF(X) (sizeof(X)/sizeof(X[0]))
+
+/* Largest ramp size tested */
+#define TEST_MAX_SIZE	4100
+/* Entries past the end of the ramp that must stay untouched */
+#define TEST_GUARD	16
+/* Temperatures of the table tried as white point, every n-th */
+#define TEST_TEMP_STRIDE	10
+/* Value the guard entries are filled with */
+#define TEST_GUARD_VAL	0xA5A5
+
+/**\brief Kernel under test */
+typedef struct{
+	/**\brief name */
+	const char *name;
+	/**\brief kernel, NULL if not built or not supported */
+	/*@null@*/ gamma_kernel_fn fn;
+} test_kernel_s;
+
+static const int sizes[]={0,1,2,3,7,8,9,15,16,17,31,32,33,255,256,257,
+	1023,1024,1025,2048,4095,4096,4097};
+static const float tweaks[]={0.1f,0.5f,0.8f,1.0f,1.5f,2.2f,3.0f,10.0f};
+static const float brightnesses[]={0.1f,0.333f,0.5f,0.75f,0.999f,1.0f};
+
+static double curve[TEST_MAX_SIZE+1];
+static uint16_t expect[TEST_MAX_SIZE+TEST_GUARD];
+static uint16_t got[TEST_MAX_SIZE+TEST_GUARD];
+
+// Fills a curve the way gamma.c does, offset selects the first entry so
+// that the vector kernels also run on unaligned input
+static void _fill_curve(int size, float tweak, int offset){
+	int i;
+	for( i=0; i<size; ++i )
+		curve[offset+i] = pow((float)i/size,1.0f/tweak);
+}
+
+// Fills a curve with values around and outside 0-1, in double precision
+static void _fill_edges(int size, int offset){
+	static const double edges[]={0.0,1e-9,0.5,0.99999,1.0,
+		1.0+1e-12,1.5,1e6,-0.0};
+	int i;
+	for( i=0; i<size; ++i )
+		curve[offset+i] = edges[i%SIZEOF(edges)];
+}
+
+// Runs one kernel on the current curve, returns 0 on any mismatch
+static int _check(const test_kernel_s *k, int size, int offset,
+		float white, float brightness){
+	int i;
+
+	for( i=0; i<size+TEST_GUARD; ++i )
+		got[i] = TEST_GUARD_VAL;
+	k->fn(curve+offset,size,white,brightness,got);
+	if( memcmp(expect,got,sizeof(uint16_t)*size)!=0 ){
+		for( i=0; (i<size) && (expect[i]==got[i]); ++i )
+			;
+		printf("%s: size %d, offset %d, white %.4f, brightness %.3f: "
+				"entry %d is %u, scalar gives %u\n",k->name,size,offset,
+				white,brightness,i,got[i],expect[i]);
+		return 0;
+	}
+	for( i=size; i<size+TEST_GUARD; ++i )
+		if( got[i]!=TEST_GUARD_VAL ){
+			printf("%s: size %d wrote past the end of the ramp\n",
+					k->name,size);
+			return 0;
+		}
+	return 1;
+}
+
+// Compares every kernel against the scalar one on the current curve
+static int _compare(test_kernel_s *kernels, int cnt, int size, int offset,
+		float white, float brightness, long *checks){
+	int i;
+	int ok = 1;
+
+	_scale_scalar(curve+offset,size,white,brightness,expect);
+	for( i=0; i<cnt; ++i ){
+		if( !kernels[i].fn )
+			continue;
+		ok = _check(&kernels[i],size,offset,white,brightness) && ok;
+		++(*checks);
+	}
+	return ok;
+}
+
+int main(void){
+	test_kernel_s kernels[]={
+		{"SSE2",NULL},
+		{"AVX",NULL}
+	};
+	int cnt = (int)SIZEOF(kernels);
+	long checks = 0;
+	int failed = 0;
+	int s,t,b,c,k;
+
+	(void)log_init(NULL,LOGBOOL_FALSE,NULL);
+#ifdef GAMMA_KERNEL_SSE2
+	kernels[0].fn = &_scale_sse2;
+#endif
+#ifdef GAMMA_KERNEL_AVX
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx") )
+		kernels[1].fn = &_scale_avx;
+#endif
+	for( k=0; k<cnt; ++k )
+		printf("%s kernel: %s\n",kernels[k].name,
+				kernels[k].fn ? "tested" : "not available, skipped");
+
+	for( s=0; s<(int)SIZEOF(sizes); ++s ){
+		int size = sizes[s];
+		int offset = s%2;
+		for( t=0; t<(int)SIZEOF(tweaks); ++t ){
+			_fill_curve(size,tweaks[t],offset);
+			/* Every channel of the temperatures tried as white point */
+			for( c=0; c<(int)SIZEOF(blackbody_color); c+=TEST_TEMP_STRIDE )
+				for( b=0; b<(int)SIZEOF(brightnesses); ++b ){
+					const gamma_s *w = &blackbody_color[c].gamma;
+					failed += !_compare(kernels,cnt,size,offset,w->r,
+							brightnesses[b],&checks);
+					failed += !_compare(kernels,cnt,size,offset,w->g,
+							brightnesses[b],&checks);
+					failed += !_compare(kernels,cnt,size,offset,w->b,
+							brightnesses[b],&checks);
+				}
+		}
+		_fill_edges(size,offset);
+		for( b=0; b<(int)SIZEOF(brightnesses); ++b )
+			failed += !_compare(kernels,cnt,size,offset,1.0f,
+					brightnesses[b],&checks);
+	}
+	printf("%ld comparisons, %d failed\n",checks,failed);
+	log_end();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/**\file		test_map_lut.c
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Checks that the compiled map matches walking the map.
+ * \details Builds gamma.c into this file to reach the walk it falls back
+ * on. Elevations are tried densely across the whole range, at and next to
+ * every breakpoint and bucket edge, for the default map and for maps set
+ * with opt_parse_map(), including one the compiled map cannot hold.
+ */
+
+/* Only the map is under test, the Null method stands in for all */
+#undef ENABLE_WAYLAND
+#undef ENABLE_RANDR
+#undef ENABLE_VIDMODE
+#undef ENABLE_WINGDI
+#ifndef ENABLE_NULL
+# define ENABLE_NULL
+#endif
+#include "gamma.c"
+
+/* Elevations tried per degree across the whole range */
+#define TEST_PER_DEGREE	1000
+/* Day and night temperatures, far apart so small errors show */
+#define TEST_TEMP_DAY	25000
+#define TEST_TEMP_NIGHT	1000
+
+static int failed = 0;
+
+#define CHECK(X)	do{ if( !(X) ){ \
+	printf("%s:%d: check failed: %s\n",__FILE__,__LINE__,#X); \
+	++failed; } }while(0)
+
+/* Stand-in for the Null method, never loaded here */
+int null_load_funcs(gamma_method_s *method){
+	(void)method;
+	return RET_FUN_SUCCESS;
+}
+
+/* Stand-ins for the worker, never started here */
+int gamma_worker_running(void){
+	return 0;
+}
+
+void gamma_worker_stop(void){
+}
+
+int gamma_worker_set_temperature(int temp, gamma_s gamma, float brightness,
+		gamma_s tweak){
+	(void)temp;
+	(void)gamma;
+	(void)brightness;
+	(void)tweak;
+	return RET_FUN_FAILED;
+}
+
+int gamma_worker_restore(void){
+	return RET_FUN_FAILED;
+}
+
+int gamma_worker_get_temperature(void){
+	return 0;
+}
+
+int gamma_worker_verify_temperature(void){
+	return 0;
+}
+
+// Checks one elevation against the walk, returns 0 on a mismatch
+static int _matches(double elevation){
+	double perc = gamma_calc_perc_walk(elevation);
+	int expect = (perc<0.0) ? 0 : (int)((0.01*perc)
+			*(TEST_TEMP_DAY-TEST_TEMP_NIGHT)+TEST_TEMP_NIGHT);
+	int got = gamma_calc_temp(elevation,TEST_TEMP_DAY,TEST_TEMP_NIGHT);
+
+	if( got==expect )
+		return 1;
+	printf("  elevation %.17g: %dK, walking gives %dK\n",elevation,got,expect);
+	return 0;
+}
+
+// Checks an elevation and the doubles either side of it
+static int _matches_around(double elevation){
+	double around[3];
+	int bad = 0;
+	int k;
+
+	around[0] = elevation;
+	around[1] = nextafter(elevation,DBL_MAX);
+	around[2] = nextafter(elevation,-DBL_MAX);
+	for( k=0; k<3; ++k )
+		if( (around[k]>=-180.0) && (around[k]<=180.0) )
+			bad += !_matches(around[k]);
+	return bad;
+}
+
+// Checks the current map, returns the number of mismatches
+static int _check_map(const char *name){
+	const map_lut_s *lut = opt_get_map_lut();
+	pair *map;
+	int size;
+	int bad = 0;
+	int i;
+
+	for( i=0; i<=360*TEST_PER_DEGREE; ++i )
+		bad += !_matches(-180.0+(double)i/TEST_PER_DEGREE);
+	map = opt_get_map(&size);
+	for( i=0; i<size; ++i )
+		bad += _matches_around(map[i].elev);
+	for( i=0; i<=MAP_LUT_SIZE; ++i )
+		bad += _matches_around(-180.0+i*MAP_LUT_STEP);
+	if( bad )
+		printf("%s map (%s): %d mismatches\n",name,
+				lut->valid ? "compiled" : "walked",bad);
+	return bad;
+}
+
+// Sets a map, the string is parsed in place
+static int _set_map(const char *map){
+	char buf[256];
+	strncpy(buf,map,sizeof(buf)-1);
+	buf[sizeof(buf)-1] = '\0';
+	return opt_parse_map(buf);
+}
+
+// The default map and custom maps are compiled and match the walk
+static void test_compiled(void){
+	CHECK(opt_get_map_lut()->valid);
+	CHECK(_check_map("default")==0);
+
+	CHECK(_set_map("170,100;10,100;10,0;-10,0;-10,50;-170,50;"));
+	CHECK(opt_get_map_lut()->valid);
+	CHECK(_check_map("vertical steps")==0);
+
+	CHECK(_set_map("179.95,100;0.05,100;0,0;-179.95,0;"));
+	CHECK(opt_get_map_lut()->valid);
+	CHECK(_check_map("bucket edges")==0);
+
+	CHECK(_set_map("175,100;2.333333,63.7;-4.1,12.5;-12.7,0;-170.2,0;"));
+	CHECK(opt_get_map_lut()->valid);
+	CHECK(_check_map("uneven")==0);
+}
+
+// Breakpoints closer than a bucket leave the map to be walked
+static void test_fallback(void){
+	CHECK(_set_map("90,100;3.01,80;3.0,20;-90,0;"));
+	CHECK(!opt_get_map_lut()->valid);
+	CHECK(_check_map("close breakpoints")==0);
+}
+
+int main(int argc, char *argv[]){
+	(void)argc;
+	(void)log_init(NULL,LOGBOOL_FALSE,NULL);
+	(void)log_setlevel(LOGWARN);
+	opt_init(argv[0]);
+	test_compiled();
+	test_fallback();
+	opt_free();
+	printf("%d checks failed\n",failed);
+	log_end();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,319 @@
+/**\file		test_randr.c
+ * \author		Mao Yu
+ * \date		Sunday, October 18, 2026
+ * \brief		Runs the RANDR backend against a simulated X server.
+ * \details The backend is built into this file against the stand-in XCB
+ * headers in tests/mock, see mock_xcb.h. The gamma layer is replaced by the
+ * stand-ins below so that ramps are known and every upload passes.
+ */
+
+#include "backends/randr.c"
+#include "mock_xcb.h"
+
+/* Ramp size of the simulated CRTCs */
+#define TEST_RAMP_SIZE	256
+
+static int failed = 0;
+static uint16_t test_ramp[3*MOCK_XCB_RAMP];
+/* Value the --verify-gamma stand-in reports */
+static int test_verify = 0;
+/* White point the stand-in reports, only used while test_white is set */
+static int test_white = 0;
+static float test_scale[3] = {1.0f,1.0f,1.0f};
+
+#define CHECK(X)	do{ if( !(X) ){ \
+	printf("%s:%d: check failed: %s\n",__FILE__,__LINE__,#X); \
+	++failed; } }while(0)
+
+/* Stand-ins for the gamma layer, ramps hold the temperature throughout */
+gamma_ramp_s gamma_ramp_fill(int size, int temp){
+	gamma_ramp_s ramp;
+	int i;
+
+	for( i=0; i<3*size; ++i )
+		test_ramp[i] = (uint16_t)temp;
+	ramp.all = test_ramp;
+	ramp.r = test_ramp;
+	ramp.g = test_ramp+size;
+	ramp.b = test_ramp+2*size;
+	ramp.size = size;
+	return ramp;
+}
+
+gamma_ramp_s gamma_ramp_identity(int size){
+	return gamma_ramp_fill(size,0xFFFF);
+}
+
+int gamma_white_scale(int temp, float *scale){
+	(void)temp;
+	scale[0] = test_scale[0];
+	scale[1] = test_scale[1];
+	scale[2] = test_scale[2];
+	return test_white ? RET_FUN_SUCCESS : RET_FUN_FAILED;
+}
+
+int gamma_gate_pass(int key, gamma_ramp_s ramp){
+	(void)key;
+	(void)ramp;
+	return RET_FUN_SUCCESS;
+}
+
+void gamma_gate_reset(void){
+}
+
+int gamma_find_temp(float ratio){
+	return (int)ratio;
+}
+
+int opt_get_verify_gamma(void){
+	return test_verify;
+}
+
+// Checks whether a CRTC of the server has the ramps for a temperature
+static int _has_temp(int crtc, int temp){
+	int i;
+	for( i=0; i<3*mock_xcb.crtcs[crtc].ramp_size; ++i )
+		if( mock_xcb.crtcs[crtc].ramp[i]!=(uint16_t)temp )
+			return 0;
+	return 1;
+}
+
+// Checks whether a CRTC of the server has linear ramps, as set up
+static int _has_linear(int crtc){
+	int size = mock_xcb.crtcs[crtc].ramp_size;
+	int c,k;
+	for( c=0; c<3; ++c )
+		for( k=0; k<size; ++k )
+			if( mock_xcb.crtcs[crtc].ramp[c*size+k]
+					!=(uint16_t)(k*65535/(size-1)) )
+				return 0;
+	return 1;
+}
+
+// Checks whether all outputs of a CRTC have a CTM scaling by the S31.32
+// diagonal given as low and high words, and zero elsewhere
+static int _has_ctm(int crtc, const uint32_t *diagonal){
+	int k,n;
+	for( k=0; k<MOCK_XCB_OUTPUTS; ++k ){
+		const mock_xcb_output_s *output = &mock_xcb.crtcs[crtc].outputs[k];
+		if( output->ctm_malformed )
+			return 0;
+		for( n=0; n<MOCK_XCB_CTM_ITEMS; ++n ){
+			uint32_t expect = 0;
+			if( (n/2)%4==0 )
+				expect = diagonal[2*(n/8)+(n%2)];
+			if( output->ctm_items[n]!=expect )
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static const uint32_t ctm_identity[6] = {0,1,0,1,0,1};
+
+// Every step of a transition waits for the server once, however many
+// CRTCs there are
+static void test_one_round_trip(void){
+	gamma_s gamma = {1.0f,1.0f,1.0f};
+	int count,i;
+
+	for( count=1; count<=MOCK_XCB_CRTCS; ++count ){
+		long before;
+		mock_xcb_reset(count,TEST_RAMP_SIZE);
+		mock_xcb.ctm_atom = 0;
+		CHECK(randr_init(-1,-1,0));
+		before = mock_xcb.round_trips;
+		CHECK(randr_set_temperature(4500,gamma));
+		CHECK(mock_xcb.round_trips-before==1);
+		before = mock_xcb.round_trips;
+		CHECK(randr_set_temperature(4400,gamma));
+		CHECK(mock_xcb.round_trips-before==1);
+		for( i=0; i<count; ++i ){
+			CHECK(_has_temp(i,4400));
+			CHECK(mock_xcb.crtcs[i].gamma_sets==2);
+		}
+		(void)randr_free();
+	}
+}
+
+// An upload the server rejects fails the step it belongs to
+static void test_rejected_upload(void){
+	gamma_s gamma = {1.0f,1.0f,1.0f};
+
+	mock_xcb_reset(3,TEST_RAMP_SIZE);
+	mock_xcb.ctm_atom = 0;
+	CHECK(randr_init(-1,-1,0));
+	mock_xcb.crtcs[1].reject_gamma = 1;
+	CHECK(!randr_set_temperature(4500,gamma));
+	CHECK(_has_temp(0,4500));
+	CHECK(_has_temp(2,4500));
+	mock_xcb.crtcs[1].reject_gamma = 0;
+	CHECK(randr_set_temperature(4500,gamma));
+	CHECK(_has_temp(1,4500));
+	(void)randr_free();
+}
+
+// A white point goes into a CTM of 18 S31.32 items, diagonal only, with
+// identity ramps, and is not sent again while unchanged
+static void test_ctm_encoding(void){
+	gamma_s gamma = {1.0f,1.0f,1.0f};
+	const uint32_t diagonal[6] = {0,1,0xC0000000u,0,0x80000000u,0};
+	int i;
+
+	mock_xcb_reset(2,TEST_RAMP_SIZE);
+	CHECK(randr_init(-1,-1,0));
+	test_white = 1;
+	test_scale[0] = 1.0f;
+	test_scale[1] = 0.75f;
+	test_scale[2] = 0.5f;
+	CHECK(randr_set_temperature(4500,gamma));
+	for( i=0; i<2; ++i ){
+		CHECK(_has_ctm(i,diagonal));
+		CHECK(_has_temp(i,0xFFFF));
+		CHECK(mock_xcb.crtcs[i].outputs[0].ctm_sets==1);
+	}
+	CHECK(randr_set_temperature(4400,gamma));
+	for( i=0; i<2; ++i )
+		CHECK(mock_xcb.crtcs[i].outputs[0].ctm_sets==1);
+
+	/* No white point to give, the CTM goes back to identity */
+	test_white = 0;
+	CHECK(randr_set_temperature(4300,gamma));
+	for( i=0; i<2; ++i ){
+		CHECK(_has_ctm(i,ctm_identity));
+		CHECK(_has_temp(i,4300));
+	}
+	(void)randr_free();
+}
+
+// CRTCs whose outputs cannot take a CTM use ramps
+static void test_ctm_fallback(void){
+	gamma_s gamma = {1.0f,1.0f,1.0f};
+	int i;
+
+	test_white = 1;
+	test_scale[0] = 1.0f;
+	test_scale[1] = 0.75f;
+	test_scale[2] = 0.5f;
+
+	/* Rejected on the first change */
+	mock_xcb_reset(3,TEST_RAMP_SIZE);
+	CHECK(randr_init(-1,-1,0));
+	mock_xcb.crtcs[1].outputs[1].reject_ctm = 1;
+	CHECK(randr_set_temperature(4500,gamma));
+	CHECK(_has_temp(0,0xFFFF));
+	CHECK(_has_temp(1,4500));
+	CHECK(_has_temp(2,0xFFFF));
+	CHECK(randr_set_temperature(4400,gamma));
+	CHECK(_has_temp(1,4400));
+	CHECK(mock_xcb.crtcs[1].outputs[1].ctm_sets==0);
+	(void)randr_free();
+
+	/* Immutable property */
+	mock_xcb_reset(2,TEST_RAMP_SIZE);
+	CHECK(randr_init(-1,-1,0));
+	mock_xcb.crtcs[0].outputs[1].immutable = 1;
+	CHECK(randr_set_temperature(4500,gamma));
+	CHECK(_has_temp(0,4500));
+	CHECK(mock_xcb.crtcs[0].outputs[0].ctm_sets==0);
+	CHECK(_has_temp(1,0xFFFF));
+	(void)randr_free();
+
+	/* Server without the CTM atom */
+	mock_xcb_reset(2,TEST_RAMP_SIZE);
+	mock_xcb.ctm_atom = 0;
+	CHECK(randr_init(-1,-1,0));
+	CHECK(randr_set_temperature(4500,gamma));
+	for( i=0; i<2; ++i ){
+		CHECK(_has_temp(i,4500));
+		CHECK(mock_xcb.crtcs[i].outputs[0].ctm_sets==0);
+	}
+	(void)randr_free();
+	test_white = 0;
+}
+
+// Restoring resets the CTM of every CRTC, and brings back the saved ramps
+// when there are some
+static void test_restore(void){
+	gamma_s gamma = {1.0f,1.0f,1.0f};
+	int save,i;
+
+	test_white = 1;
+	test_scale[0] = 1.0f;
+	test_scale[1] = 0.75f;
+	test_scale[2] = 0.5f;
+	for( save=0; save<=1; ++save ){
+		mock_xcb_reset(3,TEST_RAMP_SIZE);
+		CHECK(randr_init(-1,-1,save));
+		CHECK(randr_set_temperature(4500,gamma));
+		CHECK(randr_restore());
+		for( i=0; i<3; ++i ){
+			CHECK(_has_ctm(i,ctm_identity));
+			CHECK(save ? _has_linear(i) : _has_temp(i,0xFFFF));
+		}
+		(void)randr_free();
+	}
+	test_white = 0;
+}
+
+// Saved ramps answer temperature queries only until the first update
+static void test_saved_temperature(void){
+	gamma_s gamma = {1.0f,1.0f,1.0f};
+	int size = TEST_RAMP_SIZE;
+
+	mock_xcb_reset(1,size);
+	mock_xcb.ctm_atom = 0;
+	/* Red over blue of 4 at startup, 1 once a temperature is applied */
+	mock_xcb.crtcs[0].ramp[3*size-1] = 0x3FFF;
+	mock_xcb.crtcs[0].ramp[size-1] = 0xFFFC;
+	CHECK(randr_init(-1,-1,1));
+	CHECK(randr_get_temperature()==4);
+	mock_xcb.crtcs[0].reject_gamma = 1;
+	CHECK(!randr_set_temperature(4500,gamma));
+	CHECK(randr_get_temperature()==4);
+	mock_xcb.crtcs[0].reject_gamma = 0;
+	CHECK(randr_set_temperature(4500,gamma));
+	CHECK(randr_get_temperature()==1);
+	CHECK(randr_restore());
+	CHECK(randr_get_temperature()==4);
+	(void)randr_free();
+}
+
+// Reading back under a CTM accounts for the white point in it, the ramps
+// alone are identity
+static void test_verify_ctm(void){
+	gamma_s gamma = {1.0f,1.0f,1.0f};
+
+	test_verify = 1;
+	test_white = 1;
+	test_scale[0] = 1.0f;
+	test_scale[1] = 0.75f;
+	test_scale[2] = 0.5f;
+	mock_xcb_reset(2,TEST_RAMP_SIZE);
+	CHECK(randr_init(-1,-1,1));
+	CHECK(randr_set_temperature(4500,gamma));
+	CHECK(_has_temp(0,0xFFFF));
+	CHECK(randr_get_temperature()==2);
+
+	/* Without a white point the ramps hold it all */
+	test_white = 0;
+	CHECK(randr_set_temperature(4400,gamma));
+	CHECK(randr_get_temperature()==1);
+	(void)randr_free();
+	test_verify = 0;
+}
+
+int main(void){
+	(void)log_init(NULL,LOGBOOL_FALSE,NULL);
+	(void)log_setlevel(LOGWARN);
+	test_one_round_trip();
+	test_rejected_upload();
+	test_ctm_encoding();
+	test_ctm_fallback();
+	test_restore();
+	test_saved_temperature();
+	test_verify_ctm();
+	printf("%d checks failed\n",failed);
+	log_end();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}